@@ -626,6 +626,11 @@ bool NvEncoder::Reconfigure(const NV_ENC_RECONFIGURE_PARAMS *pReconfigureParams)
     return true;
 }
 
+bool NvEncoder::InvalidateRefFrames(uint64_t invalidRefFrameTimeStamp)
+{
+    return m_nvenc.nvEncInvalidateRefFrames(m_hEncoder, invalidRefFrameTimeStamp) == NV_ENC_SUCCESS;
+}
+
 NV_ENC_REGISTERED_PTR NvEncoder::RegisterResource(void *pBuffer, NV_ENC_INPUT_RESOURCE_TYPE eResourceType,
     int width, int height, int pitch, NV_ENC_BUFFER_FORMAT bufferFormat, NV_ENC_BUFFER_USAGE bufferUsage, 
     NV_ENC_FENCE_POINT_D3D12* pInputFencePoint)
@@ -125,6 +125,15 @@ public:
     */
     bool Reconfigure(const NV_ENC_RECONFIGURE_PARAMS *pReconfigureParams);
 
+    /**
+    *  @brief  This function is used to invalidate the reference frame that was
+    *  encoded with the input timestamp invalidRefFrameTimeStamp
+    *  (NV_ENC_PIC_PARAMS::inputTimeStamp), so that the following frames are
+    *  not predicted from it. It returns false if the encoder rejects the call,
+    *  e.g., if the frame is no longer in the reference picture buffer.
+    */
+    bool InvalidateRefFrames(uint64_t invalidRefFrameTimeStamp);
+
     /**
     *  @brief  This function is used to get the next available input buffer.
     *  Applications must call this function to obtain a pointer to the next
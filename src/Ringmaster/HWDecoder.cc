@@ -45,38 +45,135 @@ optional<size_t> Frame::frame_size() const
   return frame_size_;
 }
 
-void Frame::validate_datagram(const FrameDatagram & datagram) const
+void Frame::validate_datagram(const FrameDatagramView & datagram) const
 {
   if (datagram.frame_id != id_ or
       datagram.frame_type != type_ or
-      datagram.frag_id >= frags_.size() or
       datagram.frag_cnt != frags_.size()) {
     throw runtime_error("unable to insert an incompatible datagram");
   }
 }
 
-void Frame::insert_frag(const FrameDatagram & datagram)
+optional<uint16_t> Frame::insert_frag(const FrameDatagram & datagram)
 {
   validate_datagram(datagram);
+  if (datagram.frag_id >= frags_.size()) {
+    return insert_parity(datagram);
+  }
 
   // insert only if the datagram does not exist yet
   if (not frags_[datagram.frag_id]) {
     frame_size_ += datagram.payload.size();
     null_frags_--;
     frags_[datagram.frag_id] = datagram;
+    return try_recover(datagram.frag_id);
   }
+
+  return nullopt;
 }
 
-void Frame::insert_frag(FrameDatagram && datagram)
+optional<uint16_t> Frame::insert_frag(FrameDatagram && datagram)
 {
   validate_datagram(datagram);
+  if (datagram.frag_id >= frags_.size()) {
+    return insert_parity(datagram);
+  }
 
   // insert only if the datagram does not exist yet
+  const auto frag_id = datagram.frag_id;
+  if (not frags_[frag_id]) {
+    frame_size_ += datagram.payload.size();
+    null_frags_--;
+    frags_[frag_id] = std::move(datagram);
+    return try_recover(frag_id);
+  }
+
+  return nullopt;
+}
+
+optional<uint16_t> Frame::insert_frag(const FrameDatagramView & datagram)
+{
+  validate_datagram(datagram);
+  if (datagram.frag_id >= frags_.size()) {
+    return insert_parity(datagram);
+  }
+
+  // copy the payload out of the view only if the datagram does not exist yet
   if (not frags_[datagram.frag_id]) {
     frame_size_ += datagram.payload.size();
     null_frags_--;
-    frags_[datagram.frag_id] = std::move(datagram);
+    frags_[datagram.frag_id] = datagram.to_datagram();
+    return try_recover(datagram.frag_id);
+  }
+
+  return nullopt;
+}
+
+optional<uint16_t> Frame::insert_parity(const FrameDatagramView & datagram)
+{
+  const auto parity = XorFec::parse(datagram.payload);
+  const uint16_t group = datagram.frag_id - frags_.size();
+  if (not parity or group >= parity->num_groups or
+      (fec_groups_ != 0 and parity->num_groups != fec_groups_)) {
+    return nullopt; // ignore malformed parity
+  }
+
+  fec_groups_ = parity->num_groups;
+  if (complete() or parity_.count(group)) {
+    return nullopt;
   }
+
+  parity_.emplace(group, datagram.to_datagram());
+  return try_recover(datagram.frag_id);
+}
+
+optional<uint16_t> Frame::try_recover(const uint16_t frag_id)
+{
+  if (fec_groups_ == 0) {
+    return nullopt;
+  }
+
+  const uint16_t frag_cnt = frags_.size();
+  const uint16_t group = frag_id >= frag_cnt ? frag_id - frag_cnt
+                         : XorFec::group_of(frag_id, fec_groups_);
+  const auto parity_it = parity_.find(group);
+  if (parity_it == parity_.end()) {
+    return nullopt;
+  }
+
+  // the group's fragments are group, group + fec_groups_, ...
+  optional<uint16_t> missing;
+  vector<string_view> others;
+  for (uint32_t i = group; i < frag_cnt; i += fec_groups_) {
+    if (frags_[i]) {
+      others.push_back(frags_[i]->payload);
+    } else if (missing) {
+      return nullopt; // more than one missing
+    } else {
+      missing = i;
+    }
+  }
+
+  if (not missing) {
+    return nullopt;
+  }
+
+  const FrameDatagram & parity_datagram = parity_it->second;
+  const auto payload = XorFec::recover(XorFec::parse(parity_datagram.payload).value(), others);
+  if (not payload) {
+    return nullopt;
+  }
+
+  FrameDatagram recovered {id_, type_, *missing, frag_cnt,
+                           parity_datagram.frame_width, parity_datagram.frame_height, *payload};
+  recovered.send_ts = parity_datagram.send_ts;
+
+  frame_size_ += recovered.payload.size();
+  null_frags_--;
+  frags_[*missing] = std::move(recovered);
+  num_recovered_++;
+
+  return missing;
 }
 
 HWDecoder::HWDecoder(const uint16_t display_width,
@@ -108,7 +205,7 @@ HWDecoder::HWDecoder(const uint16_t display_width,
   }
 }
 
-bool HWDecoder::add_datagram_common(const FrameDatagram & datagram)
+bool HWDecoder::add_datagram_common(const FrameDatagramView & datagram)
 {
   const auto frame_id = datagram.frame_id;
   const auto frame_type = datagram.frame_type;
@@ -129,24 +226,53 @@ bool HWDecoder::add_datagram_common(const FrameDatagram & datagram)
   return true;
 }
 
-void HWDecoder::add_datagram(const FrameDatagram & datagram)
+optional<SeqNum> HWDecoder::on_recovered(const uint32_t frame_id,
+                                          const optional<uint16_t> frag_id)
+{
+  if (not frag_id) {
+    return nullopt;
+  }
+
+  num_recovered_frags_++;
+  if (verbose_) {
+    LOG(LogLevel::INFO) << "Recovered datagram from FEC: frame_id=" << frame_id
+         << " frag_id=" << *frag_id;
+  }
+
+  return SeqNum {frame_id, *frag_id};
+}
+
+optional<SeqNum> HWDecoder::add_datagram(const FrameDatagram & datagram)
 {
   if (not add_datagram_common(datagram)) {
-    return;
+    return nullopt;
   }
 
   // copy the fragment into the frame
-  frame_buf_.at(datagram.frame_id).insert_frag(datagram);
+  return on_recovered(datagram.frame_id,
+                      frame_buf_.at(datagram.frame_id).insert_frag(datagram));
 }
 
-void HWDecoder::add_datagram(FrameDatagram && datagram)
+optional<SeqNum> HWDecoder::add_datagram(FrameDatagram && datagram)
 {
   if (not add_datagram_common(datagram)) {
-    return;
+    return nullopt;
   }
 
   // move the fragment into the frame
-  frame_buf_.at(datagram.frame_id).insert_frag(std::move(datagram));
+  const auto frame_id = datagram.frame_id;
+  return on_recovered(frame_id, frame_buf_.at(frame_id).insert_frag(std::move(datagram)));
+}
+
+optional<SeqNum> HWDecoder::add_datagram(const FrameDatagramView & datagram)
+{
+  if (not add_datagram_common(datagram)) {
+    return nullopt;
+  }
+
+  // copy the payload into the frame (unless it is a duplicate)
+  return on_recovered(datagram.frame_id,
+                      frame_buf_.at(datagram.frame_id).insert_frag(datagram));
 }
 
 bool HWDecoder::next_frame_complete()
@@ -164,24 +290,51 @@ bool HWDecoder::next_frame_complete()
     const auto frame_id = it->first;
     const auto & frame = it->second;
 
-    // found a complete key frame ahead of next_frame_
-    if (frame.type() == FrameType::KEY and frame.complete()) {
+    // found a complete key frame (start of a refresh wave, or a frame
+    // predicted only from an LTR decoded earlier) ahead of next_frame_
+    const bool refresh = refresh_frames_ > 0 and frame.type() == FrameType::REFRESH;
+    const bool ltr_recovery = frame.type() == FrameType::RECOVERY;
+    if ((frame.type() == FrameType::KEY or refresh or ltr_recovery) and frame.complete()) {
       assert(frame_id > next_frame_);
 
       // set next_frame_ to frame_id and clean up old frames
       const auto frame_diff = frame_id - next_frame_;
       advance_next_frame(frame_diff);
+      num_frames_skipped_ += frame_diff;
+
+      // the picture is clean again once the whole wave is decoded
+      clean_frame_ = refresh ? frame_id + refresh_frames_ : frame_id;
 
       LOG(LogLevel::WARNING) << endl << "* Recovery: skipped " << frame_diff
-           << " frames ahead to key frame " << frame_id << endl;
+           << " frames ahead to "
+           << (refresh ? "refresh wave " : ltr_recovery ? "LTR recovery frame " : "key frame ")
+           << frame_id << endl;
 
       return true;
     }
   }
 
+  // blocked if any frame after next_frame_ is complete
+  if (blocked_since_us_ == 0) {
+    for (auto it = frame_buf_.upper_bound(next_frame_); it != frame_buf_.end(); it++) {
+      if (it->second.complete()) {
+        blocked_since_us_ = monotonic_us();
+        break;
+      }
+    }
+  }
+
   return false;
 }
 
+optional<uint64_t> HWDecoder::blocked_since_us() const
+{
+  if (blocked_since_us_ == 0) {
+    return nullopt;
+  }
+  return blocked_since_us_;
+}
+
 void HWDecoder::consume_next_frame()
 {
   Frame & frame = frame_buf_.at(next_frame_);
@@ -191,6 +344,7 @@ void HWDecoder::consume_next_frame()
 
   // found a decodable frame; update (and output) stats
   num_decodable_frames_++;
+  num_frames_completed_++;
   const size_t frame_size = frame.frame_size().value();
   total_decodable_frame_size_ += frame_size;
   // output stats 
@@ -205,10 +359,14 @@ void HWDecoder::consume_next_frame()
       LOG(LogLevel::INFO) << "  - Bitrate (kbps): "
            << double_to_string(total_decodable_frame_size_ * 8 / diff_ms);
     }
+    if (num_recovered_frags_ > 0) {
+      LOG(LogLevel::INFO) << "  - Datagrams recovered from FEC: " << num_recovered_frags_;
+    }
 
     // reset stats
     num_decodable_frames_ = 0;
     total_decodable_frame_size_ = 0;
+    num_recovered_frags_ = 0;
     last_stats_time_ += 1s;
   }
 
@@ -227,11 +385,17 @@ void HWDecoder::consume_next_frame()
 
   // move onto the next frame
   advance_next_frame();
+
+  if (next_frame_ == clean_frame_ and refresh_frames_ > 0) {
+    LOG(LogLevel::WARNING) << "* Recovery: picture clean again at frame "
+         << next_frame_ - 1 << " (end of the refresh wave)";
+  }
 }
 
 void HWDecoder::advance_next_frame(const unsigned int n)
 {
   next_frame_ += n;
+  blocked_since_us_ = 0;
   clean_up_to(next_frame_);
 }
 
@@ -263,7 +427,7 @@ double HWDecoder::decode_frame(const Frame & frame)
   size_t total_payload_size = 0;
 
   for (const auto & datagram : frame.frags()) {
-    const string & payload = datagram.value().payload;
+    const string_view payload = datagram.value().payload;
     if (buf_ptr + payload.size() >= buf_end) {
       throw runtime_error("frame size exceeds max decoding buffer size");
     }
@@ -372,7 +536,9 @@ void HWDecoder::worker_main()
         output_fd_->write(to_string(frame.id()) + "," +
                           to_string(frame.frame_size().value()) + "," +
                           to_string(frame_decoded_ts) + "," +
-                          to_string(decode_time_ms) + "\n"
+                          to_string(decode_time_ms) + "," +
+                          to_string(frame.num_parity()) + "," +
+                          to_string(frame.num_recovered()) + "\n"
                           );
       }
 
@@ -11,6 +11,7 @@
 #include <thread>
 
 #include "protocol.hh"
+#include "fec.hh"
 #include "sdl.hh"
 #include "file_descriptor.hh"
 
@@ -34,12 +35,15 @@ public:
         const FrameType frame_type,
         const uint16_t frag_cnt);
 
-  // Collect fragments of a frame
+  // Collect fragments of a frame; parity datagrams (frag_id >= frag_cnt)
+  // are kept aside to rebuild a missing fragment of their group
+  // return the ID of the fragment rebuilt from parity, if any
   bool has_frag(const uint16_t frag_id) const;
   FrameDatagram & get_frag(const uint16_t frag_id);
   const FrameDatagram & get_frag(const uint16_t frag_id) const;
-  void insert_frag(const FrameDatagram & datagram);
-  void insert_frag(FrameDatagram && datagram);
+  std::optional<uint16_t> insert_frag(const FrameDatagram & datagram);
+  std::optional<uint16_t> insert_frag(FrameDatagram && datagram);
+  std::optional<uint16_t> insert_frag(const FrameDatagramView & datagram); // copies the payload only if new
   bool complete() const { return null_frags_ == 0; } // if the frame has received all fragments
   std::optional<size_t> frame_size() const;
 
@@ -49,6 +53,8 @@ public:
   std::vector<std::optional<FrameDatagram>> & frags() { return frags_; }
   const std::vector<std::optional<FrameDatagram>> & frags() const { return frags_; }
   unsigned int null_frags() const { return null_frags_; }
+  unsigned int num_parity() const { return parity_.size(); }
+  unsigned int num_recovered() const { return num_recovered_; }
 
 private:
   uint32_t id_;    // frame ID
@@ -58,8 +64,19 @@ private:
   unsigned int null_frags_; // number of uninitialized fragments
   size_t frame_size_ {0}; // frame size so far
 
+  // FEC: parity datagrams by group, and the fragments rebuilt from them
+  uint16_t fec_groups_ {0}; // 0 until a parity datagram arrives
+  std::map<uint16_t, FrameDatagram> parity_ {};
+  unsigned int num_recovered_ {0};
+
   // Validate if a datagram belongs to this frame
-  void validate_datagram(const FrameDatagram & datagram) const;
+  void validate_datagram(const FrameDatagramView & datagram) const;
+
+  std::optional<uint16_t> insert_parity(const FrameDatagramView & datagram);
+
+  // rebuild the missing fragment of the group of fragment (or parity)
+  // 'frag_id' if it is the only one missing
+  std::optional<uint16_t> try_recover(const uint16_t frag_id);
 };
 
 class HWDecoder
@@ -76,8 +93,10 @@ public:
           const int lazy_level = 0,
           const std::string & output_path = "");
 
-  void add_datagram(const FrameDatagram & datagram);
-  void add_datagram(FrameDatagram && datagram);
+  // return the fragment rebuilt from FEC parity, if any
+  std::optional<SeqNum> add_datagram(const FrameDatagram & datagram);
+  std::optional<SeqNum> add_datagram(FrameDatagram && datagram);
+  std::optional<SeqNum> add_datagram(const FrameDatagramView & datagram); // copies the payload at most once
   bool next_frame_complete();
   void consume_next_frame();
 
@@ -85,10 +104,24 @@ public:
 
   // Accessors
   uint32_t next_frame() const { return next_frame_; }
+  uint64_t frames_completed() const { return num_frames_completed_; }
+  uint64_t frames_skipped() const { return num_frames_skipped_; }
+
+  // since when (in monotonic_us() time) next_frame_complete() has been
+  // false while a later frame is complete; nullopt if it is not blocked
+  std::optional<uint64_t> blocked_since_us() const;
+
+  // if the picture is still being refreshed after skipping ahead to the
+  // start of an intra-refresh wave
+  bool refreshing() const { return next_frame_ < clean_frame_; }
 
   // Mutators
   void set_verbose(const bool verbose) { verbose_ = verbose; }
 
+  // skip ahead to the start of an intra-refresh wave of 'refresh_frames'
+  // frames as to a key frame (0: only to key frames)
+  void set_refresh_frames(const uint8_t refresh_frames) { refresh_frames_ = refresh_frames; }
+
   // Forbid copying and moving
   HWDecoder(const HWDecoder & other) = delete;
   const HWDecoder & operator=(const HWDecoder & other) = delete;
@@ -105,11 +138,19 @@ private:
   bool verbose_ {false};
 
   uint32_t next_frame_ {0};  // next frame ID to decode
+  uint64_t num_frames_completed_ {0}; // totals since the start
+  uint64_t num_frames_skipped_ {0};
   std::map<uint32_t, Frame> frame_buf_ {};
+  uint64_t blocked_since_us_ {0}; // 0 if not blocked
+
+  // frames before 'clean_frame_' are decoded from an incomplete picture
+  uint8_t refresh_frames_ {0};
+  uint32_t clean_frame_ {0};
 
   // Decoding stats
   unsigned int num_decodable_frames_ {0};
   size_t total_decodable_frame_size_ {0}; // bytes
+  unsigned int num_recovered_frags_ {0};
   std::chrono::time_point<std::chrono::steady_clock> last_stats_time_ {};
 
   // Shared between main (Decoder) and wonFrame_decoded rker threads
@@ -121,7 +162,11 @@ private:
   std::thread worker_ {};
 
   // common code between the two versions of add_datagram()
-  bool add_datagram_common(const FrameDatagram & datagram);
+  bool add_datagram_common(const FrameDatagramView & datagram);
+
+  // count (and log) a fragment rebuilt from FEC parity
+  std::optional<SeqNum> on_recovered(const uint32_t frame_id,
+                                     const std::optional<uint16_t> frag_id);
 
   // advance next frame ID by 'n'
   void advance_next_frame(const unsigned int n = 1);
@@ -6,6 +6,7 @@
 #include <chrono>
 #include <algorithm>
 #include <limits>
+#include <cmath>
 
 #include "HWEncoder.hh"
 #include "conversion.hh"
@@ -27,12 +28,25 @@
 
 simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger();
 
+static const char * recovery_frame_name(const FrameType frame_type)
+{
+  switch (frame_type) {
+    case FrameType::KEY: return "key frame";
+    case FrameType::REFRESH: return "refresh wave";
+    case FrameType::RECOVERY: return "LTR recovery frame";
+    default: return "frame";
+  }
+}
+
 HWEncoder::HWEncoder(const uint16_t nWidth,
                  const uint16_t nHeight,
                  const uint16_t frame_rate,
-                 const string & output_path)
+                 const string & output_path,
+                 const uint8_t refresh_frames,
+                 const bool use_ltr)
   : nWidth_(nWidth), nHeight_(nHeight),
-    frame_rate_(frame_rate), output_fd_()
+    frame_rate_(frame_rate), output_fd_(), refresh_frames_(refresh_frames),
+    ltr_enabled_(use_ltr)
     {
   
   if (not output_path.empty()) {  // for logging
@@ -154,6 +168,66 @@ HWEncoder::HWEncoder(const uint16_t nWidth,
     }
   }
   
+  // Intra refresh on demand only (its period is longer than any stream):
+  // recovery refreshes the picture a stripe per frame over 'refresh_frames_'
+  // frames, and the recovery point SEI tells the decoder where it ends
+  if (refresh_frames_ > 0 and
+      not penc->GetCapabilityValue(pEncodeCLIOptions->GetEncodeGUID(), NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+    LOG(LogLevel::WARNING) << "Encoder does not support intra refresh; recovering with key frames";
+    refresh_frames_ = 0;
+  }
+  if (refresh_frames_ > 0) {
+    if (pEncodeCLIOptions->IsCodecH264()) {
+      auto & h264Config = encodeConfig.encodeCodecConfig.h264Config;
+      h264Config.enableIntraRefresh = 1;
+      h264Config.intraRefreshPeriod = NVENC_INFINITE_GOPLENGTH;
+      h264Config.intraRefreshCnt = refresh_frames_;
+      h264Config.outputRecoveryPointSEI = 1;
+    } else if (pEncodeCLIOptions->IsCodecHEVC()) {
+      auto & hevcConfig = encodeConfig.encodeCodecConfig.hevcConfig;
+      hevcConfig.enableIntraRefresh = 1;
+      hevcConfig.intraRefreshPeriod = NVENC_INFINITE_GOPLENGTH;
+      hevcConfig.intraRefreshCnt = refresh_frames_;
+      hevcConfig.outputRecoveryPointSEI = 1;
+    } else {
+      LOG(LogLevel::WARNING) << "Intra refresh is only used with H.264 and HEVC; recovering with key frames";
+      refresh_frames_ = 0;
+    }
+  }
+  if (refresh_frames_ > 0) {
+    LOG(LogLevel::INFO) << "Recovering with intra-refresh waves of "
+                        << static_cast<unsigned int>(refresh_frames_) << " frames";
+  }
+
+  // Long-term references marked and used per picture (not the "trust"
+  // mode that marks the first frames after an IDR)
+  if (ltr_enabled_ and
+      penc->GetCapabilityValue(pEncodeCLIOptions->GetEncodeGUID(), NV_ENC_CAPS_NUM_MAX_LTR_FRAMES)
+      < static_cast<int>(LtrTracker::NUM_SLOTS)) {
+    LOG(LogLevel::WARNING) << "Encoder does not support " << LtrTracker::NUM_SLOTS
+                           << " long-term references; not recovering with them";
+    ltr_enabled_ = false;
+  }
+  if (ltr_enabled_) {
+    if (pEncodeCLIOptions->IsCodecH264()) {
+      auto & h264Config = encodeConfig.encodeCodecConfig.h264Config;
+      h264Config.enableLTR = 1;
+      h264Config.ltrTrustMode = 0;
+      h264Config.ltrNumFrames = LtrTracker::NUM_SLOTS;
+    } else if (pEncodeCLIOptions->IsCodecHEVC()) {
+      auto & hevcConfig = encodeConfig.encodeCodecConfig.hevcConfig;
+      hevcConfig.enableLTR = 1;
+      hevcConfig.ltrTrustMode = 0;
+      hevcConfig.ltrNumFrames = LtrTracker::NUM_SLOTS;
+    } else {
+      LOG(LogLevel::WARNING) << "Long-term references are only used with H.264 and HEVC";
+      ltr_enabled_ = false;
+    }
+  }
+  if (ltr_enabled_) {
+    LOG(LogLevel::INFO) << "Recovering from acknowledged long-term references when possible";
+  }
+
   // Create the encoder interface
   pEncodeCLIOptions->SetInitParams(&initializeParams, eInputFormat);
   penc->CreateEncoder(&initializeParams);
@@ -168,8 +242,12 @@ HWEncoder::~HWEncoder()
 void HWEncoder::compress_frame(const std::unique_ptr<uint8_t[]>& pHostFrame)
 {
   const auto frame_generation_ts = timestamp_us();
+  curr_deadline_ts_ = target_latency_us_ > 0 ? frame_generation_ts + target_latency_us_ : 0;
+  purge_expired(frame_generation_ts);
+  apply_congestion_controller();
   curr_frame_type_ = FrameType::NONKEY;
   encode_frame(pHostFrame);
+  const size_t queued_bytes = output_fd_ ? send_buf_bytes() : 0;  // ahead of this frame
   const size_t frame_size = packetize_encoded_frame(vPacket, nWidth_, nHeight_);
 
   if (output_fd_) {
@@ -179,7 +257,9 @@ void HWEncoder::compress_frame(const std::unique_ptr<uint8_t[]>& pHostFrame)
                       to_string(target_bitrate_) + "," +
                       to_string(frame_size) + "," + 
                       to_string(encode_time_ms) + "," + 
-                      double_to_string(*ewma_rtt_us_ / 1000.0) + "\n"); // ms
+                      double_to_string(*ewma_rtt_us_ / 1000.0) + "," + // ms
+                      to_string(curr_num_parity_) + "," +
+                      to_string(queued_bytes) + "\n");
   }
 }
 
@@ -187,19 +267,30 @@ void HWEncoder::encode_frame(const std::unique_ptr<uint8_t[]>& pHostFrame)
 {
 
   picParams.encodePicFlags = 0;
+  picParams.inputTimeStamp = frame_id_;  // identifies the frame to nvEncInvalidateRefFrames
+  with_codec_pic_params([](auto & codec_params) {
+    codec_params.forceIntraRefreshWithFrameCnt = 0;
+    codec_params.ltrMarkFrame = 0;
+    codec_params.ltrUseFrames = 0;
+  });
   curr_frame_type_ = FrameType::UNKNOWN;
 
+  // an LTR is acknowledged once every frame up to it has been delivered
+  if (ltr_enabled_) {
+    ltr_.on_delivered_up_to(first_outstanding_frame());
+  }
+
   // Clean up if we've given up on retransmissions
   if (not unacked_.empty()) {
     const auto & first_unacked = unacked_.cbegin()->second;
     const auto us_since_first_send = timestamp_us() - first_unacked.send_ts;
 
     if (us_since_first_send > MAX_UNACKED_US) {
-      picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEINTRA;  // force an I frame
-      curr_frame_type_ = FrameType::KEY;
+      ltr_.invalidate_from(first_unacked.frame_id);
+      force_recovery_frame();
 
-      LOG(LogLevel::WARNING) << endl << "* Recovery: gave up retransmissions and forced a key frame "
-           << frame_id_ << endl;
+      LOG(LogLevel::WARNING) << endl << "* Recovery: gave up retransmissions and forced a "
+           << recovery_frame_name(curr_frame_type_) << " " << frame_id_ << endl;
       if (verbose_) {
         LOG(LogLevel::WARNING) << endl << "Giving up on lost datagram: frame_id="
              << first_unacked.frame_id << " frag_id=" << first_unacked.frag_id
@@ -213,6 +304,21 @@ void HWEncoder::encode_frame(const std::unique_ptr<uint8_t[]>& pHostFrame)
     }
   }
 
+  // the receiver cannot decode past a frame that expired before delivery
+  // or that it gave up on (PLI)
+  if (key_frame_pending_ and curr_frame_type_ == FrameType::UNKNOWN) {
+    force_recovery_frame();
+
+    if (verbose_) {
+      LOG(LogLevel::WARNING) << "Forced a recovery frame: frame_id=" << frame_id_;
+    }
+  }
+  key_frame_pending_ = false;
+
+  if (ltr_enabled_) {
+    mark_ltr();
+  }
+
   // copy host frame into the encoder input buffer
   const NvEncInputFrame* encoderInputFrame = penc->GetNextInputFrame();  // pointer to the next input buffer
 
@@ -255,46 +361,100 @@ size_t HWEncoder::packetize_encoded_frame(std::vector<std::vector<uint8_t>> &vPa
   size_t frame_size = 0;  //bytes
   
   auto frame_type  = curr_frame_type_;
-  if (frame_type == FrameType::KEY) {
+  if (frame_type == FrameType::KEY or frame_type == FrameType::REFRESH
+      or frame_type == FrameType::RECOVERY) {
     if (verbose_) {
-      cerr << "Encoded a key frame: frame_id=" << frame_id_ << endl;
+      cerr << "Encoded a " << recovery_frame_name(frame_type)
+           << ": frame_id=" << frame_id_ << endl;
     }
+
+    // the receiver skips ahead to a complete recovery frame
+    purge_superseded(frame_id_);
+    last_key_frame_ts_ = timestamp_us();
   }
 
-  // Calculate the number of fragments
-  uint16_t frag_cnt = 0;
+  // leave room for the FEC header in parity datagrams, which are as large
+  // as the largest data datagram they protect
+  const bool use_fec = fec_enabled_ and loss_rate_ >= XorFec::MIN_LOSS_RATE;
+  const size_t fec_header_size = use_fec ? XorFec::HEADER_SIZE : 0;
+
+  // bound the number of fragments with the largest header, which the
+  // sizes of the (variable-length) header fields depend on
+  const size_t min_payload = FrameDatagram::max_payload - fec_header_size;
+  uint32_t frag_id_bound = 0;
   for (const auto &packet : vPacket) {
-    if (packet.empty()) {
-      continue;
-    }
-    frag_cnt += (packet.size() + FrameDatagram::max_payload - 1) / FrameDatagram::max_payload;      
+    frag_id_bound += (packet.size() + min_payload - 1) / min_payload;
+  }
+  if (use_fec) {
+    frag_id_bound += XorFec::max_groups(frag_id_bound);
   }
   
-  // packetize the encoded frame
-  uint16_t frag_id = 0;
-  for (const auto &packet : vPacket) {
+  // move the encoded packets into a slab shared by all datagrams of this
+  // frame, including those kept in 'unacked_' and their retransmissions
+  const auto slab = make_shared<const std::vector<std::vector<uint8_t>>>(move(vPacket));
+  vPacket.clear();
+
+  // split the encoded frame into payloads, fragment 0 making room for the
+  // frame dimensions with a v2 header
+  std::vector<std::string_view> payloads;
+  for (const auto &packet : *slab) {
     size_t packet_size = packet.size();
     size_t processed = 0;  // Amount processed from the current packet
 
     while (processed < packet_size) {
-      size_t payload_size = std::min(FrameDatagram::max_payload, packet_size - processed);
+      const size_t max_payload = FrameDatagram::max_payload_of(
+          frame_id_, payloads.size(), frag_id_bound) - fec_header_size;
+      size_t payload_size = std::min(max_payload, packet_size - processed);
       const uint8_t* start_ptr = packet.data() + processed;
-      std::string_view payload(reinterpret_cast<const char*>(start_ptr), payload_size);
+      payloads.emplace_back(reinterpret_cast<const char*>(start_ptr), payload_size);
       frame_size += payload_size;
- 
-      send_buf_.emplace_back(frame_id_, frame_type, frag_id, frag_cnt, width, height, payload);
-      frag_id++;
 
       processed += payload_size;
     }
   }
 
+  // packetize the encoded frame
+  const uint16_t frag_cnt = payloads.size();
+  for (uint16_t frag_id = 0; frag_id < frag_cnt; frag_id++) {
+    auto & datagram = send_buf_.emplace_back(frame_id_, frame_type, frag_id, frag_cnt,
+                                             width, height, slab, payloads[frag_id]);
+    datagram.deadline_ts = curr_deadline_ts_;
+  }
+
+  // append the parity datagrams (frag_id >= frag_cnt), sharing a slab
+  const uint16_t num_groups = use_fec ? XorFec::num_groups(frag_cnt, loss_rate_) : 0;
+  curr_num_parity_ = num_groups;
+  if (num_groups > 0) {
+    const auto parity_slab = make_shared<const std::vector<std::string>>(
+        XorFec::encode(payloads, num_groups));
+    for (uint16_t group = 0; group < num_groups; group++) {
+      auto & datagram = send_buf_.emplace_back(frame_id_, frame_type, frag_cnt + group, frag_cnt,
+                                               width, height, parity_slab, (*parity_slab)[group]);
+      datagram.deadline_ts = curr_deadline_ts_;
+    }
+    num_parity_datagrams_ += num_groups;
+
+    if (verbose_) {
+      cerr << "FEC: frame_id=" << frame_id_ << " frag_cnt=" << frag_cnt
+           << " parity=" << num_groups << endl;
+    }
+  }
+
   frame_id_++;
   return frame_size;
 }
 
 void HWEncoder::add_unacked(const FrameDatagram & datagram)
 {
+  if (datagram.frag_id >= datagram.frag_cnt) {
+    return;  // parity is never retransmitted
+  }
+
+  if (unacked_.empty()) {  // start the retransmission timer
+    restart_rtx_timer(datagram.send_ts);
+    delivered_ts_ = first_sent_ts_ = datagram.send_ts;  // not delivering while idle
+  }
+
   const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
   auto [it, success] = unacked_.emplace(seq_num, datagram);
 
@@ -303,10 +463,20 @@ void HWEncoder::add_unacked(const FrameDatagram & datagram)
   }
 
   it->second.last_send_ts = it->second.send_ts;
+  stamp_delivery_state(it->second);
 }
 
 void HWEncoder::add_unacked(FrameDatagram && datagram)
 {
+  if (datagram.frag_id >= datagram.frag_cnt) {
+    return;  // parity is never retransmitted
+  }
+
+  if (unacked_.empty()) {  // start the retransmission timer
+    restart_rtx_timer(datagram.send_ts);
+    delivered_ts_ = first_sent_ts_ = datagram.send_ts;  // not delivering while idle
+  }
+
   const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
   auto [it, success] = unacked_.emplace(seq_num, move(datagram));
 
@@ -315,17 +485,65 @@ void HWEncoder::add_unacked(FrameDatagram && datagram)
   }
 
   it->second.last_send_ts = it->second.send_ts;
+  stamp_delivery_state(it->second);
+}
+
+void HWEncoder::requeue_unsent(const SeqNum & seq_num)
+{
+  auto it = unacked_.find(seq_num);
+  if (it == unacked_.end()) {
+    return;  // parity, or acknowledged or dropped since
+  }
+
+  if (it->second.num_rtx == 0) {
+    // the first transmission never left: it is added to 'unacked_' again
+    // once sent
+    send_buf_.emplace_front(move(it->second));
+    unacked_.erase(it);
+  } else {
+    send_buf_.emplace_front(it->second);  // a retransmission stays in 'unacked_'
+  }
 }
 
-void HWEncoder::handle_ack(const shared_ptr<AckMsg> & ack)
+void HWEncoder::stamp_delivery_state(FrameDatagram & datagram) const
+{
+  datagram.delivered = delivered_bytes_;
+  datagram.delivered_ts = delivered_ts_;
+  datagram.first_sent_ts = first_sent_ts_;
+}
+
+void HWEncoder::on_delivered(const FrameDatagram & datagram, const uint64_t now_us)
+{
+  const size_t size = datagram.payload.size();
+  delivered_bytes_ += size;
+  delivered_ts_ = now_us;
+  first_sent_ts_ = datagram.send_ts;
+
+  if (not cc_) {
+    return;
+  }
+
+  cc_->on_acked(size, now_us);
+
+  // the delivery rate while the datagram was in flight, over the longer of
+  // the send and ACK intervals so that neither a burst of sends nor of ACKs
+  // overestimates it (as in draft-cheng-iccrg-delivery-rate-estimation)
+  const uint64_t send_elapsed = datagram.send_ts - datagram.first_sent_ts;
+  const uint64_t ack_elapsed = now_us - datagram.delivered_ts;
+  cc_->on_rate_sample(delivered_bytes_ - datagram.delivered,
+                      max(send_elapsed, ack_elapsed), now_us);
+}
+
+void HWEncoder::handle_ack(const AckMsg ack)
 {
   const auto curr_ts = timestamp_us();
+  const uint64_t send_ts = extend_ts(ack.send_ts, curr_ts);  // echoed by the receiver
 
   // observed an RTT sample
-  add_rtt_sample(curr_ts - ack->send_ts);
+  add_rtt_sample(curr_ts - send_ts);
 
   // find the acked datagram in 'unacked_'
-  const auto acked_seq_num = make_pair(ack->frame_id, ack->frag_id);
+  const auto acked_seq_num = make_pair(ack.frame_id, ack.frag_id);
   auto acked_it = unacked_.find(acked_seq_num);
 
   if (acked_it == unacked_.end()) {
@@ -333,9 +551,28 @@ void HWEncoder::handle_ack(const shared_ptr<AckMsg> & ack)
     return;
   }
 
-  // retransmit all unacked datagrams before the acked one (backward)
-  for (auto rit = make_reverse_iterator(acked_it);
-       rit != unacked_.rend(); rit++) {
+  // the receiver ACKs every datagram right away, so the ACK's arrival
+  // tracks the datagram's arrival plus a reverse path delay
+  if (cc_) {
+    cc_->on_arrival(send_ts, curr_ts, acked_it->second.payload.size());
+  }
+  on_delivered(acked_it->second, curr_ts);
+
+  // retransmit all unacked datagrams before the acked one
+  retransmit_before(acked_it, curr_ts);
+
+  // finally, erase the acked datagram from 'unacked_'
+  unacked_.erase(acked_it);
+
+  // the ACK made progress
+  restart_rtx_timer(curr_ts);
+}
+
+void HWEncoder::retransmit_before(map<SeqNum, FrameDatagram>::iterator it,
+                                  const uint64_t now_us)
+{
+  // walk backward as each datagram is put at the front of 'send_buf_'
+  for (auto rit = make_reverse_iterator(it); rit != unacked_.rend(); rit++) {
     auto & datagram = rit->second;
 
     // skip if a datagram has been retransmitted MAX_NUM_RTX times
@@ -345,17 +582,400 @@ void HWEncoder::handle_ack(const shared_ptr<AckMsg> & ack)
 
     // retransmit if it's the first RTX or the last RTX was about one RTT ago
     if (datagram.num_rtx == 0 or
-        curr_ts - datagram.last_send_ts > ewma_rtt_us_.value()) {
-      datagram.num_rtx++;
-      datagram.last_send_ts = curr_ts;
+        now_us - datagram.last_send_ts > ewma_rtt_us_.value()) {
+      if (cc_) {
+        cc_->on_lost(datagram.payload.size(), now_us);
+      }
+      queue_rtx(datagram, now_us);
+    }
+  }
+}
+
+void HWEncoder::handle_sack(const SackMsg & sack)
+{
+  const auto curr_ts = timestamp_us();
+
+  // RTT sample from the echoed send timestamp minus the time the receiver
+  // held it before acknowledging
+  const uint64_t echo_send_ts = sack.echo_send_ts ? extend_ts(sack.echo_send_ts, curr_ts) : 0;
+  if (echo_send_ts != 0 and curr_ts > echo_send_ts + sack.echo_delay_us) {
+    add_rtt_sample(curr_ts - echo_send_ts - sack.echo_delay_us);
 
-      // retransmissions are more urgent
-      send_buf_.emplace_front(datagram);
+    // one timing sample per SACK: the echoed datagram arrived when the
+    // receiver started holding it
+    if (cc_) {
+      cc_->on_arrival(echo_send_ts, curr_ts - sack.echo_delay_us, 0);
     }
   }
 
-  // finally, erase the acked datagram from 'unacked_'
-  unacked_.erase(acked_it);
+  const size_t num_unacked = unacked_.size();
+
+  // every datagram before the cumulative point has been received
+  const auto cumulative_it = unacked_.lower_bound(sack.cumulative);
+  for (auto it = unacked_.begin(); it != cumulative_it; it++) {
+    on_delivered(it->second, curr_ts);
+  }
+  unacked_.erase(unacked_.begin(), cumulative_it);
+
+  // so have the datagrams in the SACK blocks
+  optional<SeqNum> highest_sacked;
+  for (unsigned int i = 0; i < sack.num_blocks; i++) {
+    const auto & block = sack.blocks[i];
+    for (unsigned int bit = 0; bit < SackMsg::BLOCK_FRAGS; bit++) {
+      if (not (block.bitmap & (uint64_t(1) << bit))) {
+        continue;
+      }
+
+      const SeqNum seq_num {block.frame_id, static_cast<uint16_t>(block.first_frag + bit)};
+      const auto it = unacked_.find(seq_num);
+      if (it != unacked_.end()) {
+        on_delivered(it->second, curr_ts);
+        unacked_.erase(it);
+      }
+      highest_sacked = max(highest_sacked.value_or(seq_num), seq_num);
+    }
+  }
+
+  // as with per-datagram ACKs, unacked datagrams before the highest
+  // acknowledged one are deemed lost
+  if (highest_sacked and ewma_rtt_us_) {
+    retransmit_before(unacked_.lower_bound(*highest_sacked), curr_ts);
+  }
+
+  if (unacked_.size() < num_unacked) {
+    restart_rtx_timer(curr_ts);  // the SACK made progress
+  }
+}
+
+void HWEncoder::queue_rtx(FrameDatagram & datagram, const uint64_t now_us)
+{
+  // too late to be of any use (purged from 'unacked_' later)
+  if (expired(datagram, now_us)) {
+    return;
+  }
+
+  datagram.num_rtx++;
+  datagram.last_send_ts = now_us;
+
+  // retransmissions are more urgent; the copy shares the payload
+  send_buf_.emplace_front(datagram);
+}
+
+bool HWEncoder::expired(const FrameDatagram & datagram, const uint64_t now_us) const
+{
+  // would arrive after the deadline, about half the min RTT from now
+  const uint64_t one_way_us = min_rtt_us_.value_or(0) / 2;
+  return datagram.deadline_ts != 0 and now_us + one_way_us > datagram.deadline_ts;
+}
+
+void HWEncoder::purge_expired(const uint64_t now_us)
+{
+  if (target_latency_us_ == 0) {
+    return;
+  }
+
+  // deadlines increase with frame IDs
+  auto it = unacked_.begin();
+  while (it != unacked_.end() and expired(it->second, now_us)) {
+    it++;
+  }
+
+  if (it != unacked_.begin()) {
+    const size_t num_unacked = unacked_.size();
+    if (verbose_) {
+      LOG(LogLevel::INFO) << "Dropping expired datagrams: frame_id="
+           << unacked_.begin()->first.first << "-" << prev(it)->first.first;
+    }
+
+    ltr_.invalidate_from(unacked_.begin()->first.first);
+    unacked_.erase(unacked_.begin(), it);
+    num_expired_ += num_unacked - unacked_.size();
+    key_frame_pending_ = true;
+    restart_rtx_timer(now_us);
+  }
+
+  const size_t num_queued = send_buf_.size();
+  uint32_t first_expired = frame_id_;
+  send_buf_.erase(remove_if(send_buf_.begin(), send_buf_.end(),
+                            [&](const FrameDatagram & datagram) {
+                              if (not expired(datagram, now_us)) {
+                                return false;
+                              }
+                              first_expired = min(first_expired, datagram.frame_id);
+                              return true;
+                            }),
+                  send_buf_.end());
+  if (send_buf_.size() < num_queued) {
+    num_expired_ += num_queued - send_buf_.size();
+    key_frame_pending_ = true;
+    ltr_.invalidate_from(first_expired);
+  }
+}
+
+template <typename F>
+void HWEncoder::with_codec_pic_params(F && f)
+{
+  // the H.264 and HEVC picture parameters share the fields used here
+  if (EncodeCLIOptions.IsCodecH264()) {
+    f(picParams.codecPicParams.h264PicParams);
+  } else if (EncodeCLIOptions.IsCodecHEVC()) {
+    f(picParams.codecPicParams.hevcPicParams);
+  }
+}
+
+void HWEncoder::force_recovery_frame()
+{
+  // predict from the newest LTR the receiver has decoded, never from the
+  // (possibly lost) frames after it
+  const auto ltr = ltr_enabled_ ? ltr_.newest_acked() : nullopt;
+  if (ltr) {
+    const uint32_t first = max(ltr->frame_id + 1, frame_id_ - min(frame_id_, MAX_INVALIDATED_FRAMES));
+    bool invalidated = true;
+    for (uint32_t frame_id = first; frame_id < frame_id_; frame_id++) {
+      invalidated = penc->InvalidateRefFrames(frame_id) and invalidated;
+    }
+
+    // the frame may still reference lost frames: a key frame instead
+    if (not invalidated) {
+      LOG(LogLevel::WARNING) << "Failed to invalidate the frames after LTR " << ltr->frame_id
+                             << "; forcing a key frame";
+      ltr_.clear();
+      picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEINTRA;
+      curr_frame_type_ = FrameType::KEY;
+      return;
+    }
+
+    with_codec_pic_params([&](auto & codec_params) {
+      codec_params.ltrUseFrames = 1;
+      codec_params.ltrUseFrameBitmap = 1u << ltr->slot;
+    });
+    ltr_.invalidate_from(ltr->frame_id + 1);
+    num_ltr_recoveries_++;
+    curr_frame_type_ = FrameType::RECOVERY;
+
+    if (verbose_) {
+      LOG(LogLevel::INFO) << "Recovering from LTR: frame_id=" << ltr->frame_id
+           << " slot=" << ltr->slot;
+    }
+    return;
+  }
+
+  // a key frame clears all references (and the receiver may skip past the
+  // LTRs to a refresh wave)
+  ltr_.clear();
+  if (refresh_frames_ > 0) {
+    with_codec_pic_params([&](auto & codec_params) {
+      codec_params.forceIntraRefreshWithFrameCnt = refresh_frames_;
+    });
+    curr_frame_type_ = FrameType::REFRESH;
+  } else {
+    picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEINTRA;  // force an I frame
+    curr_frame_type_ = FrameType::KEY;
+  }
+}
+
+void HWEncoder::mark_ltr()
+{
+  // a new LTR whenever the previous one has been acknowledged (about once
+  // per RTT)
+  const auto slot = ltr_.slot_to_mark();
+  if (not slot) {
+    return;
+  }
+
+  with_codec_pic_params([&](auto & codec_params) {
+    codec_params.ltrMarkFrame = 1;
+    codec_params.ltrMarkFrameIdx = *slot;
+  });
+  ltr_.on_marked(*slot, frame_id_);
+}
+
+uint32_t HWEncoder::first_outstanding_frame() const
+{
+  uint32_t first = frame_id_;
+  if (not unacked_.empty()) {
+    first = min(first, unacked_.begin()->first.first);
+  }
+  for (const auto & datagram : send_buf_) {
+    if (datagram.frag_id < datagram.frag_cnt) { // parity is never acknowledged
+      first = min(first, datagram.frame_id);
+    }
+  }
+  return first;
+}
+
+void HWEncoder::handle_pli(const PliMsg & pli)
+{
+  num_plis_++;
+
+  // the receiver has not decoded the frame (and whatever follows it)
+  ltr_.invalidate_from(pli.frame_id);
+
+  // a key frame encoded within an RTT (or a frame interval, whichever is
+  // longer) may not have reached the receiver yet
+  const uint64_t holdoff_us = max(ewma_rtt_us_.value_or(INITIAL_RTO_US),
+                                  1e6 / frame_rate_);
+  if (last_key_frame_ts_ > 0 and timestamp_us() < last_key_frame_ts_ + holdoff_us) {
+    return;
+  }
+
+  if (not key_frame_pending_) {
+    num_pli_key_frames_++;
+  }
+  key_frame_pending_ = true;
+
+  if (verbose_) {
+    LOG(LogLevel::WARNING) << "Received PLI: frame_id=" << pli.frame_id
+         << "; forcing a key frame";
+  }
+}
+
+void HWEncoder::purge_superseded(const uint32_t key_frame_id)
+{
+  const size_t num_datagrams = unacked_.size() + send_buf_.size();
+  if (not unacked_.empty() and unacked_.begin()->first.first < key_frame_id) {
+    ltr_.invalidate_from(unacked_.begin()->first.first);
+  }
+
+  unacked_.erase(unacked_.begin(), unacked_.lower_bound({key_frame_id, 0}));
+  send_buf_.erase(remove_if(send_buf_.begin(), send_buf_.end(),
+                            [&](const FrameDatagram & datagram) { return datagram.frame_id < key_frame_id; }),
+                  send_buf_.end());
+
+  num_superseded_ += num_datagrams - unacked_.size() - send_buf_.size();
+}
+
+void HWEncoder::restart_rtx_timer(const uint64_t now_us)
+{
+  rtx_timer_start_us_ = now_us;
+  tlp_sent_ = false;
+}
+
+uint64_t HWEncoder::backed_off_rto_us() const
+{
+  // double the RTO on every expiration (RFC 6298 5.5) up to MAX_RTO_US
+  const unsigned int shift = min(rto_backoff_, 16u);
+  return min(rto_us_ << shift, MAX_RTO_US);
+}
+
+uint64_t HWEncoder::pto_us() const
+{
+  // probe timeout of 2 * SRTT (RFC 8985 7.2), plus the receiver's maximum
+  // ACK delay if it batches ACKs
+  if (not srtt_us_) {
+    return backed_off_rto_us();
+  }
+
+  const uint64_t ack_delay_us = feedback_ == ConfigMsg::Feedback::SACK ? SackMsg::ACK_DELAY_US : 0;
+  const auto pto = max(static_cast<uint64_t>(2 * (*srtt_us_)), MIN_PTO_US) + ack_delay_us;
+  return min(pto, backed_off_rto_us());
+}
+
+void HWEncoder::handle_nack(const NackMsg & nack)
+{
+  const auto curr_ts = timestamp_us();
+
+  // RTT sample from the echoed send timestamp minus the time the receiver
+  // held it (as RTCP does with LSR/DLSR)
+  const uint64_t echo_send_ts = nack.echo_send_ts ? extend_ts(nack.echo_send_ts, curr_ts) : 0;
+  if (echo_send_ts != 0 and curr_ts > echo_send_ts + nack.echo_delay_us) {
+    add_rtt_sample(curr_ts - echo_send_ts - nack.echo_delay_us);
+
+    if (cc_) {
+      cc_->on_arrival(echo_send_ts, curr_ts - nack.echo_delay_us, 0);
+    }
+  }
+
+  // the receiver is done with the frames before 'next_frame'
+  const auto done_it = unacked_.lower_bound({nack.next_frame, 0});
+  for (auto it = unacked_.begin(); it != done_it; it++) {
+    on_delivered(it->second, curr_ts);
+  }
+  unacked_.erase(unacked_.begin(), done_it);
+
+  // retransmit the requested datagrams in order ahead of the new ones, so
+  // walk the ranges backward as each is put at the front of 'send_buf_'
+  for (unsigned int i = nack.num_ranges; i-- > 0;) {
+    const auto & range = nack.ranges[i];
+    const uint32_t end_frag = range.num_frags == 0 ? UINT16_MAX + 1
+                              : range.first_frag + range.num_frags;
+
+    const auto first = unacked_.lower_bound({range.frame_id, range.first_frag});
+    const auto last = end_frag > UINT16_MAX ? unacked_.lower_bound({range.frame_id + 1, 0})
+                      : unacked_.lower_bound({range.frame_id, static_cast<uint16_t>(end_frag)});
+
+    for (auto rit = make_reverse_iterator(last); rit != make_reverse_iterator(first); rit++) {
+      auto & datagram = rit->second;
+      if (datagram.num_rtx < MAX_NUM_RTX) {
+        if (cc_) {
+          cc_->on_lost(datagram.payload.size(), curr_ts);
+        }
+        queue_rtx(datagram, curr_ts);
+      }
+    }
+
+    if (verbose_) {
+      LOG(LogLevel::INFO) << "Received NACK: frame_id=" << range.frame_id
+           << " frag_id=" << range.first_frag << " num_frags=" << range.num_frags;
+    }
+  }
+}
+
+optional<uint64_t> HWEncoder::next_timeout_us() const
+{
+  if (unacked_.empty() or feedback_ == ConfigMsg::Feedback::NACK) {
+    return nullopt;
+  }
+
+  return rtx_timer_start_us_ + (tlp_sent_ ? backed_off_rto_us() : pto_us());
+}
+
+void HWEncoder::handle_timeout()
+{
+  const auto curr_ts = timestamp_us();
+  purge_expired(curr_ts);  // may stop or restart the timer
+  const auto deadline = next_timeout_us();
+
+  if (not deadline or curr_ts < *deadline) {
+    return;  // the timer was restarted or stopped in the meantime
+  }
+
+  if (not tlp_sent_) {
+    // tail loss probe: retransmit the most recently sent datagram, whose ACK
+    // makes handle_ack() retransmit any earlier datagrams that were lost
+    auto & datagram = unacked_.rbegin()->second;
+    if (datagram.num_rtx < MAX_NUM_RTX) {
+      queue_rtx(datagram, curr_ts);
+    }
+
+    if (verbose_) {
+      LOG(LogLevel::INFO) << "Tail loss probe: frame_id=" << datagram.frame_id
+           << " frag_id=" << datagram.frag_id;
+    }
+
+    rtx_timer_start_us_ = curr_ts;
+    tlp_sent_ = true;
+    return;
+  }
+
+  // RTO: consider all unacked datagrams lost and retransmit them in order
+  for (auto rit = unacked_.rbegin(); rit != unacked_.rend(); rit++) {
+    auto & datagram = rit->second;
+    if (datagram.num_rtx < MAX_NUM_RTX) {
+      if (cc_) {
+        cc_->on_lost(datagram.payload.size(), curr_ts);
+      }
+      queue_rtx(datagram, curr_ts);
+    }
+  }
+
+  if (verbose_) {
+    LOG(LogLevel::INFO) << "Retransmission timeout: rto_us=" << backed_off_rto_us()
+         << " unacked=" << unacked_.size();
+  }
+
+  rto_backoff_++;
+  rtx_timer_start_us_ = curr_ts;
 }
 
 void HWEncoder::add_rtt_sample(const unsigned int rtt_us)
@@ -371,6 +991,27 @@ void HWEncoder::add_rtt_sample(const unsigned int rtt_us)
   } else {
     ewma_rtt_us_ = ALPHA * rtt_us + (1 - ALPHA) * (*ewma_rtt_us_);
   }
+
+  // SRTT and RTTVAR (RFC 6298 2.2-2.3)
+  if (not srtt_us_) {
+    srtt_us_ = rtt_us;
+    rttvar_us_ = rtt_us / 2.0;
+  } else {
+    rttvar_us_ = (1 - RTO_BETA) * rttvar_us_ + RTO_BETA * abs(*srtt_us_ - rtt_us);
+    srtt_us_ = (1 - RTO_ALPHA) * (*srtt_us_) + RTO_ALPHA * rtt_us;
+  }
+
+  const auto rto = *srtt_us_ + max(static_cast<double>(RTO_GRANULARITY_US), 4 * rttvar_us_);
+  rto_us_ = clamp(static_cast<uint64_t>(rto), MIN_RTO_US, MAX_RTO_US);
+
+  // ACKs echo the send timestamp of the very transmission they acknowledge,
+  // so samples are unambiguous even for retransmissions (no need for Karn's
+  // algorithm) and can reset the backoff right away
+  rto_backoff_ = 0;
+
+  if (cc_) {
+    cc_->on_rtt_sample(rtt_us, timestamp_us());
+  }
 }
 
 void HWEncoder::output_periodic_stats()
@@ -389,12 +1030,100 @@ void HWEncoder::output_periodic_stats()
         << "/" << double_to_string(*ewma_rtt_us_ / 1000.0);
   }
 
+  if (srtt_us_) {
+    LOG(LogLevel::INFO) << "  - SRTT/RTTVAR/RTO (ms): " << double_to_string(*srtt_us_ / 1000.0)
+        << "/" << double_to_string(rttvar_us_ / 1000.0)
+        << "/" << double_to_string(backed_off_rto_us() / 1000.0);
+  }
+
+  // in the same format for every mode, for comparison across runs
+  if (cc_) {
+    LOG(LogLevel::INFO) << "  - Congestion control (" << cc_->name() << ") target/pacing (kbps): "
+        << cc_->target_bitrate_kbps() << "/" << cc_->pacing_rate_kbps();
+  } else {
+    LOG(LogLevel::INFO) << "  - Congestion control (static) target/pacing (kbps): "
+        << target_bitrate_ / 1000 << "/0";
+  }
+
+  if (target_latency_us_ > 0) {
+    LOG(LogLevel::INFO) << "  - Expired/superseded datagrams dropped: "
+        << num_expired_ << "/" << num_superseded_;
+  }
+
+  if (num_plis_ > 0) {
+    LOG(LogLevel::INFO) << "  - PLIs received/key frames forced: "
+        << num_plis_ << "/" << num_pli_key_frames_;
+  }
+
+  if (ltr_enabled_) {
+    LOG(LogLevel::INFO) << "  - LTR recoveries: " << num_ltr_recoveries_;
+  }
+
+  if (fec_enabled_) {
+    LOG(LogLevel::INFO) << "  - FEC loss rate/parity datagrams: "
+        << double_to_string(loss_rate_, 3) << "/" << num_parity_datagrams_;
+  }
+
   // reset all but RTT-related stats
+  num_plis_ = 0;
+  num_pli_key_frames_ = 0;
+  num_ltr_recoveries_ = 0;
+  num_expired_ = 0;
+  num_superseded_ = 0;
+  num_parity_datagrams_ = 0;
   num_encoded_frames_ = 0;
   total_encode_time_ms_ = 0.0;
   max_encode_time_ms_ = 0.0;
 }
 
+size_t HWEncoder::send_buf_bytes() const
+{
+  size_t bytes = 0;
+  for (const auto & datagram : send_buf_) {
+    bytes += datagram.serialized_size();
+  }
+  return bytes;
+}
+
+uint64_t HWEncoder::queue_delay_us(const uint64_t drain_bps) const
+{
+  if (send_buf_.empty()) {
+    return 0;
+  }
+  if (drain_bps == 0) {
+    return numeric_limits<uint64_t>::max();
+  }
+
+  return send_buf_bytes() * 8 * 1000 * 1000 / drain_bps;
+}
+
+void HWEncoder::set_target_latency(const unsigned int latency_ms)
+{
+  const uint64_t frame_interval_us = 1000 * 1000 / frame_rate_;
+  target_latency_us_ = latency_ms > 0 ? max<uint64_t>(latency_ms * 1000, frame_interval_us) : 0;
+}
+
+void HWEncoder::update_loss_rate(const double loss_rate)
+{
+  // react to loss at once but forget it slowly, so that protection does
+  // not switch on and off between reports
+  loss_rate_ = max(loss_rate, LOSS_DECAY * loss_rate_ + (1 - LOSS_DECAY) * loss_rate);
+}
+
+void HWEncoder::apply_congestion_controller()
+{
+  if (not cc_) {
+    return;
+  }
+
+  const unsigned int target_kbps = cc_->target_bitrate_kbps();
+  const double curr_kbps = target_bitrate_ / 1000.0;
+  if (target_kbps > 0 and
+      fabs(target_kbps - curr_kbps) > CC_MIN_CHANGE * curr_kbps) {
+    set_target_bitrate(target_kbps);
+  }
+}
+
 void HWEncoder::set_target_bitrate(const unsigned int bitrate_kbps)
 {
   target_bitrate_ = bitrate_kbps * 1000;  // bps
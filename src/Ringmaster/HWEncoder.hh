@@ -27,6 +27,9 @@
 #include "exception.hh"
 #include "image.hh"
 #include "protocol.hh"
+#include "congestion_controller.hh"
+#include "ltr_tracker.hh"
+#include "fec.hh"
 #include "file_descriptor.hh"
 
 enum OutputFormat
@@ -39,10 +42,16 @@ enum OutputFormat
 class HWEncoder
 {
 public:
+  // 'refresh_frames' > 0: recover with intra-refresh waves of that many
+  // frames instead of key frames (if the GPU supports intra refresh)
+  // 'use_ltr': recover by predicting from an acknowledged long-term
+  // reference when there is one (if the GPU supports LTRs)
   HWEncoder(const uint16_t nWidth,
               const uint16_t nHeight,
               const uint16_t frame_rate,
-              const std::string &output_path = "");
+              const std::string &output_path = "",
+              const uint8_t refresh_frames = 0,
+              const bool use_ltr = false);
   ~HWEncoder();
 
   // Cuda encoder interface
@@ -55,8 +64,33 @@ public:
   void add_unacked(const FrameDatagram &datagram);
   void add_unacked(FrameDatagram &&datagram);
 
+  // Put a datagram whose send failed (asynchronously) back in the send buffer
+  void requeue_unsent(const SeqNum &seq_num);
+
   // Call whenever ACK is received
-  void handle_ack(const std::shared_ptr<AckMsg> &ack);
+  void handle_ack(const AckMsg ack);
+
+  // Call whenever SACK is received (in SACK mode): the cumulative point
+  // and blocks acknowledge datagrams, and holes below them are retransmitted
+  void handle_sack(const SackMsg & sack);
+
+  // Call whenever NACK is received (in NACK mode): retransmit only the
+  // requested datagrams and forget those of the frames the receiver is done with
+  void handle_nack(const NackMsg & nack);
+
+  // Retransmission timer: when handle_timeout() should be called next
+  // (in timestamp_us() time), or nullopt if nothing is outstanding or the
+  // receiver drives retransmissions with NACKs
+  std::optional<uint64_t> next_timeout_us() const;
+
+  // Call when the retransmission timer expires: send a tail loss probe
+  // first, then retransmit all unacked datagrams on RTO with backoff
+  void handle_timeout();
+
+  // Call whenever PLI is received: force a key frame (or refresh wave) on
+  // the next compress_frame(), unless one was encoded less than an RTT ago (and
+  // may still be on its way; the receiver asks again if it is lost too)
+  void handle_pli(const PliMsg & pli);
 
   // Return the size of the encoded frame
   uint64_t getEncodedFrameSize() { return penc->GetFrameSize(); }
@@ -68,11 +102,35 @@ public:
   uint32_t frame_id() const { return frame_id_; }
   std::deque<FrameDatagram> &send_buf() { return send_buf_; }
   std::map<SeqNum, FrameDatagram> &unacked() { return unacked_; }
+  unsigned int target_bitrate_kbps() const { return target_bitrate_ / 1000; }
+  uint8_t refresh_frames() const { return refresh_frames_; }
+  bool ltr_enabled() const { return ltr_enabled_; }
+  uint64_t rto_us() const { return rto_us_; }
+
+  // Bytes waiting in 'send_buf_', and how long they take to drain at 'drain_bps'
+  size_t send_buf_bytes() const;
+  uint64_t queue_delay_us(const uint64_t drain_bps) const;
+  CongestionController *congestion_controller() const { return cc_.get(); }
 
   // Mutators
   void set_verbose(const bool verbose) { verbose_ = verbose; }
+  void set_feedback(const ConfigMsg::Feedback feedback) { feedback_ = feedback; }
   void set_target_bitrate(const unsigned int bitrate_kbps);
 
+  // Let a congestion controller drive the target bitrate: it is fed with
+  // ACK/SACK/NACK feedback and consulted before encoding every frame
+  void set_congestion_controller(std::unique_ptr<CongestionController> cc) { cc_ = std::move(cc); }
+
+  // Protect every frame with XOR parity datagrams sized for the loss rate
+  // reported by the receiver (see XorFec)
+  void set_fec(const bool enabled) { fec_enabled_ = enabled; }
+  void update_loss_rate(const double loss_rate);
+
+  // Give every frame a deadline 'latency_ms' after its capture (at least
+  // one frame interval); datagrams that would arrive later are dropped
+  // instead of (re)sent; 0 disables deadlines
+  void set_target_latency(const unsigned int latency_ms);
+
   // Forbid copying and moving
   HWEncoder(const HWEncoder &other) = delete;
   const HWEncoder &operator=(const HWEncoder &other) = delete;
@@ -111,6 +169,7 @@ private:
   // Variables
   FrameType curr_frame_type_{FrameType::NONKEY};
   bool verbose_{false};
+  ConfigMsg::Feedback feedback_{ConfigMsg::Feedback::ACK};
   unsigned int target_bitrate_{0};
   uint32_t frame_id_{0};
 
@@ -120,10 +179,80 @@ private:
   // Record outstanding datagrams
   std::map<SeqNum, FrameDatagram> unacked_{};
 
+  // Congestion control (none for a static bitrate)
+  std::unique_ptr<CongestionController> cc_{};
+  void apply_congestion_controller();
+
+  // Delivery rate sampling: bytes acknowledged so far, when the latest were
+  // acknowledged, and when the latest acknowledged datagram was sent
+  uint64_t delivered_bytes_{0};
+  uint64_t delivered_ts_{0};
+  uint64_t first_sent_ts_{0};
+  void stamp_delivery_state(FrameDatagram & datagram) const;
+  void on_delivered(const FrameDatagram & datagram, const uint64_t now_us);
+
+  // FEC: smoothed loss rate (rising at once, decaying slowly) and the
+  // parity datagrams of the latest frame
+  bool fec_enabled_{false};
+  double loss_rate_{0.0};
+  uint16_t curr_num_parity_{0};
+  unsigned int num_parity_datagrams_{0};
+  static constexpr double LOSS_DECAY = 0.9;
+
+  // Deadlines of frames, and datagrams dropped as useless: expired, or of
+  // frames before a key frame
+  uint64_t target_latency_us_{0};
+  uint64_t curr_deadline_ts_{0};
+  bool key_frame_pending_{false}; // the receiver cannot decode past a lost frame
+  unsigned int num_expired_{0};
+  unsigned int num_superseded_{0};
+  bool expired(const FrameDatagram & datagram, const uint64_t now_us) const;
+  void purge_expired(const uint64_t now_us);
+  void purge_superseded(const uint32_t key_frame_id);
+
+  // Recovery frames: frames predicted from an acknowledged LTR, key
+  // frames, or the first frames of intra-refresh waves
+  uint8_t refresh_frames_{0};
+  bool ltr_enabled_{false};
+  LtrTracker ltr_{};
+  unsigned int num_ltr_recoveries_{0};
+  void force_recovery_frame();
+  void mark_ltr();
+  uint32_t first_outstanding_frame() const;
+  template <typename F>
+  void with_codec_pic_params(F && f);
+  // at most as many frames as the reference picture buffer holds
+  static constexpr uint32_t MAX_INVALIDATED_FRAMES = 16;
+
+  // Key frames requested by the receiver, and when the last key frame was encoded
+  uint64_t last_key_frame_ts_{0};
+  unsigned int num_plis_{0};
+  unsigned int num_pli_key_frames_{0};
+
   // Encoding stats
   std::optional<unsigned int> min_rtt_us_{};
   std::optional<double> ewma_rtt_us_{};
   static constexpr double ALPHA = 0.2;
+
+  // RTO estimation (RFC 6298)
+  std::optional<double> srtt_us_{};
+  double rttvar_us_{0.0};
+  uint64_t rto_us_{INITIAL_RTO_US};
+  static constexpr double RTO_ALPHA = 1.0 / 8;
+  static constexpr double RTO_BETA = 1.0 / 4;
+
+  // Retransmission timer, restarted whenever an ACK makes progress
+  uint64_t rtx_timer_start_us_{0};
+  unsigned int rto_backoff_{0}; // RTO expirations since the last RTT sample
+  bool tlp_sent_{false};        // a tail loss probe was sent since the restart
+  uint64_t backed_off_rto_us() const;
+  uint64_t pto_us() const;
+  void restart_rtx_timer(const uint64_t now_us);
+  void queue_rtx(FrameDatagram & datagram, const uint64_t now_us);
+
+  // retransmit the unacked datagrams before 'it' that seem lost
+  void retransmit_before(std::map<SeqNum, FrameDatagram>::iterator it,
+                         const uint64_t now_us);
   unsigned int num_encoded_frames_{0};
   double total_encode_time_ms_{0.0};
   double max_encode_time_ms_{0.0};
@@ -132,6 +261,15 @@ private:
   // Parameters
   static constexpr unsigned int MAX_NUM_RTX = 3;
   static constexpr uint64_t MAX_UNACKED_US = 1000 * 1000; // 1 second
+  // RFC 6298 recommends a 1 s minimum RTO, which is as long as we keep
+  // retransmitting at all; a real-time stream has to recover much sooner
+  static constexpr uint64_t INITIAL_RTO_US = 200 * 1000;
+  static constexpr uint64_t MIN_RTO_US = 20 * 1000;
+  static constexpr uint64_t MAX_RTO_US = MAX_UNACKED_US;
+  static constexpr uint64_t RTO_GRANULARITY_US = 1000;
+  static constexpr uint64_t MIN_PTO_US = 2 * 1000;
+  // reconfiguring NVENC is not free, so ignore small changes of the target
+  static constexpr double CC_MIN_CHANGE = 0.05;
 
   // Internal functions
   void encode_frame(const std::unique_ptr<uint8_t[]> &pHostFrame);
@@ -124,6 +124,11 @@ bool MTHWDecoder::add_datagram_common(const FrameDatagram & datagram)
     return false;
   }
 
+  // no FEC recovery here: ignore parity datagrams (frag_id >= frag_cnt)
+  if (datagram.frag_id >= frag_cnt) {
+    return false;
+  }
+
   if (not frame_buf_.count(frame_id)) {
     // initialize a Frame instance for frame 'frame_id'
     frame_buf_.emplace(piecewise_construct, 
@@ -176,6 +181,7 @@ bool MTHWDecoder::next_frame_complete()
       // set next_frame_ to frame_id and clean up old frames
       const auto frame_diff = frame_id - next_frame_;
       advance_next_frame(frame_diff);
+      num_frames_skipped_ += frame_diff;
 
       LOG(LogLevel::WARNING) << endl << "* Recovery: skipped " << frame_diff
            << " frames ahead to key frame " << frame_id << endl;
@@ -196,6 +202,7 @@ void MTHWDecoder::consume_next_frame()
 
   // found a decodable frame; update (and output) stats
   num_decodable_frames_++;
+  num_frames_completed_++;
   const size_t frame_size = frame.frame_size().value();
   total_decodable_frame_size_ += frame_size;
   // output stats 
@@ -6,6 +6,7 @@
 #include <chrono>
 #include <algorithm>
 #include <limits>
+#include <cmath>
 
 #include "MTHWEncoder.hh"
 #include "conversion.hh"
@@ -30,9 +31,10 @@ simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(
 MTHWEncoder::MTHWEncoder(const uint16_t nWidth,
                  const uint16_t nHeight,
                  const uint16_t frame_rate,
-                 const string & output_path)
+                 const string & output_path,
+                 const uint8_t refresh_frames)
   : nWidth_(nWidth), nHeight_(nHeight), frame_rate_(frame_rate), output_fd_(),
-  vidEncThreads(nThread), ioVideoMem(nThread)
+  vidEncThreads(nThread), ioVideoMem(nThread), refresh_frames_(refresh_frames)
   {
   
   if (not output_path.empty()) {  // for logging
@@ -85,9 +87,30 @@ MTHWEncoder::MTHWEncoder(const uint16_t nWidth,
     encodeConfig.rcParams.disableIadapt = 1;  
     encodeConfig.rcParams.disableBadapt = 1;
 
-    // encodeConfig.encodeCodecConfig.hevcConfig.enableIntraRefresh = 1;
-    // encodeConfig.encodeCodecConfig.hevcConfig.intraRefreshCnt = 5;
-    // encodeConfig.encodeCodecConfig.hevcConfig.intraRefreshPeriod = 30;
+    // Intra refresh on demand only, as in HWEncoder
+    if (refresh_frames_ > 0 and not vidEncThreads[i].encSession->GetCapabilityValue(
+          pEncodeCLIOptions->GetEncodeGUID(), NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+      LOG(LogLevel::WARNING) << "Encoder does not support intra refresh; recovering with key frames";
+      refresh_frames_ = 0;
+    }
+    if (refresh_frames_ > 0) {
+      if (pEncodeCLIOptions->IsCodecH264()) {
+        auto & h264Config = encodeConfig.encodeCodecConfig.h264Config;
+        h264Config.enableIntraRefresh = 1;
+        h264Config.intraRefreshPeriod = NVENC_INFINITE_GOPLENGTH;
+        h264Config.intraRefreshCnt = refresh_frames_;
+        h264Config.outputRecoveryPointSEI = 1;
+      } else if (pEncodeCLIOptions->IsCodecHEVC()) {
+        auto & hevcConfig = encodeConfig.encodeCodecConfig.hevcConfig;
+        hevcConfig.enableIntraRefresh = 1;
+        hevcConfig.intraRefreshPeriod = NVENC_INFINITE_GOPLENGTH;
+        hevcConfig.intraRefreshCnt = refresh_frames_;
+        hevcConfig.outputRecoveryPointSEI = 1;
+      } else {
+        LOG(LogLevel::WARNING) << "Intra refresh is only used with H.264 and HEVC; recovering with key frames";
+        refresh_frames_ = 0;
+      }
+    }
     encodeConfig.encodeCodecConfig.hevcConfig.hevcVUIParameters.videoSignalTypePresentFlag = 1;
     encodeConfig.encodeCodecConfig.hevcConfig.hevcVUIParameters.colourDescriptionPresentFlag = 1;
     encodeConfig.encodeCodecConfig.hevcConfig.hevcVUIParameters.colourMatrix = NV_ENC_VUI_MATRIX_COEFFS_FCC;
@@ -100,6 +123,10 @@ MTHWEncoder::MTHWEncoder(const uint16_t nWidth,
     vidEncThreads[i].encSession->CreateEncoder(&initializeParams);
     vidEncThreads[i].cuStream.reset(new NvCUStream(cuContext, 1, vidEncThreads[i].encSession)); // each encoding session thread is going to use one cuda stream
   }
+  if (refresh_frames_ > 0) {
+    LOG(LogLevel::INFO) << "Recovering with intra-refresh waves of "
+                        << static_cast<unsigned int>(refresh_frames_) << " frames";
+  }
 
   // Allocate all the required memory for IO 
   uint64_t frameSize = vidEncThreads[0].encSession->GetFrameSize();
@@ -123,6 +150,16 @@ void MTHWEncoder::compress_frame(const std::unique_ptr<uint8_t[]>& pHostFrame)
 {
   const auto frame_generation_ts = timestamp_us();
 
+  // apply the congestion controller's target unless it barely changed
+  if (cc_) {
+    const unsigned int target_kbps = cc_->target_bitrate_kbps();
+    const double curr_kbps = target_bitrate_ / 1000.0;
+    if (target_kbps > 0 and
+        fabs(target_kbps - curr_kbps) > CC_MIN_CHANGE * curr_kbps) {
+      set_target_bitrate(target_kbps);
+    }
+  }
+
   
   curr_frame_type_ = FrameType::NONKEY;
   encode_frame(pHostFrame);
@@ -146,6 +183,7 @@ void MTHWEncoder::encode_frame(const std::unique_ptr<uint8_t[]>& pHostFrame)
 {
 
   picParams.encodePicFlags = 0;
+  force_intra_refresh(0);
   curr_frame_type_ = FrameType::UNKNOWN;
 
   // Clean up if we've given up on retransmissions
@@ -154,11 +192,10 @@ void MTHWEncoder::encode_frame(const std::unique_ptr<uint8_t[]>& pHostFrame)
     const auto us_since_first_send = timestamp_us() - first_unacked.send_ts;
 
     if (us_since_first_send > MAX_UNACKED_US) {
-      picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEINTRA;  // force an I frame
-      curr_frame_type_ = FrameType::KEY;
+      force_recovery_frame();
 
-      LOG(LogLevel::WARNING) << endl << "* Recovery: gave up retransmissions and forced a key frame "
-           << frame_id_ << endl;
+      LOG(LogLevel::WARNING) << endl << "* Recovery: gave up retransmissions and forced a "
+           << (refresh_frames_ > 0 ? "refresh wave from " : "key frame ") << frame_id_ << endl;
       if (verbose_) {
         LOG(LogLevel::WARNING) << endl << "Giving up on lost datagram: frame_id="
              << first_unacked.frame_id << " frag_id=" << first_unacked.frag_id
@@ -251,7 +288,9 @@ void MTHWEncoder::asyncEncode(ConcurrentQueue<encodeData>& encodeQueue, std::ato
     uint64_t totalBitStreamSize = 0; // need to keep track of the size of each compressed frame
 		ck(cuCtxSetCurrent((CUcontext)enc.threadData->encSession->GetDevice()));
     std::vector<std::vector<uint8_t>> encOutBuf;
-    NV_ENC_PIC_PARAMS nvEncPicParams = { NV_ENC_PIC_PARAMS_VER };
+    // start from the flags set by encode_frame() (forced intra frames and
+    // refresh waves)
+    NV_ENC_PIC_PARAMS nvEncPicParams = picParams;
 
     if (frame_id_ == 0) nvEncPicParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR; // force IDR frame
 
@@ -310,9 +349,10 @@ size_t MTHWEncoder::packetize_encoded_frame(std::vector<std::vector<uint8_t>> &v
   size_t frame_size = 0;  //bytes
   
   auto frame_type  = curr_frame_type_;
-  if (frame_type == FrameType::KEY) {
+  if (frame_type == FrameType::KEY or frame_type == FrameType::REFRESH) {
     if (verbose_) {
-      cerr << "Encoded a key frame: frame_id=" << frame_id_ << endl;
+      cerr << "Encoded a " << (frame_type == FrameType::KEY ? "key frame" : "refresh wave start")
+           << ": frame_id=" << frame_id_ << endl;
     }
   }
 
@@ -325,9 +365,14 @@ size_t MTHWEncoder::packetize_encoded_frame(std::vector<std::vector<uint8_t>> &v
     frag_cnt += (packet.size() + FrameDatagram::max_payload - 1) / FrameDatagram::max_payload;
   }
   
+  // move the encoded packets into a slab shared by all datagrams of this
+  // frame, including those kept in 'unacked_' and their retransmissions
+  const auto slab = make_shared<const std::vector<std::vector<uint8_t>>>(move(vPacket));
+  vPacket.clear();
+
   // packetize the encoded frame
   uint16_t frag_id = 0;
-  for (const auto &packet : vPacket) {
+  for (const auto &packet : *slab) {
     size_t packet_size = packet.size();
     size_t processed = 0;  // Amount processed from the current packet
 
@@ -337,7 +382,7 @@ size_t MTHWEncoder::packetize_encoded_frame(std::vector<std::vector<uint8_t>> &v
       std::string_view payload(reinterpret_cast<const char*>(start_ptr), payload_size);
       frame_size += payload_size;
  
-      send_buf_.emplace_back(frame_id_, frame_type, frag_id, frag_cnt, width, height, payload);
+      send_buf_.emplace_back(frame_id_, frame_type, frag_id, frag_cnt, width, height, slab, payload);
       frag_id++;
 
       processed += payload_size;
@@ -348,8 +393,32 @@ size_t MTHWEncoder::packetize_encoded_frame(std::vector<std::vector<uint8_t>> &v
   return frame_size;
 }
 
+void MTHWEncoder::force_recovery_frame()
+{
+  if (refresh_frames_ > 0) {
+    force_intra_refresh(refresh_frames_);
+    curr_frame_type_ = FrameType::REFRESH;
+  } else {
+    picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEINTRA;  // force an I frame
+    curr_frame_type_ = FrameType::KEY;
+  }
+}
+
+void MTHWEncoder::force_intra_refresh(const uint32_t frame_cnt)
+{
+  if (EncodeCLIOptions.IsCodecH264()) {
+    picParams.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = frame_cnt;
+  } else if (EncodeCLIOptions.IsCodecHEVC()) {
+    picParams.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = frame_cnt;
+  }
+}
+
 void MTHWEncoder::add_unacked(const FrameDatagram & datagram)
 {
+  if (unacked_.empty()) {  // not delivering while idle
+    delivered_ts_ = first_sent_ts_ = datagram.send_ts;
+  }
+
   const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
   auto [it, success] = unacked_.emplace(seq_num, datagram);
 
@@ -358,10 +427,17 @@ void MTHWEncoder::add_unacked(const FrameDatagram & datagram)
   }
 
   it->second.last_send_ts = it->second.send_ts;
+  it->second.delivered = delivered_bytes_;
+  it->second.delivered_ts = delivered_ts_;
+  it->second.first_sent_ts = first_sent_ts_;
 }
 
 void MTHWEncoder::add_unacked(FrameDatagram && datagram)
 {
+  if (unacked_.empty()) {  // not delivering while idle
+    delivered_ts_ = first_sent_ts_ = datagram.send_ts;
+  }
+
   const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
   auto [it, success] = unacked_.emplace(seq_num, move(datagram));
 
@@ -370,17 +446,21 @@ void MTHWEncoder::add_unacked(FrameDatagram && datagram)
   }
 
   it->second.last_send_ts = it->second.send_ts;
+  it->second.delivered = delivered_bytes_;
+  it->second.delivered_ts = delivered_ts_;
+  it->second.first_sent_ts = first_sent_ts_;
 }
 
-void MTHWEncoder::handle_ack(const shared_ptr<AckMsg> & ack)
+void MTHWEncoder::handle_ack(const AckMsg ack)
 {
   const auto curr_ts = timestamp_us();
 
   // observed an RTT sample
-  add_rtt_sample(curr_ts - ack->send_ts);
+  const uint64_t send_ts = extend_ts(ack.send_ts, curr_ts);  // echoed by the receiver
+  add_rtt_sample(curr_ts - send_ts);
 
   // find the acked datagram in 'unacked_'
-  const auto acked_seq_num = make_pair(ack->frame_id, ack->frag_id);
+  const auto acked_seq_num = make_pair(ack.frame_id, ack.frag_id);
   auto acked_it = unacked_.find(acked_seq_num);
 
   if (acked_it == unacked_.end()) {
@@ -388,6 +468,12 @@ void MTHWEncoder::handle_ack(const shared_ptr<AckMsg> & ack)
     return;
   }
 
+  if (cc_) {
+    cc_->on_rtt_sample(curr_ts - send_ts, curr_ts);
+    cc_->on_arrival(send_ts, curr_ts, acked_it->second.payload.size());
+  }
+  on_delivered(acked_it->second, curr_ts);
+
   // retransmit all unacked datagrams before the acked one (backward)
   for (auto rit = make_reverse_iterator(acked_it);
        rit != unacked_.rend(); rit++) {
@@ -401,6 +487,10 @@ void MTHWEncoder::handle_ack(const shared_ptr<AckMsg> & ack)
     // retransmit if it's the first RTX or the last RTX was about one RTT ago
     if (datagram.num_rtx == 0 or
         curr_ts - datagram.last_send_ts > ewma_rtt_us_.value()) {
+      if (cc_) {
+        cc_->on_lost(datagram.payload.size(), curr_ts);
+      }
+
       datagram.num_rtx++;
       datagram.last_send_ts = curr_ts;
 
@@ -413,6 +503,23 @@ void MTHWEncoder::handle_ack(const shared_ptr<AckMsg> & ack)
   unacked_.erase(acked_it);
 }
 
+void MTHWEncoder::on_delivered(const FrameDatagram & datagram, const uint64_t now_us)
+{
+  const size_t size = datagram.payload.size();
+  delivered_bytes_ += size;
+  delivered_ts_ = now_us;
+  first_sent_ts_ = datagram.send_ts;
+
+  if (cc_) {
+    // delivery rate over the longer of the send and ACK intervals
+    const uint64_t send_elapsed = datagram.send_ts - datagram.first_sent_ts;
+    const uint64_t ack_elapsed = now_us - datagram.delivered_ts;
+    cc_->on_acked(size, now_us);
+    cc_->on_rate_sample(delivered_bytes_ - datagram.delivered,
+                        max(send_elapsed, ack_elapsed), now_us);
+  }
+}
+
 void MTHWEncoder::add_rtt_sample(const unsigned int rtt_us)
 {
   // min RTT
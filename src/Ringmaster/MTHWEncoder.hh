@@ -27,6 +27,7 @@
 #include "exception.hh"    
 #include "image.hh"
 #include "protocol.hh"
+#include "congestion_controller.hh"
 #include "file_descriptor.hh" 
 
 #include "EncMultiInstance.h"
@@ -39,11 +40,13 @@ enum OutputFormat
 class MTHWEncoder
 {
 public:
-  // initialize a VP9 encoder
+  // initialize a VP9 encoder; 'refresh_frames' > 0: recover with
+  // intra-refresh waves of that many frames instead of key frames
   MTHWEncoder(const uint16_t nWidth,
           const uint16_t nHeight,
           const uint16_t frame_rate,
-          const std::string & output_path = "");
+          const std::string & output_path = "",
+          const uint8_t refresh_frames = 0);
   ~MTHWEncoder();
 
   // encode raw_img and packetize into datagrams
@@ -54,7 +57,7 @@ public:
   void add_unacked(FrameDatagram && datagram);
 
   // handle ACK
-  void handle_ack(const std::shared_ptr<AckMsg> & ack);
+  void handle_ack(const AckMsg ack);
 
   // output stats every second and reset some of them
   void output_periodic_stats();
@@ -63,11 +66,15 @@ public:
   uint32_t frame_id() const { return frame_id_; }
   std::deque<FrameDatagram> & send_buf() { return send_buf_; }
   std::map<SeqNum, FrameDatagram> & unacked() { return unacked_; }
+  uint8_t refresh_frames() const { return refresh_frames_; }
 
   // mutators
   void set_verbose(const bool verbose) { verbose_ = verbose; }
   void set_target_bitrate(const unsigned int bitrate_kbps);
 
+  // let a congestion controller drive the target bitrate
+  void set_congestion_controller(std::unique_ptr<CongestionController> cc) { cc_ = std::move(cc); }
+
   //
   uint64_t getEncodedFrameSize() { return vidEncThreads[0].encSession->GetFrameSize(); }
 
@@ -121,6 +128,11 @@ private:
   
   
   FrameType curr_frame_type_ {FrameType::NONKEY};
+
+  // Recovery frames: key frames, or the first frames of intra-refresh waves
+  uint8_t refresh_frames_{0};
+  void force_recovery_frame();
+  void force_intra_refresh(const uint32_t frame_cnt);
   
   // print debugging info
   bool verbose_ {false};
@@ -128,6 +140,16 @@ private:
   // current target bitrate
   unsigned int target_bitrate_ {0};
 
+  // congestion controller (none for a static bitrate)
+  std::unique_ptr<CongestionController> cc_ {};
+  static constexpr double CC_MIN_CHANGE = 0.05;
+
+  // delivery rate sampling for the congestion controller
+  uint64_t delivered_bytes_ {0};
+  uint64_t delivered_ts_ {0};
+  uint64_t first_sent_ts_ {0};
+  void on_delivered(const FrameDatagram & datagram, const uint64_t now_us);
+
   // frame ID to encode
   uint32_t frame_id_ {0};
 
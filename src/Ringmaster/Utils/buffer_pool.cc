@@ -0,0 +1,110 @@
+#include <stdexcept>
+
+#include "buffer_pool.hh"
+
+using namespace std;
+
+BufferPool::BufferPool(const size_t num_buffers, const size_t buffer_size)
+  : buffer_size_(buffer_size), storage_(new char[num_buffers * buffer_size]),
+    refcounts_(num_buffers, 0), free_list_()
+{
+  if (num_buffers == 0 or buffer_size == 0) {
+    throw runtime_error("BufferPool: empty pool");
+  }
+
+  free_list_.reserve(num_buffers);
+  for (size_t i = num_buffers; i > 0; i--) {
+    free_list_.push_back(i - 1);
+  }
+}
+
+optional<BufferPool::Lease> BufferPool::acquire()
+{
+  if (free_list_.empty()) {
+    return nullopt;
+  }
+
+  const uint32_t index = free_list_.back();
+  free_list_.pop_back();
+
+  refcounts_[index] = 1;
+  return Lease(this, index, storage_.get() + index * buffer_size_, buffer_size_);
+}
+
+void BufferPool::release(const uint32_t index)
+{
+  if (refcounts_.at(index) == 0) {
+    throw runtime_error("BufferPool: released a free buffer");
+  }
+
+  if (--refcounts_[index] == 0) {
+    free_list_.push_back(index);
+  }
+}
+
+BufferPool::Lease::Lease(BufferPool * pool, const uint32_t index,
+                         char * ptr, const size_t len)
+  : pool_(pool), index_(index), ptr_(ptr), len_(len)
+{}
+
+BufferPool::Lease::~Lease()
+{
+  reset();
+}
+
+BufferPool::Lease::Lease(Lease && other)
+  : pool_(other.pool_), index_(other.index_), ptr_(other.ptr_), len_(other.len_)
+{
+  other.pool_ = nullptr;
+  other.ptr_ = nullptr;
+  other.len_ = 0;
+}
+
+BufferPool::Lease & BufferPool::Lease::operator=(Lease && other)
+{
+  if (this != &other) {
+    reset();
+
+    pool_ = other.pool_;
+    index_ = other.index_;
+    ptr_ = other.ptr_;
+    len_ = other.len_;
+
+    other.pool_ = nullptr;
+    other.ptr_ = nullptr;
+    other.len_ = 0;
+  }
+
+  return *this;
+}
+
+BufferPool::Lease BufferPool::Lease::share(const size_t offset,
+                                           const size_t len) const
+{
+  if (not valid() or offset + len > len_) {
+    throw out_of_range("BufferPool::Lease::share(): invalid range");
+  }
+
+  pool_->add_ref(index_);
+  return Lease(pool_, index_, ptr_ + offset, len);
+}
+
+void BufferPool::Lease::shrink(const size_t len)
+{
+  if (len > len_) {
+    throw out_of_range("BufferPool::Lease::shrink(): cannot grow a lease");
+  }
+
+  len_ = len;
+}
+
+void BufferPool::Lease::reset()
+{
+  if (pool_) {
+    pool_->release(index_);
+  }
+
+  pool_ = nullptr;
+  ptr_ = nullptr;
+  len_ = 0;
+}
@@ -0,0 +1,87 @@
+#ifndef BUFFER_POOL_HH
+#define BUFFER_POOL_HH
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// A fixed set of preallocated, equally sized buffers that are handed out as
+// leases, so that receiving a datagram does not allocate on the heap.
+// A buffer returns to the pool once all the leases on it are destroyed;
+// the pool must outlive all of its leases.
+class BufferPool
+{
+public:
+  class Lease
+  {
+  public:
+    Lease() {}
+    ~Lease();
+
+    // move constructor and assignment
+    Lease(Lease && other);
+    Lease & operator=(Lease && other);
+
+    // forbid copying or assigning; use share() instead
+    Lease(const Lease & other) = delete;
+    const Lease & operator=(const Lease & other) = delete;
+
+    // another lease on the range [offset, offset + len) of this lease
+    Lease share(const size_t offset, const size_t len) const;
+
+    // shrink the lease to its first 'len' bytes
+    void shrink(const size_t len);
+
+    // accessors
+    std::string_view data() const { return {ptr_, len_}; }
+    char * buffer() const { return ptr_; } // writable start of the lease
+    size_t size() const { return len_; }
+    bool valid() const { return pool_ != nullptr; }
+
+  private:
+    friend class BufferPool;
+    Lease(BufferPool * pool, const uint32_t index, char * ptr, const size_t len);
+
+    // give up the lease (and the buffer if this was its last lease)
+    void reset();
+
+    BufferPool * pool_ {nullptr};
+    uint32_t index_ {0};
+    char * ptr_ {nullptr};
+    size_t len_ {0};
+  };
+
+  BufferPool(const size_t num_buffers, const size_t buffer_size);
+
+  // lease a whole free buffer; return nullopt if all buffers are leased
+  std::optional<Lease> acquire();
+
+  // accessors
+  size_t buffer_size() const { return buffer_size_; }
+  size_t num_free() const { return free_list_.size(); }
+
+  // forbid copying and moving since leases point to the pool
+  BufferPool(const BufferPool & other) = delete;
+  const BufferPool & operator=(const BufferPool & other) = delete;
+  BufferPool(BufferPool && other) = delete;
+  BufferPool & operator=(BufferPool && other) = delete;
+
+private:
+  size_t buffer_size_;
+
+  // storage is left uninitialized so that untouched pages are never faulted in
+  std::unique_ptr<char[]> storage_;
+
+  // number of live leases on each buffer
+  std::vector<uint32_t> refcounts_;
+
+  // indices of free buffers (used as a stack to keep buffers cache-warm)
+  std::vector<uint32_t> free_list_;
+
+  void add_ref(const uint32_t index) { refcounts_[index]++; }
+  void release(const uint32_t index);
+};
+
+#endif /* BUFFER_POOL_HH */
@@ -1,14 +1,26 @@
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
 
 #include "epoller.hh"
 #include "exception.hh"
+#include "timestamp.hh"
 
 using namespace std;
 
 Epoller::Epoller()
-  : epfd_(check_syscall(epoll_create1(EPOLL_CLOEXEC)))
-{}
+  : epfd_(check_syscall(epoll_create1(EPOLL_CLOEXEC))), timers_(monotonic_us())
+{
+  // expired timers are fired at the end of every poll(); just consume
+  // the expiration here
+  register_event(timerfd_, In,
+    [this]()
+    {
+      timerfd_.read_expirations();
+      timerfd_expiration_ = 0;
+    }
+  );
+}
 
 Epoller::~Epoller()
 {
@@ -22,20 +34,39 @@ void Epoller::register_event(const int fd,
                              const Flag flag,
                              const Callback callback)
 {
-  if (not roster_.count(fd)) { // fd is not registered yet
-    roster_[fd][flag] = callback;
-    active_events_[fd] = flag;
-    epoll_add(fd, flag);
+  auto it = roster_.find(fd);
+
+  if (it == roster_.end()) { // fd is not registered yet
+    auto entry = make_unique<Entry>();
+    entry->fd = fd;
+
+    // register all the events once; edges are filtered in user space
+    epoll_event ev;
+    ev.data.ptr = entry.get();
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    check_syscall(epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev));
+
+    it = roster_.emplace(fd, move(entry)).first;
+  }
+  else if (it->second->deregistered) {
+    throw runtime_error("attempted to register an fd scheduled to deregister");
   }
-  else { // fd is registered but flag should not be registered yet
-    if (roster_[fd].count(flag)) {
-      throw runtime_error("attempted to register the same event");
-    }
 
-    roster_[fd][flag] = callback;
-    active_events_[fd] |= flag;
-    epoll_mod(fd, active_events_[fd]);
+  Entry & entry = *it->second;
+
+  // fd is registered but flag should not be registered yet
+  if (entry.registered & flag) {
+    throw runtime_error("attempted to register the same event");
   }
+
+  if (flag == In) {
+    entry.in_callback = callback;
+  } else {
+    entry.out_callback = callback;
+  }
+
+  entry.registered |= flag;
+  entry.active |= flag;
 }
 
 void Epoller::register_event(const FileDescriptor & fd,
@@ -47,12 +78,16 @@ void Epoller::register_event(const FileDescriptor & fd,
 
 void Epoller::activate(const int fd, const Flag flag)
 {
-  uint32_t & active_events = active_events_.at(fd);
+  Entry & entry = *roster_.at(fd);
 
   // activate only if not activated yet
-  if (not (active_events & flag)) {
-    active_events |= flag;
-    epoll_mod(fd, active_events);
+  if (not (entry.active & flag)) {
+    entry.active |= flag;
+
+    // the edge might have been consumed while inactive, so give the
+    // callback a chance to run instead of waiting for the next edge
+    entry.ready |= flag;
+    enqueue(entry);
   }
 }
 
@@ -63,13 +98,7 @@ void Epoller::activate(const FileDescriptor & fd, const Flag flag)
 
 void Epoller::deactivate(const int fd, const Flag flag)
 {
-  uint32_t & active_events = active_events_.at(fd);
-
-  // deactivate only if activated before
-  if (active_events & flag) {
-    active_events &= ~flag;
-    epoll_mod(fd, active_events);
-  }
+  roster_.at(fd)->active &= ~flag;
 }
 
 void Epoller::deactivate(const FileDescriptor & fd, const Flag flag)
@@ -79,7 +108,14 @@ void Epoller::deactivate(const FileDescriptor & fd, const Flag flag)
 
 void Epoller::deregister(const int fd)
 {
-  fds_to_deregister_.emplace(fd);
+  Entry & entry = *roster_.at(fd);
+
+  if (not entry.deregistered) {
+    // stop dispatching now but keep the entry alive until the next poll()
+    entry.deregistered = true;
+    entry.active = 0;
+    fds_to_deregister_.emplace_back(fd);
+  }
 }
 
 void Epoller::deregister(const FileDescriptor & fd)
@@ -89,52 +125,97 @@ void Epoller::deregister(const FileDescriptor & fd)
 
 void Epoller::do_deregister()
 {
+  if (fds_to_deregister_.empty()) {
+    return;
+  }
+
+  ready_list_.erase(
+    remove_if(ready_list_.begin(), ready_list_.end(),
+              [](const Entry * entry) { return entry->deregistered; }),
+    ready_list_.end());
+
   for (const int fd : fds_to_deregister_) {
-    roster_.erase(fd);
-    active_events_.erase(fd);
     check_syscall(epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr));
+    roster_.erase(fd);
   }
 
   fds_to_deregister_.clear();
 }
 
+void Epoller::enqueue(Entry & entry)
+{
+  if (not entry.queued and not entry.deregistered
+      and (entry.ready & entry.active)) {
+    entry.queued = true;
+    ready_list_.emplace_back(&entry);
+  }
+}
+
 void Epoller::poll(const int timeout_ms)
 {
-  static constexpr size_t MAX_EVENTS = 32;
-  static epoll_event event_list[MAX_EVENTS];
+  static constexpr size_t MAX_EVENTS = 64;
+  epoll_event event_list[MAX_EVENTS];
 
   // first, deregister the fds that have been scheduled to deregister
   do_deregister();
 
-  int nfds = check_syscall(
-    epoll_wait(epfd_, event_list, sizeof(event_list), timeout_ms));
+  // wake up for the next timer
+  arm_timerfd();
+
+  // don't block if there are callbacks pending from activate()
+  const int nfds = check_syscall(
+    epoll_wait(epfd_, event_list, MAX_EVENTS,
+               ready_list_.empty() ? timeout_ms : 0));
 
   for (int i = 0; i < nfds; i++) {
-    int fd = event_list[i].data.fd;
+    Entry & entry = *static_cast<Entry *>(event_list[i].data.ptr);
     uint32_t revents = event_list[i].events;
 
-    for (const auto & [flag, callback] : roster_.at(fd)) {
-      if (revents & flag) {
-        callback(); // execute the callback function
-      }
+    // let the callbacks run into the error when reading or writing
+    if (revents & (EPOLLERR | EPOLLHUP)) {
+      revents |= EPOLLIN | EPOLLOUT;
     }
+
+    // remember the edge even if the event is inactive at the moment
+    entry.ready |= revents & entry.registered;
+    enqueue(entry);
   }
-}
 
-void Epoller::epoll_add(const int fd, const uint32_t events)
-{
-  epoll_event ev;
-  ev.data.fd = fd;
-  ev.events = events;
+  // dispatch from a separate list since callbacks may enqueue entries
+  dispatch_list_.swap(ready_list_);
+
+  for (Entry * entry : dispatch_list_) {
+    entry->queued = false;
 
-  check_syscall(epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev));
+    // callbacks are expected to consume the events entirely
+    if (entry->ready & entry->active & In) {
+      entry->ready &= ~In;
+      entry->in_callback(); // execute the callback function
+    }
+
+    if (entry->ready & entry->active & Out) {
+      entry->ready &= ~Out;
+      entry->out_callback();
+    }
+  }
+
+  dispatch_list_.clear();
+
+  // fire the expired timers
+  timers_.advance(monotonic_us());
 }
 
-void Epoller::epoll_mod(const int fd, const uint32_t events)
+void Epoller::arm_timerfd()
 {
-  epoll_event ev;
-  ev.data.fd = fd;
-  ev.events = events;
+  const uint64_t expiration = timers_.next_expiration().value_or(0);
+  if (expiration == timerfd_expiration_) {
+    return;
+  }
 
-  check_syscall(epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev));
+  // absolute expiration on CLOCK_MONOTONIC, same as monotonic_us();
+  // an expiration in the past fires immediately
+  const timespec ts {static_cast<time_t>(expiration / 1000000),
+                     static_cast<long>(expiration % 1000000 * 1000)};
+  timerfd_.set_time(ts, {0, 0}, TFD_TIMER_ABSTIME);
+  timerfd_expiration_ = expiration;
 }
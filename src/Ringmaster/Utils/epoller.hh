@@ -3,12 +3,25 @@
 
 #include <sys/epoll.h>
 
+#include <memory>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 #include <functional>
 
 #include "file_descriptor.hh"
-
+#include "timerfd.hh"
+#include "timer_wheel.hh"
+
+// Edge-triggered event loop with the same interface as Poller.
+// Each fd is added to epoll once (EPOLLIN | EPOLLOUT | EPOLLET) and never
+// modified afterwards; activate()/deactivate() only flip bits in user space,
+// and poll() dispatches callbacks on the ready fds only.
+// Since an edge is reported only once, a callback must consume its event
+// entirely (i.e., read or write until EWOULDBLOCK) or deactivate itself;
+// activating an event schedules its callback to run once more, so callbacks
+// must also tolerate EWOULDBLOCK on the first attempt.
+// Timers live in a TimerWheel on the monotonic clock (monotonic_us()),
+// driven by a single timerfd that is re-armed for the next expiration.
 class Epoller
 {
 public:
@@ -46,15 +59,38 @@ public:
   void deregister(const int fd);
   void deregister(const FileDescriptor & fd);
 
-  // execute the callbacks on the ready fds
+  // execute the callbacks on the ready fds and of the expired timers;
+  // return immediately if callbacks are already pending regardless of
+  // 'timeout_ms'
   void poll(const int timeout_ms = -1);
 
+  // timer service; times are absolute in monotonic_us()
+  TimerWheel & timers() { return timers_; }
+
+  // forbid copying or moving since epoll holds pointers to the entries
+  Epoller(const Epoller & other) = delete;
+  const Epoller & operator=(const Epoller & other) = delete;
+  Epoller(Epoller && other) = delete;
+  Epoller & operator=(Epoller && other) = delete;
+
 private:
-  // add fd to the interest list and monitor provided events
-  void epoll_add(const int fd, const uint32_t events);
+  struct Entry
+  {
+    int fd;
+    Callback in_callback {};
+    Callback out_callback {};
+    uint32_t registered {0}; // events with a callback
+    uint32_t active {0};     // events the user is currently interested in
+    uint32_t ready {0};      // events reported (or forced) but not consumed
+    bool queued {false};     // if the entry is in ready_list_
+    bool deregistered {false};
+  };
+
+  // add the entry to ready_list_ if it has an active event ready
+  void enqueue(Entry & entry);
 
-  // modify the events setting to 'events' for fd
-  void epoll_mod(const int fd, const uint32_t events);
+  // arm timerfd_ for the next expiration of timers_ (if changed)
+  void arm_timerfd();
 
   // *actually* deregister fds in fds_to_deregister_
   void do_deregister();
@@ -62,14 +98,19 @@ private:
   // data members
   int epfd_;
 
-  // fd -> {flag (bit value) -> callback}
-  std::unordered_map<int, std::unordered_map<Flag, Callback>> roster_ {};
+  // fd -> entry (heap-allocated so that epoll_event.data.ptr stays valid)
+  std::unordered_map<int, std::unique_ptr<Entry>> roster_ {};
 
-  // fd -> currently active events (bitmask)
-  std::unordered_map<int, uint32_t> active_events_ {};
+  // entries with active events ready to dispatch
+  std::vector<Entry *> ready_list_ {};
+  std::vector<Entry *> dispatch_list_ {};
 
   // fds scheduled to deregister
-  std::unordered_set<int> fds_to_deregister_ {};
+  std::vector<int> fds_to_deregister_ {};
+
+  TimerWheel timers_;
+  Timerfd timerfd_ {};
+  uint64_t timerfd_expiration_ {0}; // currently armed (0: disarmed)
 };
 
 #endif /* EPOLLER_HH */
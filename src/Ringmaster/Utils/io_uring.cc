@@ -0,0 +1,458 @@
+#include <stdexcept>
+
+#include "io_uring.hh"
+#include "exception.hh"
+
+using namespace std;
+
+#ifdef HAVE_LIBURING
+
+#include <sys/eventfd.h>
+#include <liburing.h>
+
+#include <array>
+#include <cstring>
+
+#include "Logger.h"
+#include "timestamp.hh"
+
+namespace {
+  constexpr uint16_t BUF_GROUP_ID = 0;
+  constexpr uint64_t RECV_TAG = UINT64_MAX; // user_data of the receive request
+  constexpr uint64_t SEND_ERROR_LOG_US = 1000 * 1000; // at most one warning per second
+
+  // throw unix_error for a negative result returned by liburing
+  void check_uring(const int ret, const string & tag)
+  {
+    if (ret < 0) {
+      errno = -ret;
+      throw unix_error(tag);
+    }
+  }
+}
+
+struct UringUDP::Impl
+{
+  struct SendSlot
+  {
+    std::array<iovec, 2> iov; // header and payload
+    msghdr msg;
+    size_t size;
+    std::shared_ptr<const void> payload_owner; // held until the slot is free
+    uint64_t tag;
+  };
+
+  int sock_fd;
+  io_uring ring {};
+  FileDescriptor event_fd;
+  bool zero_copy {false};
+
+  // receive buffers provided to the kernel in a buffer ring; each buffer
+  // holds an io_uring_recvmsg_out header followed by the datagram
+  unsigned int num_recv_bufs;
+  size_t recv_buf_size;
+  unique_ptr<char[]> recv_bufs;
+  io_uring_buf_ring * buf_ring {nullptr};
+  msghdr recv_msg {};
+
+  // send slots hold each datagram (a copy of its header, and its payload
+  // in place or a copy) until its completion (or its zero-copy
+  // notification) arrives
+  size_t slot_size;
+  unique_ptr<char[]> send_bufs;
+  vector<SendSlot> send_slots;
+  vector<uint32_t> free_slots {};
+
+  // failed sends since the last warning
+  unsigned int num_send_errors {0};
+  uint64_t last_send_error_log_us {0};
+
+  Impl(const int fd, const bool zc, const size_t max_recv_size,
+       const size_t max_send_size, const unsigned int nbufs,
+       const unsigned int nslots);
+  ~Impl();
+
+  char * recv_buf(const uint32_t bid) { return recv_bufs.get() + bid * recv_buf_size; }
+  char * send_buf(const uint32_t slot) { return send_bufs.get() + slot * slot_size; }
+
+  io_uring_sqe * get_sqe();
+  void arm_recv();
+
+  // queue a send request of a datagram in a free send slot
+  // return false if no slot or submission queue entry is available
+  bool queue_send(const UDPSocket::Gather & datagram);
+  void free_slot(const uint32_t slot);
+  void log_send_error(const int err);
+};
+
+UringUDP::Impl::Impl(const int fd, const bool zc, const size_t max_recv_size,
+                     const size_t max_send_size, const unsigned int nbufs,
+                     const unsigned int nslots)
+  : sock_fd(fd),
+    event_fd(check_syscall(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))),
+    num_recv_bufs(nbufs),
+    recv_buf_size(sizeof(io_uring_recvmsg_out) + max_recv_size),
+    recv_bufs(new char[nbufs * recv_buf_size]),
+    slot_size(max_send_size),
+    send_bufs(new char[nslots * max_send_size]),
+    send_slots(nslots)
+{
+  if (nbufs == 0 or (nbufs & (nbufs - 1)) != 0 or nbufs > 32768) {
+    throw runtime_error("UringUDP: number of receive buffers must be a power of 2");
+  }
+
+  // room for a submission per send slot plus the receive request; a
+  // zero-copy send completes twice and multishot recvmsg completes many
+  // times, hence the larger completion queue
+  io_uring_params params {};
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 4 * (nslots + nbufs);
+  check_uring(io_uring_queue_init_params(nslots + 1, &ring, &params),
+              "io_uring_queue_init_params");
+
+  try {
+    if (zc) {
+      io_uring_probe * probe = io_uring_get_probe_ring(&ring);
+      zero_copy = probe and io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC);
+      io_uring_free_probe(probe);
+    }
+
+    int ret = 0;
+    buf_ring = io_uring_setup_buf_ring(&ring, nbufs, BUF_GROUP_ID, 0, &ret);
+    if (buf_ring == nullptr) {
+      check_uring(ret, "io_uring_setup_buf_ring");
+    }
+
+    const int mask = io_uring_buf_ring_mask(nbufs);
+    for (uint32_t i = 0; i < nbufs; i++) {
+      io_uring_buf_ring_add(buf_ring, recv_buf(i), recv_buf_size, i, mask, i);
+    }
+    io_uring_buf_ring_advance(buf_ring, nbufs);
+
+    check_uring(io_uring_register_eventfd(&ring, event_fd.fd_num()),
+                "io_uring_register_eventfd");
+  } catch (...) {
+    if (buf_ring) {
+      io_uring_free_buf_ring(&ring, buf_ring, nbufs, BUF_GROUP_ID);
+    }
+    io_uring_queue_exit(&ring);
+    throw;
+  }
+
+  free_slots.reserve(nslots);
+  for (uint32_t i = nslots; i > 0; i--) {
+    free_slots.push_back(i - 1);
+  }
+
+  arm_recv();
+  check_uring(io_uring_submit(&ring), "io_uring_submit");
+}
+
+UringUDP::Impl::~Impl()
+{
+  // don't throw from destructor
+  io_uring_free_buf_ring(&ring, buf_ring, num_recv_bufs, BUF_GROUP_ID);
+  io_uring_queue_exit(&ring);
+}
+
+io_uring_sqe * UringUDP::Impl::get_sqe()
+{
+  io_uring_sqe * sqe = io_uring_get_sqe(&ring);
+  if (sqe == nullptr) { // submission queue is full; flush it
+    check_uring(io_uring_submit(&ring), "io_uring_submit");
+    sqe = io_uring_get_sqe(&ring);
+  }
+
+  return sqe;
+}
+
+void UringUDP::Impl::arm_recv()
+{
+  io_uring_sqe * sqe = get_sqe();
+  if (sqe == nullptr) {
+    throw runtime_error("UringUDP: no submission queue entry for recvmsg");
+  }
+
+  // connected socket: no source address or ancillary data
+  recv_msg = {};
+  io_uring_prep_recvmsg_multishot(sqe, sock_fd, &recv_msg, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUF_GROUP_ID;
+  io_uring_sqe_set_data64(sqe, RECV_TAG);
+}
+
+UringUDP::UringUDP(UDPSocket & sock, const bool zero_copy,
+                   const size_t max_recv_size, const size_t max_send_size,
+                   const unsigned int num_recv_bufs,
+                   const unsigned int num_send_slots)
+  : impl_(make_unique<Impl>(sock.fd_num(), zero_copy, max_recv_size,
+                            max_send_size, num_recv_bufs, num_send_slots))
+{}
+
+UringUDP::~UringUDP() {}
+
+FileDescriptor & UringUDP::event_fd()
+{
+  return impl_->event_fd;
+}
+
+bool UringUDP::zero_copy() const
+{
+  return impl_->zero_copy;
+}
+
+size_t UringUDP::num_free_send_slots() const
+{
+  return impl_->free_slots.size();
+}
+
+bool UringUDP::Impl::queue_send(const UDPSocket::Gather & datagram)
+{
+  const size_t size = datagram.size();
+  if (size == 0) {
+    throw runtime_error("attempted to send empty data");
+  }
+
+  // a payload with an owner is sent in place; anything else is copied so
+  // that the caller's buffers can go away before the send completes
+  const bool in_place = datagram.payload_owner and not datagram.payload.empty();
+  const size_t copy_size = in_place ? datagram.header.size() : size;
+  if (copy_size > slot_size) {
+    throw runtime_error("UringUDP::send_batch(): datagram larger than a send slot");
+  }
+
+  if (free_slots.empty()) {
+    return false; // all the slots are in flight; try again after completions
+  }
+
+  io_uring_sqe * sqe = get_sqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+
+  const uint32_t slot = free_slots.back();
+  free_slots.pop_back();
+
+  char * buf = send_buf(slot);
+  memcpy(buf, datagram.header.data(), datagram.header.size());
+
+  SendSlot & s = send_slots[slot];
+  s.msg = {};
+  s.msg.msg_iov = s.iov.data();
+  if (in_place) {
+    s.iov[0] = {buf, datagram.header.size()};
+    s.iov[1] = {const_cast<char *>(datagram.payload.data()), datagram.payload.size()};
+    s.msg.msg_iovlen = 2;
+    s.payload_owner = datagram.payload_owner;
+  } else {
+    memcpy(buf + datagram.header.size(), datagram.payload.data(), datagram.payload.size());
+    s.iov[0] = {buf, size};
+    s.msg.msg_iovlen = 1;
+  }
+  s.size = size;
+  s.tag = datagram.tag;
+
+  if (zero_copy) {
+    io_uring_prep_sendmsg_zc(sqe, sock_fd, &s.msg, 0);
+  } else {
+    io_uring_prep_sendmsg(sqe, sock_fd, &s.msg, 0);
+  }
+  io_uring_sqe_set_data64(sqe, slot);
+
+  return true;
+}
+
+void UringUDP::Impl::free_slot(const uint32_t slot)
+{
+  send_slots[slot].payload_owner.reset();
+  free_slots.push_back(slot);
+}
+
+void UringUDP::Impl::log_send_error(const int err)
+{
+  num_send_errors++;
+
+  const uint64_t now = monotonic_us();
+  if (now < last_send_error_log_us + SEND_ERROR_LOG_US) {
+    return;
+  }
+
+  LOG(LogLevel::WARNING) << "UringUDP: " << num_send_errors
+                         << " send(s) failed, last with: " << strerror(err);
+  num_send_errors = 0;
+  last_send_error_log_us = now;
+}
+
+size_t UringUDP::send_batch(const vector<string_view> & data)
+{
+  size_t num_queued = 0;
+  while (num_queued < data.size() and impl_->queue_send({data[num_queued], {}})) {
+    num_queued++;
+  }
+
+  if (num_queued > 0) {
+    check_uring(io_uring_submit(&impl_->ring), "io_uring_submit");
+  }
+
+  return num_queued;
+}
+
+size_t UringUDP::send_batch(const vector<UDPSocket::Gather> & data)
+{
+  size_t num_queued = 0;
+  while (num_queued < data.size()
+         and impl_->queue_send(data[num_queued])) {
+    num_queued++;
+  }
+
+  if (num_queued > 0) {
+    check_uring(io_uring_submit(&impl_->ring), "io_uring_submit");
+  }
+
+  return num_queued;
+}
+
+bool UringUDP::process_completions(const RecvCallback & on_recv,
+                                   const SendErrorCallback & on_send_error)
+{
+  Impl & u = *impl_;
+
+  // consume the notification first so that later completions signal again
+  uint64_t num_events;
+  if (::read(u.event_fd.fd_num(), &num_events, sizeof(num_events)) < 0
+      and errno != EAGAIN) {
+    throw unix_error("UringUDP: read eventfd");
+  }
+
+  const int mask = io_uring_buf_ring_mask(u.num_recv_bufs);
+  unsigned int num_recycled = 0;
+  bool rearm_recv = false;
+  bool slots_freed = false;
+
+  io_uring_cqe * cqe;
+  unsigned int head;
+  unsigned int num_cqes = 0;
+
+  io_uring_for_each_cqe(&u.ring, head, cqe) {
+    num_cqes++;
+    const uint64_t tag = io_uring_cqe_get_data64(cqe);
+
+    if (tag == RECV_TAG) {
+      // the multishot request terminates e.g. when it runs out of buffers
+      if (not (cqe->flags & IORING_CQE_F_MORE)) {
+        rearm_recv = true;
+      }
+
+      if (cqe->res == -ENOBUFS) {
+        continue;
+      }
+      check_uring(cqe->res, "UringUDP: recvmsg");
+
+      if (not (cqe->flags & IORING_CQE_F_BUFFER)) {
+        continue;
+      }
+
+      const uint32_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      char * buf = u.recv_buf(bid);
+
+      io_uring_recvmsg_out * out = io_uring_recvmsg_validate(buf, cqe->res, &u.recv_msg);
+      if (out == nullptr) {
+        throw runtime_error("UringUDP: invalid recvmsg completion");
+      }
+
+      if (out->flags & MSG_TRUNC) {
+        throw runtime_error("UringUDP: datagram truncated");
+      }
+
+      const char * payload = static_cast<const char *>(io_uring_recvmsg_payload(out, &u.recv_msg));
+      const size_t len = io_uring_recvmsg_payload_length(out, cqe->res, &u.recv_msg);
+      on_recv({payload, len});
+
+      // give the buffer back to the kernel
+      io_uring_buf_ring_add(u.buf_ring, buf, u.recv_buf_size, bid, mask, num_recycled++);
+    } else {
+      const uint32_t slot = tag;
+
+      // the second completion of a zero-copy send: the buffers are released
+      if (cqe->flags & IORING_CQE_F_NOTIF) {
+        u.free_slot(slot);
+        slots_freed = true;
+        continue;
+      }
+
+      if (cqe->res < 0) {
+        // e.g., EAGAIN or ENOBUFS under load, or ECONNREFUSED before the
+        // peer is up; the caller may send the datagram again
+        u.log_send_error(-cqe->res);
+        if (on_send_error) {
+          on_send_error(u.send_slots[slot].tag, -cqe->res);
+        }
+      } else if (static_cast<size_t>(cqe->res) != u.send_slots[slot].size) {
+        throw runtime_error("UringUDP failed to deliver target number of bytes");
+      }
+
+      // a zero-copy send still holds the buffers until its notification
+      if (not (cqe->flags & IORING_CQE_F_MORE)) {
+        u.free_slot(slot);
+        slots_freed = true;
+      }
+    }
+  }
+
+  io_uring_cq_advance(&u.ring, num_cqes);
+
+  if (num_recycled > 0) {
+    io_uring_buf_ring_advance(u.buf_ring, num_recycled);
+  }
+
+  if (rearm_recv) {
+    u.arm_recv();
+    check_uring(io_uring_submit(&u.ring), "io_uring_submit");
+  }
+
+  return slots_freed;
+}
+
+#else /* HAVE_LIBURING */
+
+struct UringUDP::Impl {};
+
+UringUDP::UringUDP(UDPSocket &, const bool, const size_t, const size_t,
+                   const unsigned int, const unsigned int)
+{
+  throw runtime_error("UringUDP: built without liburing");
+}
+
+UringUDP::~UringUDP() {}
+
+FileDescriptor & UringUDP::event_fd()
+{
+  throw runtime_error("UringUDP: built without liburing");
+}
+
+size_t UringUDP::send_batch(const vector<string_view> &)
+{
+  throw runtime_error("UringUDP: built without liburing");
+}
+
+size_t UringUDP::send_batch(const vector<UDPSocket::Gather> &)
+{
+  throw runtime_error("UringUDP: built without liburing");
+}
+
+bool UringUDP::process_completions(const RecvCallback &, const SendErrorCallback &)
+{
+  throw runtime_error("UringUDP: built without liburing");
+}
+
+bool UringUDP::zero_copy() const
+{
+  return false;
+}
+
+size_t UringUDP::num_free_send_slots() const
+{
+  return 0;
+}
+
+#endif /* HAVE_LIBURING */
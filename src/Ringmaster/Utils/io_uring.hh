@@ -0,0 +1,68 @@
+#ifndef IO_URING_HH
+#define IO_URING_HH
+
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+#include "udp_socket.hh"
+
+// io_uring backend for a connected UDPSocket: datagrams are received by a
+// multishot recvmsg into a ring of provided buffers, and sent in batches
+// (one io_uring_enter() per batch) from send slots, optionally with
+// zero-copy sendmsg (SEND_ZC, Linux >= 6.0). A payload with an owner is
+// sent in place (only its header is copied into the slot).
+// Completions are signaled on an eventfd that the caller registers in
+// its event loop. The socket must outlive the UringUDP.
+// Throws on construction if the binary was built without liburing
+// (HAVE_LIBURING) or the kernel lacks the features, so callers can fall
+// back to the plain socket calls.
+class UringUDP
+{
+public:
+  using RecvCallback = std::function<void(const std::string_view datagram)>;
+  using SendErrorCallback = std::function<void(const uint64_t tag, const int err)>;
+
+  UringUDP(UDPSocket & sock,
+           const bool zero_copy = false,
+           const size_t max_recv_size = 2048, // bytes per received datagram
+           const size_t max_send_size = 2048, // bytes per sent datagram
+           const unsigned int num_recv_bufs = 256, // must be a power of 2
+           const unsigned int num_send_slots = 256);
+  ~UringUDP();
+
+  // forbid copying or moving since the kernel holds pointers to the buffers
+  UringUDP(const UringUDP & other) = delete;
+  const UringUDP & operator=(const UringUDP & other) = delete;
+  UringUDP(UringUDP && other) = delete;
+  UringUDP & operator=(UringUDP && other) = delete;
+
+  // readable whenever completions are ready (register with Epoller::In)
+  FileDescriptor & event_fd();
+
+  // queue datagrams in free send slots and submit them with one syscall
+  // (payloads without an owner are copied into the slots)
+  // return the number of datagrams queued; a return value smaller than
+  // data.size() indicates that all the send slots are in flight
+  size_t send_batch(const std::vector<std::string_view> & data);
+  size_t send_batch(const std::vector<UDPSocket::Gather> & data);
+
+  // reap all the completions: pass each received datagram to 'on_recv'
+  // (the view is valid only during the call), pass the tag of each datagram
+  // whose send failed (e.g., EAGAIN or ENOBUFS under load) to
+  // 'on_send_error', and recycle the send slots
+  // return true if any send slot was freed
+  bool process_completions(const RecvCallback & on_recv,
+                           const SendErrorCallback & on_send_error = {});
+
+  // accessors
+  bool zero_copy() const;
+  size_t num_free_send_slots() const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+#endif /* IO_URING_HH */
@@ -36,6 +36,36 @@ string WireParser::read_string(const size_t len)
   return ret;
 }
 
+string_view WireParser::read_view(const size_t len)
+{
+  if (len > str_.size()) {
+    throw out_of_range("WireParser::read_view(): attempted to read past end");
+  }
+
+  const string_view ret = str_.substr(0, len);
+
+  // move the start of string view forward
+  str_.remove_prefix(len);
+
+  return ret;
+}
+
+uint64_t WireParser::read_varint()
+{
+  uint64_t ret = 0;
+
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    const uint8_t byte = read<uint8_t>();
+    ret |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+    if (not (byte & 0x80)) {
+      return ret;
+    }
+  }
+
+  throw out_of_range("WireParser::read_varint(): varint too long");
+}
+
 void WireParser::skip(const size_t len)
 {
   if (len > str_.size()) {
@@ -44,3 +74,22 @@ void WireParser::skip(const size_t len)
 
   str_.remove_prefix(len);
 }
+
+void WireWriter::write_varint(uint64_t host)
+{
+  while (host >= 0x80) {
+    write(static_cast<uint8_t>(host | 0x80));
+    host >>= 7;
+  }
+  write(static_cast<uint8_t>(host));
+}
+
+void WireWriter::write_bytes(const string_view data)
+{
+  if (size_ + data.size() > capacity_) {
+    throw out_of_range("WireWriter::write_bytes(): attempted to write past end");
+  }
+
+  memcpy(buf_ + size_, data.data(), data.size());
+  size_ += data.size();
+}
@@ -68,6 +68,18 @@ T get_bits(const T number, const size_t bit_offset, const size_t bit_len) // bit
   return ret;
 }
 
+// number of bytes of 'value' as a varint (LEB128: 7 bits per byte, least
+// significant group first, high bit set on all but the last byte)
+inline size_t varint_size(uint64_t value)
+{
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
 class WireParser
 {
 public:
@@ -77,10 +89,15 @@ public:
   uint16_t read_uint16() { return read<uint16_t>(); }
   uint32_t read_uint32() { return read<uint32_t>(); }
   uint64_t read_uint64() { return read<uint64_t>(); }
+  uint64_t read_varint();
 
   std::string read_string(const size_t len);
   std::string read_string() { return read_string(str_.size()); }
 
+  // similar to read_string() but return a view into the parsed data
+  std::string_view read_view(const size_t len);
+  std::string_view read_view() { return read_view(str_.size()); }
+
   // skip 'len' bytes ahead
   void skip(const size_t len);
 
@@ -104,4 +121,41 @@ private:
   }
 };
 
+// serialize numbers in network byte order into a caller-provided buffer
+// (e.g., on the stack) without allocating
+class WireWriter
+{
+public:
+  WireWriter(char * buf, const size_t capacity) : buf_(buf), capacity_(capacity) {}
+
+  void write_uint8(const uint8_t host) { write(host); }
+  void write_uint16(const uint16_t host) { write(host); }
+  void write_uint32(const uint32_t host) { write(host); }
+  void write_uint64(const uint64_t host) { write(host); }
+  void write_varint(uint64_t host);
+
+  void write_bytes(const std::string_view data);
+
+  // accessors
+  size_t size() const { return size_; }
+  std::string_view data() const { return {buf_, size_}; }
+
+private:
+  char * buf_;
+  size_t capacity_;
+  size_t size_ {0};
+
+  template<typename T>
+  void write(const T host)
+  {
+    if (size_ + sizeof(T) > capacity_) {
+      throw std::out_of_range("WireWriter::write(): write past end");
+    }
+
+    const T net = hton(host); // convert to network byte order
+    memcpy(buf_ + size_, &net, sizeof(T));
+    size_ += sizeof(T);
+  }
+};
+
 #endif /* SERIALIZATION_HH */
@@ -0,0 +1,291 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include "timer_wheel.hh"
+
+using namespace std;
+
+namespace {
+  // rotate the occupancy bitmap right so that bit 'shift' becomes bit 0
+  uint64_t rotate_right(const uint64_t bits, const unsigned int shift)
+  {
+    return shift == 0 ? bits : (bits >> shift) | (bits << (64 - shift));
+  }
+}
+
+TimerWheel::TimerWheel(const uint64_t now_us, const uint64_t tick_us)
+  : tick_us_(tick_us), current_tick_(0), heads_()
+{
+  if (tick_us_ == 0) {
+    throw runtime_error("TimerWheel: tick must be positive");
+  }
+
+  current_tick_ = now_us / tick_us_;
+  heads_.fill(NIL);
+}
+
+uint64_t TimerWheel::to_tick(const uint64_t time_us) const
+{
+  // round up so that a timer never fires before its expiration
+  return (time_us + tick_us_ - 1) / tick_us_;
+}
+
+TimerWheel::TimerId TimerWheel::schedule(const uint64_t expiration_us,
+                                         Callback callback)
+{
+  return schedule_periodic(expiration_us, 0, move(callback));
+}
+
+TimerWheel::TimerId TimerWheel::schedule_periodic(const uint64_t expiration_us,
+                                                  const uint64_t interval_us,
+                                                  Callback callback)
+{
+  if (not callback) {
+    throw runtime_error("TimerWheel: empty callback");
+  }
+
+  const uint32_t index = alloc_node();
+  Node & node = nodes_[index];
+  node.expiration_tick = to_tick(expiration_us);
+  node.interval_us = interval_us;
+  node.callback = move(callback);
+
+  insert(index);
+
+  return {index, node.generation};
+}
+
+bool TimerWheel::pending(const TimerId id) const
+{
+  return id.index < nodes_.size()
+         and nodes_[id.index].generation == id.generation
+         and nodes_[id.index].slot != NIL;
+}
+
+bool TimerWheel::cancel(const TimerId id)
+{
+  if (not pending(id)) {
+    return false;
+  }
+
+  unlink(id.index);
+  free_node(id.index);
+
+  return true;
+}
+
+size_t TimerWheel::advance(const uint64_t now_us)
+{
+  const uint64_t target_tick = now_us / tick_us_;
+  size_t num_fired = 0;
+
+  while (current_tick_ <= target_tick) {
+    // skip the ticks with nothing to fire or cascade
+    const auto next_tick = next_expiration();
+    if (not next_tick or *next_tick / tick_us_ > target_tick) {
+      current_tick_ = target_tick + 1;
+      break;
+    }
+    current_tick_ = max(current_tick_, *next_tick / tick_us_);
+
+    const uint64_t tick = current_tick_;
+
+    // move the timers of the higher-level slots starting at this tick down
+    for (unsigned int level = LEVELS - 1; level > 0; level--) {
+      if ((tick & ((uint64_t(1) << (BITS * level)) - 1)) == 0) {
+        cascade(level, (tick >> (BITS * level)) & (SLOTS - 1));
+      }
+    }
+
+    // detach the expired timers onto the firing list
+    const uint32_t slot = tick & (SLOTS - 1);
+    heads_[FIRING_SLOT] = heads_[slot];
+    heads_[slot] = NIL;
+    occupied_[0] &= ~(uint64_t(1) << slot);
+    for (uint32_t i = heads_[FIRING_SLOT]; i != NIL; i = nodes_[i].next) {
+      nodes_[i].slot = FIRING_SLOT;
+    }
+
+    // timers scheduled by the callbacks below will land in later ticks
+    current_tick_ = tick + 1;
+
+    // a callback may cancel or schedule timers, so pop one at a time
+    while (heads_[FIRING_SLOT] != NIL) {
+      const uint32_t index = heads_[FIRING_SLOT];
+      unlink(index);
+
+      Node & node = nodes_[index];
+      Callback callback = move(node.callback);
+
+      if (node.interval_us == 0) { // one-shot
+        free_node(index);
+        callback();
+      } else {
+        const uint32_t generation = node.generation;
+
+        // reschedule before the callback so that it can cancel itself
+        const uint64_t interval_ticks = max<uint64_t>(1, node.interval_us / tick_us_);
+        node.expiration_tick += interval_ticks;
+        if (node.expiration_tick <= target_tick) { // skip missed intervals
+          node.expiration_tick += ((target_tick - node.expiration_tick) / interval_ticks + 1)
+                                  * interval_ticks;
+        }
+        insert(index);
+
+        callback();
+
+        // nodes_ might have been reallocated in the callback
+        if (nodes_[index].generation == generation) {
+          nodes_[index].callback = move(callback);
+        }
+      }
+
+      num_fired++;
+    }
+  }
+
+  return num_fired;
+}
+
+optional<uint64_t> TimerWheel::next_expiration() const
+{
+  if (num_timers_ == 0) {
+    return nullopt;
+  }
+
+  uint64_t next_tick = UINT64_MAX;
+
+  for (unsigned int level = 0; level < LEVELS; level++) {
+    if (occupied_[level] == 0) {
+      continue;
+    }
+
+    const unsigned int shift = BITS * level;
+    const unsigned int idx = (current_tick_ >> shift) & (SLOTS - 1);
+
+    if (level == 0) {
+      // level-0 slots hold the timers of the current SLOTS-tick block
+      const unsigned int dist = __builtin_ctzll(rotate_right(occupied_[0], idx));
+      next_tick = min(next_tick, current_tick_ + dist);
+    } else {
+      // a higher-level slot is cascaded when the tick reaches its start;
+      // once past that start, the current slot only comes around again
+      // after a full rotation
+      const unsigned int first = (current_tick_ & ((uint64_t(1) << shift) - 1)) == 0 ? 0 : 1;
+      const unsigned int dist = first + __builtin_ctzll(
+          rotate_right(occupied_[level], (idx + first) & (SLOTS - 1)));
+      next_tick = min(next_tick, ((current_tick_ >> shift) + dist) << shift);
+    }
+  }
+
+  return next_tick * tick_us_;
+}
+
+uint32_t TimerWheel::alloc_node()
+{
+  uint32_t index;
+
+  if (free_head_ != NIL) {
+    index = free_head_;
+    free_head_ = nodes_[index].next;
+  } else {
+    if (nodes_.size() >= NIL) {
+      throw runtime_error("TimerWheel: too many timers");
+    }
+    index = nodes_.size();
+    nodes_.emplace_back();
+  }
+
+  nodes_[index].prev = NIL;
+  nodes_[index].next = NIL;
+  num_timers_++;
+
+  return index;
+}
+
+void TimerWheel::free_node(const uint32_t index)
+{
+  Node & node = nodes_[index];
+  node.callback = nullptr;
+  node.generation++; // invalidate the outstanding TimerIds
+  node.slot = NIL;
+  node.prev = NIL;
+  node.next = free_head_;
+  free_head_ = index;
+
+  num_timers_--;
+}
+
+void TimerWheel::insert(const uint32_t index)
+{
+  const uint64_t tick = max(nodes_[index].expiration_tick, current_tick_);
+
+  // the lowest level whose current rotation includes the tick
+  unsigned int level = 0;
+  while (level < LEVELS - 1 and
+         (tick >> (BITS * (level + 1))) != (current_tick_ >> (BITS * (level + 1)))) {
+    level++;
+  }
+
+  // timers beyond the span of the wheel wait in the top level and get
+  // reinserted each time their slot is cascaded
+  const uint32_t slot_idx = (tick >> (BITS * level)) & (SLOTS - 1);
+  link(index, level * SLOTS + slot_idx);
+}
+
+void TimerWheel::link(const uint32_t index, const uint32_t slot)
+{
+  Node & node = nodes_[index];
+  node.slot = slot;
+  node.prev = NIL;
+  node.next = heads_[slot];
+
+  if (heads_[slot] != NIL) {
+    nodes_[heads_[slot]].prev = index;
+  }
+  heads_[slot] = index;
+
+  if (slot != FIRING_SLOT) {
+    occupied_[slot / SLOTS] |= uint64_t(1) << (slot % SLOTS);
+  }
+}
+
+void TimerWheel::unlink(const uint32_t index)
+{
+  Node & node = nodes_[index];
+  const uint32_t slot = node.slot;
+
+  if (node.prev != NIL) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    heads_[slot] = node.next;
+  }
+
+  if (node.next != NIL) {
+    nodes_[node.next].prev = node.prev;
+  }
+
+  if (heads_[slot] == NIL and slot != FIRING_SLOT) {
+    occupied_[slot / SLOTS] &= ~(uint64_t(1) << (slot % SLOTS));
+  }
+
+  node.slot = NIL;
+  node.prev = NIL;
+  node.next = NIL;
+}
+
+void TimerWheel::cascade(const unsigned int level, const unsigned int slot_idx)
+{
+  const uint32_t slot = level * SLOTS + slot_idx;
+
+  // detach the whole list first since a timer may land in the same slot
+  uint32_t index = heads_[slot];
+  heads_[slot] = NIL;
+  occupied_[level] &= ~(uint64_t(1) << slot_idx);
+
+  while (index != NIL) {
+    const uint32_t next = nodes_[index].next;
+    insert(index);
+    index = next;
+  }
+}
@@ -0,0 +1,109 @@
+#ifndef TIMER_WHEEL_HH
+#define TIMER_WHEEL_HH
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <optional>
+#include <functional>
+
+// Hierarchical timing wheel (Varghese & Lauck) for many cheap timers.
+// Times are absolute in microseconds on the caller's clock (normally
+// monotonic_us()) and are rounded up to a tick, so a timer never fires
+// early. Scheduling and cancellation are O(1); advance() is O(1) per tick
+// plus the timers that fire or cascade down a level.
+class TimerWheel
+{
+public:
+  using Callback = std::function<void()>;
+
+  // handle to a scheduled timer; stale handles are detected by generation
+  struct TimerId
+  {
+    uint32_t index {UINT32_MAX};
+    uint32_t generation {0};
+
+    bool valid() const { return index != UINT32_MAX; }
+  };
+
+  static constexpr uint64_t DEFAULT_TICK_US = 100;
+
+  TimerWheel(const uint64_t now_us, const uint64_t tick_us = DEFAULT_TICK_US);
+
+  // schedule a one-shot timer firing at 'expiration_us'
+  TimerId schedule(const uint64_t expiration_us, Callback callback);
+
+  // schedule a timer firing at 'expiration_us' and then every 'interval_us'
+  // (missed intervals are skipped rather than fired in a burst)
+  TimerId schedule_periodic(const uint64_t expiration_us,
+                            const uint64_t interval_us,
+                            Callback callback);
+
+  // cancel a timer; return false if it has fired (one-shot) or been canceled
+  // (safe to call from any callback, including the timer's own)
+  bool cancel(const TimerId id);
+
+  // if the timer is still scheduled
+  bool pending(const TimerId id) const;
+
+  // fire the callbacks of all the timers expired by 'now_us'
+  // return the number of callbacks executed
+  size_t advance(const uint64_t now_us);
+
+  // the earliest time advance() needs to be called (may be earlier than the
+  // actual next expiration when timers are still in higher levels)
+  std::optional<uint64_t> next_expiration() const;
+
+  // accessors
+  size_t size() const { return num_timers_; }
+  bool empty() const { return num_timers_ == 0; }
+  uint64_t tick_us() const { return tick_us_; }
+
+private:
+  static constexpr unsigned int BITS = 6;
+  static constexpr unsigned int SLOTS = 1 << BITS; // per level
+  static constexpr unsigned int LEVELS = 4;
+  static constexpr uint32_t NIL = UINT32_MAX;
+
+  // pseudo-slot holding the timers being fired by advance()
+  static constexpr uint32_t FIRING_SLOT = LEVELS * SLOTS;
+
+  struct Node
+  {
+    uint64_t expiration_tick {0};
+    uint64_t interval_us {0}; // 0 for one-shot timers
+    Callback callback {};
+    uint32_t generation {0};
+    uint32_t slot {NIL}; // NIL if the node is free
+    uint32_t prev {NIL};
+    uint32_t next {NIL}; // also links the free list
+  };
+
+  uint64_t tick_us_;
+  uint64_t current_tick_; // the next tick to be processed
+
+  std::vector<Node> nodes_ {};
+  uint32_t free_head_ {NIL};
+  size_t num_timers_ {0};
+
+  // head node of each slot's doubly linked list (and the firing list)
+  std::array<uint32_t, LEVELS * SLOTS + 1> heads_;
+
+  // bit i is set if slot i of the level is nonempty
+  std::array<uint64_t, LEVELS> occupied_ {};
+
+  uint32_t alloc_node();
+  void free_node(const uint32_t index);
+
+  // link a node into the slot for its expiration tick relative to now
+  void insert(const uint32_t index);
+  void link(const uint32_t index, const uint32_t slot);
+  void unlink(const uint32_t index);
+
+  // move the timers of a higher-level slot down to lower levels
+  void cascade(const unsigned int level, const unsigned int slot_idx);
+
+  uint64_t to_tick(const uint64_t time_us) const;
+};
+
+#endif /* TIMER_WHEEL_HH */
@@ -9,21 +9,26 @@ Timerfd::Timerfd(int clockid, int flags)
 {}
 
 void Timerfd::set_time(const timespec & initial_expiration,
-                       const timespec & interval)
+                       const timespec & interval,
+                       const int flags)
 {
   itimerspec its;
   its.it_value = initial_expiration;
   its.it_interval = interval;
 
-  check_syscall(timerfd_settime(fd_num(), 0, &its, nullptr));
+  check_syscall(timerfd_settime(fd_num(), flags, &its, nullptr));
 }
 
 unsigned int Timerfd::read_expirations()
 {
   uint64_t num_exp = 0;
-  
-  if (check_syscall(::read(fd_num(), &num_exp, sizeof(num_exp)))
-      != sizeof(num_exp)) {
+
+  const ssize_t ret = ::read(fd_num(), &num_exp, sizeof(num_exp));
+  if (ret < 0 and errno == EAGAIN) {
+    return 0; // not expired yet (in nonblocking mode)
+  }
+
+  if (check_syscall(ret) != sizeof(num_exp)) {
     throw runtime_error("read error in timerfd");
   }
   // q: in what situration will num_exp in the fd be greater than 1?
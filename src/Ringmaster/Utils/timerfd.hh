@@ -11,9 +11,14 @@ class Timerfd : public FileDescriptor
 public:
   Timerfd(int clockid = CLOCK_MONOTONIC, int flags = TFD_NONBLOCK);
 
+  // 'flags' may be TFD_TIMER_ABSTIME to set an absolute initial expiration;
+  // a zero initial expiration disarms the timer
   void set_time(const timespec & initial_expiration,
-                const timespec & interval);
+                const timespec & interval,
+                const int flags = 0);
 
+  // return the number of expirations since the last read
+  // (0 if the timer has not expired yet in nonblocking mode)
   unsigned int read_expirations();
 };
 
@@ -21,6 +21,12 @@ uint64_t timestamp_ms()
   return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
 }
 
+uint64_t monotonic_us()
+{
+  // steady_clock is CLOCK_MONOTONIC on Linux, as used by Timerfd
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
 // uint64_t timestamp_ns()
 // {
 //   return system_clock::now().time_since_epoch() / 1ns;
@@ -12,4 +12,7 @@ uint64_t timestamp_us();
 /* milliseconds since epoch */
 uint64_t timestamp_ms();
 
+/* microseconds on the monotonic clock (for timers; unaffected by clock changes) */
+uint64_t monotonic_us();
+
 #endif /* TIMESTAMP_HH */
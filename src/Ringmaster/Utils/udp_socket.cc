@@ -1,11 +1,129 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <stdexcept>
+#include <cstring>
 
 #include "udp_socket.hh"
 #include "exception.hh"
 
+// socket options in case the libc headers predate them
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
 using namespace std;
 
+namespace {
+  // point 'iov' to the buffers of a datagram; return the number of iovecs
+  size_t to_iovecs(const string_view data, iovec * iov)
+  {
+    iov[0] = { const_cast<char *>(data.data()), data.size() };
+    return 1;
+  }
+
+  size_t to_iovecs(const UDPSocket::Gather & data, iovec * iov)
+  {
+    size_t num_iov = 0;
+
+    if (not data.header.empty()) {
+      iov[num_iov++] = { const_cast<char *>(data.header.data()), data.header.size() };
+    }
+    if (not data.payload.empty()) {
+      iov[num_iov++] = { const_cast<char *>(data.payload.data()), data.payload.size() };
+    }
+
+    return num_iov;
+  }
+
+  size_t size_of(const string_view data) { return data.size(); }
+  size_t size_of(const UDPSocket::Gather & data) { return data.size(); }
+
+  // control message space of a datagram
+  constexpr size_t CTRL_SPACE = CMSG_SPACE(sizeof(uint64_t));
+
+  // attach the control messages of a datagram to 'msg' (SCM_TXTIME)
+  void to_control(const string_view, msghdr &, char *) {}
+
+  void to_control(const UDPSocket::Gather & data, msghdr & msg, char * ctrl_buf)
+  {
+    if (data.txtime == 0) {
+      return;
+    }
+
+    msg.msg_control = ctrl_buf;
+    msg.msg_controllen = CTRL_SPACE;
+    cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &data.txtime, sizeof(uint64_t));
+  }
+
+  // send a batch of datagrams with a single sendmmsg() per MAX_BATCH_SIZE
+  template<typename T>
+  size_t sendmmsg_batch(const int fd, const vector<T> & data)
+  {
+    static constexpr size_t MAX_BATCH_SIZE = UDPSocket::MAX_BATCH_SIZE;
+
+    array<mmsghdr, MAX_BATCH_SIZE> msgs;
+    array<iovec, 2 * MAX_BATCH_SIZE> iovs;
+    alignas(cmsghdr) char ctrl_bufs[MAX_BATCH_SIZE][CTRL_SPACE];
+
+    size_t total_sent = 0;
+
+    while (total_sent < data.size()) {
+      const size_t batch_size = min(data.size() - total_sent, MAX_BATCH_SIZE);
+
+      for (size_t i = 0; i < batch_size; i++) {
+        const T & datagram = data[total_sent + i];
+        if (size_of(datagram) == 0) {
+          throw runtime_error("attempted to send empty data");
+        }
+
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_iov = &iovs[2 * i];
+        msgs[i].msg_hdr.msg_iovlen = to_iovecs(datagram, &iovs[2 * i]);
+        to_control(datagram, msgs[i].msg_hdr, ctrl_bufs[i]);
+      }
+
+      const int num_sent = ::sendmmsg(fd, msgs.data(), batch_size, 0);
+      if (num_sent < 0) {
+        if (errno == EWOULDBLOCK) {
+          return total_sent; // EWOULDBLOCK before sending anything in this batch
+        }
+
+        throw unix_error("UDPSocket:send_batch()");
+      }
+
+      for (int i = 0; i < num_sent; i++) {
+        if (msgs[i].msg_len != size_of(data[total_sent + i])) {
+          throw runtime_error("UDPSocket failed to deliver target number of bytes");
+        }
+      }
+
+      total_sent += num_sent;
+
+      // sendmmsg() stops early when the next datagram would block
+      if (static_cast<size_t>(num_sent) < batch_size) {
+        break;
+      }
+    }
+
+    return total_sent;
+  }
+}
+
 bool UDPSocket::check_bytes_sent(const ssize_t bytes_sent,
                                  const size_t target) const
 {
@@ -47,6 +165,24 @@ bool UDPSocket::sendto(const Address & dst_addr, const string_view data)
   return check_bytes_sent(bytes_sent, data.size());
 }
 
+bool UDPSocket::send(const Gather & datagram)
+{
+  if (datagram.size() == 0) {
+    throw runtime_error("attempted to send empty data");
+  }
+
+  array<iovec, 2> iovs;
+  msghdr msg {};
+  msg.msg_iov = iovs.data();
+  msg.msg_iovlen = to_iovecs(datagram, iovs.data());
+
+  alignas(cmsghdr) char ctrl_buf[CTRL_SPACE];
+  to_control(datagram, msg, ctrl_buf);
+
+  const ssize_t bytes_sent = ::sendmsg(fd_num(), &msg, 0);
+  return check_bytes_sent(bytes_sent, datagram.size());
+}
+
 bool UDPSocket::check_bytes_received(const ssize_t bytes_received) const
 {
   if (bytes_received < 0) {
@@ -94,3 +230,239 @@ pair<Address, optional<string>> UDPSocket::recvfrom()
   return { Address{src_addr, src_addr_len},
            string{buf.data(), static_cast<size_t>(bytes_received)} };
 }
+
+size_t UDPSocket::send_batch(const vector<string_view> & data)
+{
+  return sendmmsg_batch(fd_num(), data);
+}
+
+size_t UDPSocket::send_batch(const vector<Gather> & data)
+{
+  return sendmmsg_batch(fd_num(), data);
+}
+
+optional<BufferPool::Lease> UDPSocket::recv(BufferPool & pool)
+{
+  if (pool.buffer_size() < UDP_MTU) {
+    throw runtime_error("UDPSocket::recv(): pool buffers are too small");
+  }
+
+  auto buf = pool.acquire();
+  if (not buf) {
+    throw runtime_error("UDPSocket::recv(): buffer pool exhausted");
+  }
+
+  const ssize_t bytes_received = ::recv(fd_num(), buf->buffer(),
+                                        UDP_MTU, MSG_TRUNC);
+  if (not check_bytes_received(bytes_received)) {
+    return nullopt; // the leased buffer returns to the pool
+  }
+
+  buf->shrink(bytes_received);
+  return buf;
+}
+
+size_t UDPSocket::recv_batch(BufferPool & pool,
+                             vector<BufferPool::Lease> & datagrams,
+                             const size_t max_num)
+{
+  if (pool.buffer_size() < UDP_MTU) {
+    throw runtime_error("UDPSocket::recv_batch(): pool buffers are too small");
+  }
+
+  // receive no more datagrams than there are free buffers
+  const size_t batch_size = min({max_num, MAX_BATCH_SIZE, pool.num_free()});
+  if (batch_size == 0) {
+    throw runtime_error("UDPSocket::recv_batch(): buffer pool exhausted");
+  }
+
+  // ancillary data to receive the segment size of GRO-coalesced datagrams
+  static constexpr size_t CTRL_LEN = CMSG_SPACE(sizeof(int));
+  alignas(cmsghdr) char ctrl_buf[MAX_BATCH_SIZE][CTRL_LEN];
+
+  array<optional<BufferPool::Lease>, MAX_BATCH_SIZE> bufs;
+  array<mmsghdr, MAX_BATCH_SIZE> msgs;
+  array<iovec, MAX_BATCH_SIZE> iovs;
+
+  for (size_t i = 0; i < batch_size; i++) {
+    bufs[i] = pool.acquire();
+
+    iovs[i].iov_base = bufs[i]->buffer();
+    iovs[i].iov_len = UDP_MTU;
+
+    msgs[i] = {};
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+
+    if (gro_enabled_) {
+      msgs[i].msg_hdr.msg_control = ctrl_buf[i];
+      msgs[i].msg_hdr.msg_controllen = CTRL_LEN;
+    }
+  }
+
+  // MSG_WAITFORONE: block (if blocking) until the first datagram arrives,
+  // then return whatever else is already queued
+  const int num_received = ::recvmmsg(fd_num(), msgs.data(), batch_size,
+                                      MSG_WAITFORONE, nullptr);
+  if (num_received < 0 and errno == EWOULDBLOCK) {
+    return 0; // return 0 to indicate EWOULDBLOCK
+  }
+  check_syscall(num_received, "UDPSocket:recv_batch()");
+
+  const size_t num_before = datagrams.size();
+
+  for (int i = 0; i < num_received; i++) {
+    const msghdr & hdr = msgs[i].msg_hdr;
+    if (hdr.msg_flags & MSG_TRUNC) {
+      throw runtime_error("UDPSocket::recv_batch(): datagram truncated");
+    }
+
+    const size_t len = msgs[i].msg_len;
+
+    // find out if the kernel coalesced multiple datagrams into this buffer
+    size_t segment_size = len;
+    if (gro_enabled_) {
+      for (cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(const_cast<msghdr *>(&hdr), cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP and cmsg->cmsg_type == UDP_GRO) {
+          int gso_size;
+          memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+          segment_size = gso_size;
+        }
+      }
+    }
+
+    if (segment_size >= len) {
+      bufs[i]->shrink(len);
+      datagrams.emplace_back(move(*bufs[i]));
+      continue;
+    }
+
+    // split the buffer back into the original datagrams sharing the buffer
+    for (size_t offset = 0; offset < len; offset += segment_size) {
+      datagrams.emplace_back(
+          bufs[i]->share(offset, min(segment_size, len - offset)));
+    }
+  }
+
+  // unused buffers return to the pool when 'bufs' goes out of scope
+  return datagrams.size() - num_before;
+}
+
+bool UDPSocket::send_gso(const string_view data, const size_t segment_size)
+{
+  iovec iov { const_cast<char *>(data.data()), data.size() };
+  return sendmsg_gso(&iov, 1, data.size(), segment_size);
+}
+
+bool UDPSocket::send_gso(const vector<Gather> & data, const size_t segment_size)
+{
+  if (data.size() > MAX_GSO_SEGMENTS) {
+    throw runtime_error("UDPSocket::send_gso(): too many segments");
+  }
+
+  array<iovec, 2 * MAX_GSO_SEGMENTS> iovs;
+  size_t num_iov = 0;
+  size_t total_size = 0;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    // every segment but the last one must be exactly 'segment_size'
+    const size_t size = data[i].size();
+    if (size > segment_size or (size < segment_size and i + 1 < data.size())) {
+      throw runtime_error("UDPSocket::send_gso(): invalid segmentation");
+    }
+
+    num_iov += to_iovecs(data[i], &iovs[num_iov]);
+    total_size += size;
+  }
+
+  return sendmsg_gso(iovs.data(), num_iov, total_size, segment_size);
+}
+
+bool UDPSocket::sendmsg_gso(iovec * iov, const size_t num_iov,
+                            const size_t total_size, const size_t segment_size)
+{
+  if (total_size == 0) {
+    throw runtime_error("attempted to send empty data");
+  }
+
+  if (segment_size == 0 or total_size > MAX_GSO_SIZE or
+      (total_size + segment_size - 1) / segment_size > MAX_GSO_SEGMENTS) {
+    throw runtime_error("UDPSocket::send_gso(): invalid segmentation");
+  }
+
+  alignas(cmsghdr) char ctrl_buf[CMSG_SPACE(sizeof(uint16_t))] {};
+  msghdr msg {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = num_iov;
+  msg.msg_control = ctrl_buf;
+  msg.msg_controllen = sizeof(ctrl_buf);
+
+  cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  const uint16_t gso_size = segment_size;
+  memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+
+  const ssize_t bytes_sent = ::sendmsg(fd_num(), &msg, 0);
+  return check_bytes_sent(bytes_sent, total_size);
+}
+
+bool UDPSocket::gso_supported() const
+{
+  int gso_size = 0;
+  socklen_t len = sizeof(gso_size);
+
+  // kernels without GSO reject the option with ENOPROTOOPT
+  return ::getsockopt(fd_num(), SOL_UDP, UDP_SEGMENT, &gso_size, &len) == 0;
+}
+
+bool UDPSocket::set_gro(const bool enabled)
+{
+  const int value = enabled;
+  if (::setsockopt(fd_num(), SOL_UDP, UDP_GRO, &value, sizeof(value)) < 0) {
+    if (errno == ENOPROTOOPT) {
+      return false;
+    }
+    throw unix_error("UDPSocket:set_gro()");
+  }
+
+  gro_enabled_ = enabled;
+  return true;
+}
+
+bool UDPSocket::set_txtime()
+{
+  // struct sock_txtime from <linux/net_tstamp.h>; fq expects departure
+  // times on CLOCK_MONOTONIC (same as monotonic_us())
+  struct {
+    clockid_t clockid;
+    uint32_t flags;
+  } config {CLOCK_MONOTONIC, 0};
+
+  if (::setsockopt(fd_num(), SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) < 0) {
+    if (errno == ENOPROTOOPT or errno == EINVAL) {
+      return false;
+    }
+    throw unix_error("UDPSocket:set_txtime()");
+  }
+
+  return true;
+}
+
+void UDPSocket::set_pmtu_probe()
+{
+  const int value = IP_PMTUDISC_PROBE;
+  check_syscall(::setsockopt(fd_num(), IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value)),
+                "UDPSocket:set_pmtu_probe()");
+}
+
+size_t UDPSocket::path_mtu() const
+{
+  int mtu = 0;
+  socklen_t len = sizeof(mtu);
+  check_syscall(::getsockopt(fd_num(), IPPROTO_IP, IP_MTU, &mtu, &len),
+                "UDPSocket:path_mtu()");
+  return mtu;
+}
@@ -1,13 +1,18 @@
 #ifndef UDP_SOCKET_HH
 #define UDP_SOCKET_HH
 
+#include <sys/uio.h>
+
 #include <string>
 #include <string_view>
 #include <utility>
 #include <optional>
+#include <vector>
+#include <memory>
 
 #include "socket.hh"
 #include "address.hh"
+#include "buffer_pool.hh"
 
 class UDPSocket : public Socket
 {
@@ -15,10 +20,28 @@ public:
   // constructor
   UDPSocket() : Socket(AF_INET, SOCK_DGRAM) {};
 
+  // a datagram gathered from a header and a payload that are sent together
+  // with sendmsg() without being copied into one buffer first
+  struct Gather
+  {
+    std::string_view header {};
+    std::string_view payload {};
+    uint64_t txtime {0}; // earliest departure (CLOCK_MONOTONIC ns) if nonzero
+
+    // asynchronous (io_uring) sends only: 'payload_owner' keeps the payload
+    // alive until the kernel is done with it, so that it is sent in place,
+    // and 'tag' identifies the datagram if its send fails
+    std::shared_ptr<const void> payload_owner {};
+    uint64_t tag {0};
+
+    size_t size() const { return header.size() + payload.size(); }
+  };
+
   // return true if data is sent in its entirety
   // return false to indicate EWOULDBLOCK in nonblocking I/O mode
   bool send(const std::string_view data);
   bool sendto(const Address & dst_addr, const std::string_view data);
+  bool send(const Gather & datagram);
 
   // receive a datagram (*supposedly* from a connected address)
   // return nullopt to indicate EWOULDBLOCK in nonblocking I/O mode
@@ -27,11 +50,69 @@ public:
   // receive a datagram and its source address
   std::pair<Address, std::optional<std::string>> recvfrom();
 
+  // send a batch of datagrams with a single sendmmsg() per MAX_BATCH_SIZE
+  // return the number of datagrams sent in their entirety; a return value
+  // smaller than data.size() indicates EWOULDBLOCK midway
+  size_t send_batch(const std::vector<std::string_view> & data);
+  size_t send_batch(const std::vector<Gather> & data);
+
+  // receive a datagram into a buffer leased from 'pool' (no heap allocation)
+  // return nullopt to indicate EWOULDBLOCK in nonblocking I/O mode
+  std::optional<BufferPool::Lease> recv(BufferPool & pool);
+
+  // receive up to 'max_num' datagrams with a single recvmmsg() into buffers
+  // leased from 'pool' (each of at least UDP_MTU bytes), and append them to
+  // 'datagrams'; blocks only for the first datagram in blocking I/O mode
+  // return the number of datagrams appended (0 indicates EWOULDBLOCK)
+  size_t recv_batch(BufferPool & pool,
+                    std::vector<BufferPool::Lease> & datagrams,
+                    const size_t max_num = MAX_BATCH_SIZE);
+
+  // UDP generic segmentation offload (GSO): send one super-buffer that the
+  // kernel splits into datagrams of 'segment_size' bytes (the last one may be
+  // shorter); return false to indicate EWOULDBLOCK in nonblocking I/O mode
+  bool send_gso(const std::string_view data, const size_t segment_size);
+
+  // similar but gather the super-buffer from consecutive datagrams
+  bool send_gso(const std::vector<Gather> & data, const size_t segment_size);
+
+  // check if the kernel supports GSO on this socket (Linux >= 4.18)
+  bool gso_supported() const;
+
+  // UDP generic receive offload (GRO): let the kernel coalesce datagrams;
+  // recv_batch() splits them back transparently
+  // return false if the kernel does not support GRO (Linux < 5.0)
+  bool set_gro(const bool enabled);
+
+  // SO_TXTIME: let the qdisc (fq) hold each datagram sent with a nonzero
+  // Gather::txtime until then, instead of pacing in user space
+  // return false if the kernel does not support it (Linux < 4.19)
+  bool set_txtime();
+
+  // Path MTU discovery: set the DF bit on every datagram, and let the
+  // sizes above the kernel's cached path MTU through (IP_PMTUDISC_PROBE)
+  // so that they can be probed; ICMP "fragmentation needed" messages still
+  // lower the cached value
+  void set_pmtu_probe();
+
+  // the kernel's path MTU to the connected peer (IP_MTU)
+  size_t path_mtu() const;
+
+  static constexpr size_t MAX_BATCH_SIZE = 64; // datagrams per syscall
+  static constexpr size_t MAX_GSO_SEGMENTS = 64; // UDP_MAX_SEGMENTS
+  static constexpr size_t MAX_GSO_SIZE = 65507; // max UDP payload over IPv4
+  static constexpr size_t UDP_MTU = 65536; // bytes
+
 private:
   bool check_bytes_sent(const ssize_t bytes_sent, const size_t target) const;
   bool check_bytes_received(const ssize_t bytes_received) const;
 
-  static constexpr size_t UDP_MTU = 65536; // bytes
+  // sendmsg() with the UDP_SEGMENT control message
+  bool sendmsg_gso(iovec * iov, const size_t num_iov,
+                   const size_t total_size, const size_t segment_size);
+
+  // if GRO is enabled and recv_batch() should split coalesced datagrams
+  bool gro_enabled_ {false};
 };
 
 #endif /* UDP_SOCKET_HH */
@@ -0,0 +1,172 @@
+#include <algorithm>
+
+#include "bbr_controller.hh"
+
+using namespace std;
+
+BbrController::BbrController(const unsigned int start_kbps,
+                             const unsigned int min_kbps,
+                             const unsigned int max_kbps)
+  : start_bps_(start_kbps * 1000.0),
+    min_bps_(min_kbps * 1000.0), max_bps_(max_kbps * 1000.0)
+{
+  start_bps_ = clamp(start_bps_, min_bps_, max_bps_);
+}
+
+double BbrController::btl_bw_bps() const
+{
+  double btl_bw = 0.0;
+  for (const auto & [round, rate] : bw_samples_) {
+    btl_bw = max(btl_bw, rate);
+  }
+  return btl_bw;
+}
+
+void BbrController::on_rate_sample(const size_t delivered_bytes,
+                                   const uint64_t interval_us,
+                                   const uint64_t now_us)
+{
+  if (round_start_ts_ == 0) {
+    round_start_ts_ = now_us;
+    mode_start_ts_ = now_us;
+  }
+
+  if (now_us - round_start_ts_ >= round_us()) {
+    round_count_++;
+    round_start_ts_ = now_us;
+    on_round_start(now_us);
+  }
+
+  if (interval_us > 0 and delivered_bytes > 0) {
+    const double rate = delivered_bytes * 8 * 1e6 / interval_us;
+
+    if (bw_samples_.empty() or bw_samples_.back().first != round_count_) {
+      bw_samples_.emplace_back(round_count_, rate);
+    } else {
+      bw_samples_.back().second = max(bw_samples_.back().second, rate);
+    }
+
+    while (bw_samples_.front().first + BW_WINDOW_ROUNDS <= round_count_) {
+      bw_samples_.pop_front();
+    }
+  }
+
+  update_mode(now_us);
+}
+
+void BbrController::on_round_start(const uint64_t)
+{
+  if (full_bw_reached_ or bw_samples_.empty()) {
+    return;
+  }
+
+  // the pipe is full once sending faster no longer grows the delivery rate
+  // by 25% for three rounds
+  const double btl_bw = btl_bw_bps();
+  if (btl_bw >= full_bw_bps_ * 1.25) {
+    full_bw_bps_ = btl_bw;
+    full_bw_count_ = 0;
+  } else if (++full_bw_count_ >= 3) {
+    full_bw_reached_ = true;
+  }
+}
+
+void BbrController::enter_probe_bw(const uint64_t now_us)
+{
+  mode_ = Mode::PROBE_BW;
+  mode_start_ts_ = now_us;
+
+  // start in a cruising phase, away from the probing ones
+  cycle_index_ = 2 + round_count_ % (CYCLE_LENGTH - 2);
+  pacing_gain_ = CYCLE_GAINS[cycle_index_];
+}
+
+void BbrController::update_mode(const uint64_t now_us)
+{
+  switch (mode_) {
+    case Mode::STARTUP:
+      if (full_bw_reached_) {
+        mode_ = Mode::DRAIN;
+        mode_start_ts_ = now_us;
+        pacing_gain_ = 1 / STARTUP_GAIN;
+      }
+      break;
+
+    case Mode::DRAIN:
+      // until the queue built in STARTUP is gone; without a congestion
+      // window to count the bytes in flight, the RTT tells when it is
+      if (latest_rtt_us_ <= min_rtt_us_.value_or(0) * 5 / 4) {
+        enter_probe_bw(now_us);
+      }
+      break;
+
+    case Mode::PROBE_BW:
+      if (now_us - mode_start_ts_ >= round_us()) {
+        cycle_index_ = (cycle_index_ + 1) % CYCLE_LENGTH;
+        pacing_gain_ = CYCLE_GAINS[cycle_index_];
+        mode_start_ts_ = now_us;
+      }
+      break;
+
+    case Mode::PROBE_RTT:
+      if (now_us - mode_start_ts_ >= max(PROBE_RTT_US, round_us())) {
+        min_rtt_ts_ = now_us;  // keep the min RTT seen while drained
+        if (full_bw_reached_) {
+          enter_probe_bw(now_us);
+        } else {
+          mode_ = Mode::STARTUP;
+          mode_start_ts_ = now_us;
+          pacing_gain_ = STARTUP_GAIN;
+        }
+      }
+      break;
+  }
+}
+
+void BbrController::on_rtt_sample(const uint64_t rtt_us, const uint64_t now_us)
+{
+  // a min RTT not refreshed for MIN_RTT_WINDOW_US is replaced by the
+  // next sample, and the queue is drained to measure it
+  const bool expired = min_rtt_us_ and now_us > min_rtt_ts_ + MIN_RTT_WINDOW_US;
+  latest_rtt_us_ = rtt_us;
+
+  if (not min_rtt_us_ or rtt_us <= *min_rtt_us_ or expired) {
+    min_rtt_us_ = rtt_us;
+    min_rtt_ts_ = now_us;
+  }
+
+  if (expired and mode_ != Mode::PROBE_RTT) {
+    mode_ = Mode::PROBE_RTT;
+    mode_start_ts_ = now_us;
+    pacing_gain_ = PROBE_RTT_GAIN;
+  }
+}
+
+unsigned int BbrController::target_bitrate_kbps() const
+{
+  if (bw_samples_.empty()) {
+    return static_cast<unsigned int>(start_bps_ / 1000);
+  }
+
+  // a video sender is application-limited at the encoder's bitrate, so the
+  // encoder has to follow the gain for the probing and draining to happen
+  const double btl_bw = btl_bw_bps();
+  double target = pacing_gain_ * btl_bw;
+  if (mode_ == Mode::STARTUP) {
+    target = max(target, start_bps_);  // early samples are few
+  }
+
+  // stand-in for BBR's congestion window of CWND_GAIN * BDP: at the latest
+  // RTT, more than that would be in flight above this rate
+  if (min_rtt_us_ and latest_rtt_us_ > 0) {
+    target = min(target, CWND_GAIN * btl_bw * (*min_rtt_us_) / latest_rtt_us_);
+  }
+
+  return static_cast<unsigned int>(clamp(target, min_bps_, max_bps_) / 1000);
+}
+
+unsigned int BbrController::pacing_rate_kbps() const
+{
+  const double btl_bw = bw_samples_.empty() ? start_bps_ : btl_bw_bps();
+  return static_cast<unsigned int>(clamp(pacing_gain_ * btl_bw, min_bps_, max_bps_) / 1000);
+}
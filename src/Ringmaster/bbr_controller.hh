@@ -0,0 +1,80 @@
+#ifndef BBR_CONTROLLER_HH
+#define BBR_CONTROLLER_HH
+
+#include <deque>
+#include <utility>
+#include <optional>
+
+#include "congestion_controller.hh"
+
+// Model-based congestion control in the style of BBR (v1): the bottleneck
+// bandwidth is the max-filtered delivery rate over the last 10 rounds and
+// the propagation delay the min RTT over the last 10 seconds. Both the
+// encoder target and the pacing rate cycle around the bottleneck bandwidth
+// to probe for more and drain the queue built by probing
+class BbrController : public CongestionController
+{
+public:
+  BbrController(const unsigned int start_kbps,
+                const unsigned int min_kbps = 100,
+                const unsigned int max_kbps = 500 * 1000);
+
+  void on_acked(const size_t, const uint64_t) override {}
+  void on_arrival(const uint64_t, const uint64_t, const size_t) override {}
+  void on_lost(const size_t, const uint64_t) override {}
+  void on_rtt_sample(const uint64_t rtt_us, const uint64_t now_us) override;
+  void on_rate_sample(const size_t delivered_bytes, const uint64_t interval_us,
+                      const uint64_t now_us) override;
+
+  unsigned int target_bitrate_kbps() const override;
+  unsigned int pacing_rate_kbps() const override;
+  const char * name() const override { return "bbr"; }
+
+private:
+  enum class Mode { STARTUP, DRAIN, PROBE_BW, PROBE_RTT };
+
+  Mode mode_ {Mode::STARTUP};
+  double pacing_gain_ {STARTUP_GAIN};
+  double start_bps_;
+  double min_bps_;
+  double max_bps_;
+
+  // a round lasts about one min RTT
+  uint64_t round_count_ {0};
+  uint64_t round_start_ts_ {0};
+
+  // max filter of the delivery rate: (round, max rate in the round)
+  std::deque<std::pair<uint64_t, double>> bw_samples_ {};
+  double btl_bw_bps() const;
+
+  // min filter of the RTT
+  std::optional<uint64_t> min_rtt_us_ {};
+  uint64_t min_rtt_ts_ {0};
+  uint64_t latest_rtt_us_ {0};
+  uint64_t round_us() const { return min_rtt_us_.value_or(DEFAULT_ROUND_US); }
+
+  // STARTUP ends when the bandwidth stops growing by 25% for 3 rounds
+  double full_bw_bps_ {0.0};
+  unsigned int full_bw_count_ {0};
+  bool full_bw_reached_ {false};
+
+  // gain cycling in PROBE_BW, and the states' start times
+  unsigned int cycle_index_ {0};
+  uint64_t mode_start_ts_ {0};
+
+  void on_round_start(const uint64_t now_us);
+  void enter_probe_bw(const uint64_t now_us);
+  void update_mode(const uint64_t now_us);
+
+  static constexpr double STARTUP_GAIN = 2.885; // 2/ln(2)
+  static constexpr double PROBE_RTT_GAIN = 0.5;
+  static constexpr double CWND_GAIN = 2.0;
+  static constexpr double CYCLE_GAINS[] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+  static constexpr unsigned int CYCLE_LENGTH = 8;
+  static constexpr uint64_t BW_WINDOW_ROUNDS = 10;
+  static constexpr uint64_t MIN_RTT_WINDOW_US = 10 * 1000 * 1000;
+  static constexpr uint64_t PROBE_RTT_US = 200 * 1000;
+  static constexpr uint64_t DEFAULT_ROUND_US = 100 * 1000;
+};
+
+#endif /* BBR_CONTROLLER_HH */
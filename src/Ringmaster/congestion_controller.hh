@@ -0,0 +1,47 @@
+#ifndef CONGESTION_CONTROLLER_HH
+#define CONGESTION_CONTROLLER_HH
+
+#include <cstdint>
+#include <cstddef>
+
+// Interface of a congestion controller shared by the encoders, which feed
+// it with feedback about their datagrams and apply its target bitrate to
+// the next frames. All times are timestamp_us() on the sender's clock.
+class CongestionController
+{
+public:
+  virtual ~CongestionController() {}
+
+  // 'bytes' of datagrams were acknowledged at 'now_us'
+  virtual void on_acked(const size_t bytes, const uint64_t now_us) = 0;
+
+  // a timing sample: a datagram of 'bytes' sent at 'send_ts' reached the
+  // receiver at about 'arrival_ts' (the ACK's arrival minus the time the
+  // receiver held it, so that only the reverse path delay is added)
+  virtual void on_arrival(const uint64_t send_ts, const uint64_t arrival_ts,
+                          const size_t bytes) = 0;
+
+  // a datagram of 'bytes' was deemed lost and retransmitted at 'now_us'
+  virtual void on_lost(const size_t bytes, const uint64_t now_us) = 0;
+
+  // an RTT sample
+  virtual void on_rtt_sample(const uint64_t rtt_us, const uint64_t now_us) = 0;
+
+  // a delivery rate sample: 'delivered_bytes' were acknowledged over
+  // 'interval_us' while the newly acknowledged datagram was in flight
+  virtual void on_rate_sample(const size_t, const uint64_t, const uint64_t) {}
+
+  // the receiver's estimate of the maximum bitrate, from its reports
+  virtual void on_remb(const unsigned int, const uint64_t) {}
+
+  // the bitrate the encoder should target
+  virtual unsigned int target_bitrate_kbps() const = 0;
+
+  // the rate at which datagrams should be paced out, or 0 for no pacing
+  virtual unsigned int pacing_rate_kbps() const { return 0; }
+
+  // short name for logging
+  virtual const char * name() const = 0;
+};
+
+#endif /* CONGESTION_CONTROLLER_HH */
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "fec.hh"
+#include "serialization.hh"
+
+using namespace std;
+
+uint16_t XorFec::num_groups(const uint16_t frag_cnt, const double loss_rate)
+{
+  if (frag_cnt == 0 or loss_rate < MIN_LOSS_RATE) {
+    return 0;
+  }
+
+  // with k fragments plus a parity per group, a group is lost only if two
+  // or more of its k+1 datagrams are: keep (k+1) * loss_rate small
+  const double group_size = max(floor(GROUP_LOSSES / loss_rate) - 1, 1.0);
+  return min<double>(ceil(frag_cnt / group_size), max_groups(frag_cnt));
+}
+
+uint16_t XorFec::max_groups(const uint16_t frag_cnt)
+{
+  // parity frag_ids must fit after the data fragments
+  const double groups = max(ceil(frag_cnt * MAX_OVERHEAD), 1.0);
+  return min<double>(groups, UINT16_MAX - frag_cnt);
+}
+
+vector<string> XorFec::encode(const vector<string_view> & frags, const uint16_t num_groups)
+{
+  // the XOR is accumulated after the header of each parity payload
+  vector<string> parities(num_groups, string(HEADER_SIZE, 0));
+  vector<uint16_t> length_xors(num_groups, 0);
+
+  for (size_t i = 0; i < frags.size(); i++) {
+    const auto group = group_of(i, num_groups);
+    auto & parity = parities[group];
+    const auto & frag = frags[i];
+
+    if (parity.size() < HEADER_SIZE + frag.size()) {
+      parity.resize(HEADER_SIZE + frag.size(), 0);
+    }
+    char * data = parity.data() + HEADER_SIZE;
+    for (size_t j = 0; j < frag.size(); j++) {
+      data[j] ^= frag[j];
+    }
+    length_xors[group] ^= frag.size();
+  }
+
+  for (uint16_t group = 0; group < num_groups; group++) {
+    WireWriter writer(parities[group].data(), HEADER_SIZE);
+    writer.write_uint16(num_groups);
+    writer.write_uint16(length_xors[group]);
+  }
+
+  return parities;
+}
+
+optional<XorFec::Parity> XorFec::parse(const string_view payload)
+{
+  if (payload.size() < HEADER_SIZE) {
+    return nullopt;
+  }
+
+  WireParser parser(payload);
+  Parity parity;
+  parity.num_groups = parser.read_uint16();
+  parity.length_xor = parser.read_uint16();
+  parity.data = parser.read_view();
+
+  if (parity.num_groups == 0) {
+    return nullopt;
+  }
+  return parity;
+}
+
+optional<string> XorFec::recover(const Parity & parity, const vector<string_view> & others)
+{
+  uint16_t length = parity.length_xor;
+  string data {parity.data};
+
+  for (const auto & frag : others) {
+    if (frag.size() > data.size()) {
+      return nullopt;
+    }
+    for (size_t j = 0; j < frag.size(); j++) {
+      data[j] ^= frag[j];
+    }
+    length ^= frag.size();
+  }
+
+  if (length > data.size()) {
+    return nullopt;
+  }
+
+  data.resize(length);
+  return data;
+}
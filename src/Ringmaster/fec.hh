@@ -0,0 +1,61 @@
+#ifndef FEC_HH
+#define FEC_HH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+
+// Forward error correction with XOR parity. The fragments of a frame are
+// interleaved into 'num_groups' groups (fragment i in group i % num_groups)
+// and each group is protected by one parity datagram with frag_id
+// frag_cnt + group. The receiver rebuilds one missing fragment per group
+// without waiting for a retransmission, i.e., any burst of up to
+// 'num_groups' consecutive losses.
+class XorFec
+{
+public:
+  // a parity payload: its header, then the XOR of the group's payloads
+  // (zero-padded to the longest one)
+  struct Parity
+  {
+    uint16_t num_groups {};
+    uint16_t length_xor {}; // XOR of the payload sizes
+    std::string_view data {};
+  };
+
+  static constexpr size_t HEADER_SIZE = 2 * sizeof(uint16_t);
+
+  // number of groups to protect 'frag_cnt' fragments against 'loss_rate';
+  // 0 if no protection is needed
+  static uint16_t num_groups(const uint16_t frag_cnt, const double loss_rate);
+
+  // the most groups num_groups() returns for 'frag_cnt' fragments
+  static uint16_t max_groups(const uint16_t frag_cnt);
+
+  static uint16_t group_of(const uint16_t frag_id, const uint16_t num_groups)
+  {
+    return frag_id % num_groups;
+  }
+
+  // parity payloads of all groups of 'frags' (the payloads of a frame)
+  static std::vector<std::string> encode(const std::vector<std::string_view> & frags,
+                                         const uint16_t num_groups);
+
+  // nullopt if 'payload' is not a valid parity payload
+  static std::optional<Parity> parse(const std::string_view payload);
+
+  // rebuild the only missing fragment of a group from its parity and the
+  // group's other fragments; nullopt if they are inconsistent
+  static std::optional<std::string> recover(const Parity & parity,
+                                            const std::vector<std::string_view> & others);
+
+  // no protection below this loss rate
+  static constexpr double MIN_LOSS_RATE = 0.005;
+  // size groups for about this many expected losses per group
+  static constexpr double GROUP_LOSSES = 0.2;
+  // parity datagrams per data datagram at most
+  static constexpr double MAX_OVERHEAD = 0.5;
+};
+
+#endif /* FEC_HH */
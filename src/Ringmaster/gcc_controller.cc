@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cmath>
+
+#include "gcc_controller.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+GccController::GccController(const unsigned int start_kbps,
+                             const unsigned int min_kbps,
+                             const unsigned int max_kbps)
+  : delay_rate_bps_(start_kbps * 1000.0),
+    min_bps_(min_kbps * 1000.0), max_bps_(max_kbps * 1000.0),
+    loss_rate_bps_(max_kbps * 1000.0)
+{
+  delay_rate_bps_ = clamp(delay_rate_bps_, min_bps_, max_bps_);
+}
+
+void GccController::on_arrival(const uint64_t send_ts, const uint64_t arrival_ts,
+                               const size_t bytes)
+{
+  if (curr_group_ and send_ts < curr_group_->first_send_ts) {
+    return; // reordered behind the current group
+  }
+
+  // a datagram sent more than BURST_US after the first of the group
+  // starts a new group
+  if (curr_group_ and send_ts - curr_group_->first_send_ts > BURST_US) {
+    on_group_complete(*curr_group_);
+    curr_group_.reset();
+  }
+
+  if (not curr_group_) {
+    curr_group_ = PacketGroup{send_ts, send_ts, arrival_ts, bytes};
+    return;
+  }
+
+  curr_group_->last_send_ts = max(curr_group_->last_send_ts, send_ts);
+  curr_group_->last_arrival_ts = max(curr_group_->last_arrival_ts, arrival_ts);
+  curr_group_->bytes += bytes;
+}
+
+void GccController::on_group_complete(const PacketGroup & group)
+{
+  if (prev_group_) {
+    // inter-group delay variation: d(i) = t(i) - t(i-1) - (T(i) - T(i-1))
+    const double send_delta_ms = (static_cast<double>(group.last_send_ts)
+                                  - prev_group_->last_send_ts) / 1000.0;
+    const double arrival_delta_ms = (static_cast<double>(group.last_arrival_ts)
+                                     - prev_group_->last_arrival_ts) / 1000.0;
+    update_trendline(arrival_delta_ms - send_delta_ms, send_delta_ms,
+                     group.last_arrival_ts);
+  }
+
+  prev_group_ = group;
+}
+
+void GccController::update_trendline(const double delay_variation_ms,
+                                     const double send_delta_ms,
+                                     const uint64_t arrival_ts)
+{
+  if (first_arrival_ts_ == 0) {
+    first_arrival_ts_ = arrival_ts;
+  }
+
+  num_deltas_ = min(num_deltas_ + 1, 1000u);
+
+  // smooth the accumulated delay and keep the last TRENDLINE_WINDOW points
+  accumulated_delay_ms_ += delay_variation_ms;
+  smoothed_delay_ms_ = SMOOTHING * smoothed_delay_ms_
+                       + (1 - SMOOTHING) * accumulated_delay_ms_;
+
+  const double arrival_ms = (static_cast<double>(arrival_ts) - first_arrival_ts_) / 1000.0;
+  samples_.emplace_back(arrival_ms, smoothed_delay_ms_);
+  if (samples_.size() > TRENDLINE_WINDOW) {
+    samples_.pop_front();
+  }
+
+  // the slope of the least-squares line through the points is the trend
+  // of the queuing delay
+  double trend = prev_trend_;
+  if (samples_.size() == TRENDLINE_WINDOW) {
+    double avg_x = 0.0, avg_y = 0.0;
+    for (const auto & [x, y] : samples_) {
+      avg_x += x;
+      avg_y += y;
+    }
+    avg_x /= samples_.size();
+    avg_y /= samples_.size();
+
+    double numerator = 0.0, denominator = 0.0;
+    for (const auto & [x, y] : samples_) {
+      numerator += (x - avg_x) * (y - avg_y);
+      denominator += (x - avg_x) * (x - avg_x);
+    }
+
+    if (denominator != 0.0) {
+      trend = numerator / denominator;
+    }
+  }
+
+  detect(trend, send_delta_ms, arrival_ts);
+}
+
+void GccController::detect(const double trend, const double send_delta_ms,
+                           const uint64_t now_us)
+{
+  if (num_deltas_ < 2) {
+    usage_ = Usage::NORMAL;
+    return;
+  }
+
+  const double modified_trend = min(num_deltas_, 60u) * trend * THRESHOLD_GAIN;
+
+  if (modified_trend > threshold_) {
+    // overusing only if it lasts OVERUSE_TIME_MS and the trend is not falling
+    if (time_over_using_ms_ < 0) {
+      time_over_using_ms_ = send_delta_ms / 2;
+    } else {
+      time_over_using_ms_ += send_delta_ms;
+    }
+    overuse_counter_++;
+
+    if (time_over_using_ms_ > OVERUSE_TIME_MS and overuse_counter_ > 1
+        and trend >= prev_trend_) {
+      time_over_using_ms_ = 0;
+      overuse_counter_ = 0;
+      usage_ = Usage::OVERUSE;
+    }
+  } else if (modified_trend < -threshold_) {
+    time_over_using_ms_ = -1;
+    overuse_counter_ = 0;
+    usage_ = Usage::UNDERUSE;
+  } else {
+    time_over_using_ms_ = -1;
+    overuse_counter_ = 0;
+    usage_ = Usage::NORMAL;
+  }
+
+  prev_trend_ = trend;
+  update_threshold(modified_trend, now_us);
+  update_delay_rate(now_us);
+}
+
+void GccController::update_threshold(const double modified_trend, const uint64_t now_us)
+{
+  if (last_threshold_update_ts_ == 0) {
+    last_threshold_update_ts_ = now_us;
+  }
+
+  // ignore spikes (e.g., a burst after a route change)
+  const double abs_trend = fabs(modified_trend);
+  if (abs_trend > threshold_ + 15) {
+    last_threshold_update_ts_ = now_us;
+    return;
+  }
+
+  // adapt slowly when the trend is above the threshold and quickly below,
+  // so that competing loss-based flows do not starve this one
+  const double k = abs_trend < threshold_ ? K_DOWN : K_UP;
+  const double time_delta_ms = min((now_us - last_threshold_update_ts_) / 1000.0, 100.0);
+  threshold_ += k * (abs_trend - threshold_) * time_delta_ms;
+  threshold_ = clamp(threshold_, 6.0, 600.0);
+  last_threshold_update_ts_ = now_us;
+}
+
+void GccController::update_delay_rate(const uint64_t now_us)
+{
+  // state transitions driven by the detector
+  if (usage_ == Usage::OVERUSE) {
+    rate_state_ = RateState::DECREASE;
+  } else if (usage_ == Usage::UNDERUSE) {
+    rate_state_ = RateState::HOLD;
+  } else if (rate_state_ == RateState::HOLD) {
+    rate_state_ = RateState::INCREASE;
+  }
+
+  if (last_rate_update_ts_ == 0) {
+    last_rate_update_ts_ = now_us;
+  }
+  const double dt_s = min((now_us - last_rate_update_ts_) / 1e6, 1.0);
+  last_rate_update_ts_ = now_us;
+
+  const auto acked = acked_rate_bps(now_us);
+  const double rtt_us = rtt_us_.value_or(100 * 1000);
+
+  if (rate_state_ == RateState::INCREASE) {
+    // forget the link capacity once the acked rate clearly exceeds it
+    if (link_capacity_bps_ and acked and *acked > 1.5 * (*link_capacity_bps_)) {
+      link_capacity_bps_.reset();
+    }
+
+    if (link_capacity_bps_ and delay_rate_bps_ > 0.8 * (*link_capacity_bps_)) {
+      // near the capacity: about one 1200-byte datagram per response time
+      const double response_time_s = (rtt_us + 100 * 1000) / 1e6;
+      delay_rate_bps_ += max(1000.0, 1200 * 8 * dt_s / response_time_s);
+    } else {
+      // far from it: multiplicative increase of 8% per second
+      delay_rate_bps_ *= pow(1.08, dt_s);
+    }
+
+    // never get too far ahead of what is actually delivered
+    if (acked) {
+      delay_rate_bps_ = min(delay_rate_bps_, 1.5 * (*acked) + 10 * 1000);
+    }
+  } else if (rate_state_ == RateState::DECREASE) {
+    // at most once per RTT, as the queue needs time to drain
+    if (now_us - last_decrease_ts_ >= rtt_us) {
+      const double decreased = BETA * acked.value_or(delay_rate_bps_);
+      delay_rate_bps_ = min(delay_rate_bps_, decreased);
+
+      if (acked) {
+        link_capacity_bps_ = link_capacity_bps_ ? 0.95 * (*link_capacity_bps_) + 0.05 * (*acked)
+                             : *acked;
+      }
+      last_decrease_ts_ = now_us;
+    }
+    rate_state_ = RateState::HOLD;
+  }
+
+  delay_rate_bps_ = clamp(delay_rate_bps_, min_bps_, max_bps_);
+  loss_rate_bps_ = min(loss_rate_bps_, 1.5 * delay_rate_bps_);
+}
+
+optional<double> GccController::acked_rate_bps(const uint64_t now_us)
+{
+  while (not acked_.empty() and acked_.front().first + ACKED_WINDOW_US < now_us) {
+    acked_bytes_ -= acked_.front().second;
+    acked_.pop_front();
+  }
+
+  if (first_acked_ts_ == 0 or now_us < first_acked_ts_ + 100 * 1000) {
+    return nullopt; // too little history
+  }
+
+  const double span_s = min(now_us - first_acked_ts_, ACKED_WINDOW_US) / 1e6;
+  return acked_bytes_ * 8 / span_s;
+}
+
+void GccController::on_acked(const size_t bytes, const uint64_t now_us)
+{
+  if (first_acked_ts_ == 0) {
+    first_acked_ts_ = now_us;
+  }
+
+  acked_.emplace_back(now_us, bytes);
+  acked_bytes_ += bytes;
+
+  num_acked_++;
+  update_loss_rate(now_us);
+}
+
+void GccController::on_lost(const size_t, const uint64_t now_us)
+{
+  num_lost_++;
+  update_loss_rate(now_us);
+}
+
+void GccController::update_loss_rate(const uint64_t now_us)
+{
+  if (loss_period_start_ts_ == 0) {
+    loss_period_start_ts_ = now_us;
+  }
+
+  const unsigned int total = num_acked_ + num_lost_;
+  if (now_us < loss_period_start_ts_ + LOSS_PERIOD_US or total < 20) {
+    return;
+  }
+
+  // back off above 10% loss and probe upward below 2%
+  const double loss = static_cast<double>(num_lost_) / total;
+  if (loss > 0.1) {
+    loss_rate_bps_ = min(loss_rate_bps_, delay_rate_bps_) * (1 - 0.5 * loss);
+  } else if (loss < 0.02) {
+    loss_rate_bps_ *= 1.05;
+  }
+
+  loss_rate_bps_ = clamp(loss_rate_bps_, min_bps_, max(min_bps_, 1.5 * delay_rate_bps_));
+
+  num_acked_ = 0;
+  num_lost_ = 0;
+  loss_period_start_ts_ = now_us;
+}
+
+void GccController::on_rtt_sample(const uint64_t rtt_us, const uint64_t)
+{
+  rtt_us_ = rtt_us_ ? 0.875 * (*rtt_us_) + 0.125 * rtt_us : rtt_us;
+}
+
+void GccController::on_remb(const unsigned int remb_kbps, const uint64_t now_us)
+{
+  if (remb_kbps > 0) {
+    remb_bps_ = remb_kbps * 1000.0;
+    remb_ts_ = now_us;
+  }
+}
+
+unsigned int GccController::target_bitrate_kbps() const
+{
+  double target = min(delay_rate_bps_, loss_rate_bps_);
+
+  // a stale estimate no longer applies (the receiver's reports are lost)
+  if (remb_bps_ and timestamp_us() < remb_ts_ + REMB_TIMEOUT_US) {
+    target = max(min(target, *remb_bps_), min_bps_);
+  }
+
+  return static_cast<unsigned int>(target / 1000);
+}
@@ -0,0 +1,111 @@
+#ifndef GCC_CONTROLLER_HH
+#define GCC_CONTROLLER_HH
+
+#include <deque>
+#include <utility>
+#include <optional>
+
+#include "congestion_controller.hh"
+
+// Delay-based congestion control in the style of Google Congestion Control
+// (draft-ietf-rmcat-gcc-02): a trendline filter over the delay variation
+// between groups of datagrams detects overuse with an adaptive threshold,
+// which drives an AIMD rate controller; a loss-based controller caps it
+class GccController : public CongestionController
+{
+public:
+  GccController(const unsigned int start_kbps,
+                const unsigned int min_kbps = 100,
+                const unsigned int max_kbps = 500 * 1000);
+
+  void on_acked(const size_t bytes, const uint64_t now_us) override;
+  void on_arrival(const uint64_t send_ts, const uint64_t arrival_ts,
+                  const size_t bytes) override;
+  void on_lost(const size_t bytes, const uint64_t now_us) override;
+  void on_rtt_sample(const uint64_t rtt_us, const uint64_t now_us) override;
+  void on_remb(const unsigned int remb_kbps, const uint64_t now_us) override;
+
+  unsigned int target_bitrate_kbps() const override;
+  const char * name() const override { return "gcc"; }
+
+private:
+  enum class Usage { NORMAL, OVERUSE, UNDERUSE };
+  enum class RateState { HOLD, INCREASE, DECREASE };
+
+  // datagrams sent within BURST_US of the first one form a group
+  struct PacketGroup
+  {
+    uint64_t first_send_ts {0};
+    uint64_t last_send_ts {0};
+    uint64_t last_arrival_ts {0};
+    size_t bytes {0};
+  };
+
+  std::optional<PacketGroup> curr_group_ {};
+  std::optional<PacketGroup> prev_group_ {};
+
+  // trendline filter
+  double accumulated_delay_ms_ {0.0};
+  double smoothed_delay_ms_ {0.0};
+  unsigned int num_deltas_ {0};
+  uint64_t first_arrival_ts_ {0};
+  std::deque<std::pair<double, double>> samples_ {}; // (arrival ms, smoothed delay ms)
+  double prev_trend_ {0.0};
+
+  // overuse detector
+  Usage usage_ {Usage::NORMAL};
+  double threshold_ {12.5};
+  uint64_t last_threshold_update_ts_ {0};
+  double time_over_using_ms_ {-1.0};
+  unsigned int overuse_counter_ {0};
+
+  // AIMD rate controller
+  RateState rate_state_ {RateState::INCREASE};
+  double delay_rate_bps_;
+  uint64_t last_rate_update_ts_ {0};
+  uint64_t last_decrease_ts_ {0};
+  std::optional<double> link_capacity_bps_ {};
+  double min_bps_;
+  double max_bps_;
+
+  // acknowledged rate over ACKED_WINDOW_US
+  std::deque<std::pair<uint64_t, size_t>> acked_ {}; // (time, bytes)
+  size_t acked_bytes_ {0};
+  uint64_t first_acked_ts_ {0};
+  std::optional<double> acked_rate_bps(const uint64_t now_us);
+
+  // loss-based controller
+  double loss_rate_bps_;
+  unsigned int num_acked_ {0};
+  unsigned int num_lost_ {0};
+  uint64_t loss_period_start_ts_ {0};
+
+  std::optional<double> rtt_us_ {};
+
+  // the receiver's estimate caps the target (A = min(As, Ar) in the draft)
+  std::optional<double> remb_bps_ {};
+  uint64_t remb_ts_ {0};
+
+  void on_group_complete(const PacketGroup & group);
+  void update_trendline(const double delay_variation_ms,
+                        const double send_delta_ms, const uint64_t arrival_ts);
+  void detect(const double trend, const double send_delta_ms,
+              const uint64_t now_us);
+  void update_threshold(const double modified_trend, const uint64_t now_us);
+  void update_delay_rate(const uint64_t now_us);
+  void update_loss_rate(const uint64_t now_us);
+
+  static constexpr uint64_t BURST_US = 5000;
+  static constexpr unsigned int TRENDLINE_WINDOW = 20;
+  static constexpr double SMOOTHING = 0.9;
+  static constexpr double THRESHOLD_GAIN = 4.0;
+  static constexpr double OVERUSE_TIME_MS = 10.0;
+  static constexpr double K_UP = 0.0087;
+  static constexpr double K_DOWN = 0.039;
+  static constexpr double BETA = 0.85;
+  static constexpr uint64_t ACKED_WINDOW_US = 500 * 1000;
+  static constexpr uint64_t LOSS_PERIOD_US = 1000 * 1000;
+  static constexpr uint64_t REMB_TIMEOUT_US = 2000 * 1000;
+};
+
+#endif /* GCC_CONTROLLER_HH */
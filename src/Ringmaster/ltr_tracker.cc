@@ -0,0 +1,63 @@
+#include "ltr_tracker.hh"
+
+using namespace std;
+
+void LtrTracker::on_delivered_up_to(const uint32_t frontier)
+{
+  for (auto & slot : slots_) {
+    if (slot.state == State::PENDING and slot.frame_id < frontier) {
+      slot.state = State::ACKED;
+    }
+  }
+}
+
+void LtrTracker::invalidate_from(const uint32_t frame_id)
+{
+  for (auto & slot : slots_) {
+    if (slot.state != State::EMPTY and slot.frame_id >= frame_id) {
+      slot = {};
+    }
+  }
+}
+
+optional<unsigned int> LtrTracker::slot_to_mark() const
+{
+  // one LTR awaiting acknowledgment at a time
+  for (const auto & slot : slots_) {
+    if (slot.state == State::PENDING) {
+      return nullopt;
+    }
+  }
+
+  optional<unsigned int> oldest_acked;
+  for (unsigned int i = 0; i < NUM_SLOTS; i++) {
+    if (slots_[i].state == State::EMPTY) {
+      return i;
+    }
+    if (not oldest_acked or slots_[i].frame_id < slots_[*oldest_acked].frame_id) {
+      oldest_acked = i;
+    }
+  }
+
+  // all acknowledged: replace the oldest
+  return oldest_acked;
+}
+
+void LtrTracker::on_marked(const unsigned int slot, const uint32_t frame_id)
+{
+  slots_.at(slot) = {State::PENDING, frame_id};
+}
+
+optional<LtrTracker::Ltr> LtrTracker::newest_acked() const
+{
+  optional<Ltr> newest;
+
+  for (unsigned int i = 0; i < NUM_SLOTS; i++) {
+    if (slots_[i].state == State::ACKED and
+        (not newest or slots_[i].frame_id > newest->frame_id)) {
+      newest = Ltr {i, slots_[i].frame_id};
+    }
+  }
+
+  return newest;
+}
@@ -0,0 +1,55 @@
+#ifndef LTR_TRACKER_HH
+#define LTR_TRACKER_HH
+
+#include <array>
+#include <optional>
+#include <cstdint>
+
+// Sender side of long-term reference (LTR) recovery: keeps track of the
+// frames marked as LTRs in the encoder's slots and which of them the
+// receiver is known to have decoded. An LTR is acknowledged once it and
+// every frame before it have been delivered, so that the receiver decoded
+// it in order; after a loss, the next frame can be predicted from the
+// newest acknowledged LTR instead of being a key frame.
+class LtrTracker
+{
+public:
+  static constexpr unsigned int NUM_SLOTS = 2;
+
+  struct Ltr
+  {
+    unsigned int slot {};
+    uint32_t frame_id {};
+  };
+
+  // every frame before 'frontier' has been delivered
+  void on_delivered_up_to(const uint32_t frontier);
+
+  // the receiver may not decode the frames from 'frame_id' on (dropped,
+  // given up on, or skipped by a recovery frame)
+  void invalidate_from(const uint32_t frame_id);
+
+  // a key frame clears all references
+  void clear() { slots_ = {}; }
+
+  // the slot to mark the frame being encoded into, if a new LTR is due:
+  // none is awaiting acknowledgment, and the newest acknowledged one stays
+  std::optional<unsigned int> slot_to_mark() const;
+  void on_marked(const unsigned int slot, const uint32_t frame_id);
+
+  // the newest acknowledged LTR, if any
+  std::optional<Ltr> newest_acked() const;
+
+private:
+  enum class State { EMPTY, PENDING, ACKED };
+
+  struct Slot
+  {
+    State state {State::EMPTY};
+    uint32_t frame_id {};
+  };
+
+  std::array<Slot, NUM_SLOTS> slots_ {};
+};
+
+#endif /* LTR_TRACKER_HH */
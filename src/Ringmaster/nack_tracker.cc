@@ -0,0 +1,156 @@
+#include <algorithm>
+
+#include "nack_tracker.hh"
+
+using namespace std;
+
+void NackTracker::on_datagram(const FrameDatagramView & datagram,
+                              const uint64_t now_us)
+{
+  // echo the newest send timestamp for the sender's RTT samples
+  if (datagram.send_ts > latest_send_ts_) {
+    latest_send_ts_ = datagram.send_ts;
+    latest_recv_us_ = now_us;
+  }
+
+  if (datagram.frame_id < next_frame_ or datagram.frag_cnt == 0
+      or datagram.frag_id >= datagram.frag_cnt) {
+    return;
+  }
+
+  auto & frame = frames_[datagram.frame_id];
+  if (frame.frag_cnt == 0) {
+    frame.frag_cnt = datagram.frag_cnt;
+    frame.frags.resize(frame.frag_cnt);
+
+    // inherit the timing of a whole-frame NACK
+    for (auto & frag : frame.frags) {
+      frag.num_nacks = frame.whole.num_nacks;
+      frag.detected_us = frame.whole.detected_us;
+      frag.last_nack_us = frame.whole.last_nack_us;
+    }
+  } else if (datagram.frag_cnt != frame.frag_cnt) {
+    return; // inconsistent with the other fragments
+  }
+
+  auto & frag = frame.frags[datagram.frag_id];
+  if (frag.received) {
+    return; // duplicate
+  }
+  frag.received = true;
+  frame.num_received++;
+
+  // a repair (or a late original) of a NACKed fragment: RTT sample
+  if (frag.num_nacks > 0 and now_us > frag.last_nack_us) {
+    const double rtt_sample = now_us - frag.last_nack_us;
+    if (not rtt_sampled_) {
+      rtt_us_ = rtt_sample;
+      rtt_sampled_ = true;
+    } else {
+      rtt_us_ = RTT_ALPHA * rtt_sample + (1 - RTT_ALPHA) * rtt_us_;
+    }
+  }
+
+  const SeqNum seq_num {datagram.frame_id, datagram.frag_id};
+  if (not highest_ or seq_num > *highest_) {
+    highest_ = seq_num;
+  }
+}
+
+void NackTracker::clean_up_to(const uint32_t frontier)
+{
+  if (frontier <= next_frame_) {
+    return;
+  }
+
+  frames_.erase(frames_.begin(), frames_.lower_bound(frontier));
+  next_frame_ = frontier;
+}
+
+bool NackTracker::nack_due(FragState & frag, const uint64_t now_us,
+                           const uint64_t reorder_us,
+                           const uint64_t renack_us)
+{
+  if (frag.received or frag.num_nacks >= MAX_NACKS) {
+    return false;
+  }
+
+  // give reordered datagrams a chance to arrive first
+  if (frag.detected_us == 0) {
+    frag.detected_us = now_us;
+  }
+  if (now_us < frag.detected_us + reorder_us) {
+    return false;
+  }
+
+  return frag.num_nacks == 0 or now_us >= frag.last_nack_us + renack_us;
+}
+
+bool NackTracker::make_nack(const uint64_t now_us, NackMsg & nack)
+{
+  nack.next_frame = next_frame_;
+  nack.echo_send_ts = latest_send_ts_;
+  nack.echo_delay_us = latest_send_ts_ ? now_us - latest_recv_us_ : 0;
+  nack.num_ranges = 0;
+
+  if (not highest_ or highest_->first < next_frame_) {
+    return false;
+  }
+
+  const uint64_t reorder_us = clamp(static_cast<uint64_t>(rtt_us_ / 4),
+                                    MIN_REORDER_US, MAX_REORDER_US);
+  const uint64_t renack_us = max(static_cast<uint64_t>(rtt_us_ * RENACK_RTT_FACTOR),
+                                 reorder_us);
+
+  const uint32_t last_frame = min(highest_->first, next_frame_ + MAX_TRACKED_FRAMES);
+  for (uint32_t frame_id = next_frame_; frame_id <= last_frame; frame_id++) {
+    auto & frame = frames_[frame_id];
+
+    if (frame.frag_cnt == 0) {
+      // nothing of an earlier frame has arrived: request all of it
+      if (nack_due(frame.whole, now_us, reorder_us, renack_us)) {
+        if (not nack.add_range(frame_id, 0, 0)) {
+          break;
+        }
+        frame.whole.num_nacks++;
+        frame.whole.last_nack_us = now_us;
+      }
+      continue;
+    }
+
+    if (frame.num_received == frame.frag_cnt) {
+      continue;
+    }
+
+    // fragments after the highest received one are not overdue yet
+    const uint16_t limit = (frame_id == highest_->first) ? highest_->second
+                                                         : frame.frag_cnt;
+
+    // coalesce consecutive due fragments into ranges
+    optional<uint32_t> run_start;
+    for (uint32_t frag_id = 0; frag_id <= limit; frag_id++) {
+      const bool due = frag_id < limit and
+                       nack_due(frame.frags[frag_id], now_us, reorder_us, renack_us);
+
+      if (due) {
+        if (not run_start) {
+          run_start = frag_id;
+        }
+        continue;
+      }
+
+      if (run_start) {
+        if (not nack.add_range(frame_id, *run_start, frag_id - *run_start)) {
+          return true; // full; the rest goes into the next NACK
+        }
+        for (uint32_t i = *run_start; i < frag_id; i++) {
+          frame.frags[i].num_nacks++;
+          frame.frags[i].last_nack_us = now_us;
+        }
+        run_start.reset();
+      }
+    }
+  }
+
+  return nack.num_ranges > 0;
+}
@@ -0,0 +1,78 @@
+#ifndef NACK_TRACKER_HH
+#define NACK_TRACKER_HH
+
+#include <map>
+#include <vector>
+#include <optional>
+
+#include "protocol.hh"
+
+// Receiver side of NACK mode: tracks which fragments of the frames not yet
+// decoded are missing and decides when to request them. A fragment counts
+// as missing once a later datagram has arrived and it has not shown up
+// within a reorder window; it is NACKed again roughly every RTT until it
+// arrives or MAX_NACKS is reached.
+class NackTracker
+{
+public:
+  // call for every received datagram; 'now_us' is timestamp_us()
+  void on_datagram(const FrameDatagramView & datagram, const uint64_t now_us);
+
+  // forget the frames before 'frontier' (consumed or skipped by the decoder)
+  void clean_up_to(const uint32_t frontier);
+
+  // fill in 'nack' (heartbeat fields and the ranges that are due now)
+  // return true if any range is due
+  bool make_nack(const uint64_t now_us, NackMsg & nack);
+
+  // accessors
+  double rtt_us() const { return rtt_us_; }
+
+  static constexpr unsigned int MAX_NACKS = 3; // per fragment
+
+private:
+  struct FragState
+  {
+    bool received {false};
+    uint8_t num_nacks {0};
+    uint64_t detected_us {0}; // when it was found missing (0 if not yet)
+    uint64_t last_nack_us {0};
+  };
+
+  struct FrameState
+  {
+    uint16_t frag_cnt {0}; // 0 until any fragment of the frame arrives
+    uint16_t num_received {0};
+    std::vector<FragState> frags {};
+
+    // used while no fragment of the frame has arrived
+    FragState whole {};
+  };
+
+  std::map<uint32_t, FrameState> frames_ {};
+  uint32_t next_frame_ {0};
+
+  // the highest (frame_id, frag_id) received
+  std::optional<SeqNum> highest_ {};
+
+  // for the sender's RTT samples (echoed in every NACK)
+  uint64_t latest_send_ts_ {0};
+  uint64_t latest_recv_us_ {0};
+
+  // RTT measured from NACKs to the arrival of the repairs
+  double rtt_us_ {DEFAULT_RTT_US};
+  bool rtt_sampled_ {false};
+
+  static constexpr double DEFAULT_RTT_US = 50 * 1000;
+  static constexpr double RTT_ALPHA = 1.0 / 8;
+  static constexpr uint64_t MIN_REORDER_US = 1000;
+  static constexpr uint64_t MAX_REORDER_US = 20 * 1000;
+  static constexpr double RENACK_RTT_FACTOR = 1.5;
+  static constexpr uint32_t MAX_TRACKED_FRAMES = 256;
+
+  // if fragment 'frag' is due for a (re-)NACK at 'now_us'
+  static bool nack_due(FragState & frag, const uint64_t now_us,
+                       const uint64_t reorder_us, const uint64_t renack_us);
+};
+
+#endif /* NACK_TRACKER_HH */
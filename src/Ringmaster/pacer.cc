@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+
+#include "pacer.hh"
+
+using namespace std;
+
+void Pacer::set_rate(const uint64_t rate_bps)
+{
+  if (rate_bps_ == 0 and rate_bps > 0) {
+    // start with a full bucket and no backlog
+    tokens_ = 0.0;
+    last_refill_us_ = 0;
+    next_departure_us_ = 0.0;
+  }
+
+  rate_bps_ = rate_bps;
+  tokens_ = min(tokens_, burst_bytes());
+}
+
+double Pacer::burst_bytes() const
+{
+  return max(rate_bps_ / 8.0 * BURST_US / 1e6, static_cast<double>(MIN_BURST_BYTES));
+}
+
+void Pacer::refill(const uint64_t now_us)
+{
+  if (last_refill_us_ == 0) {
+    tokens_ = burst_bytes();
+  } else if (now_us > last_refill_us_) {
+    tokens_ = min(tokens_ + (now_us - last_refill_us_) * rate_bps_ / 8.0 / 1e6,
+                  burst_bytes());
+  }
+
+  last_refill_us_ = max(last_refill_us_, now_us);
+}
+
+uint64_t Pacer::next_send_us(const uint64_t now_us)
+{
+  if (not enabled()) {
+    return now_us;
+  }
+
+  if (mode_ == Mode::BUCKET) {
+    refill(now_us);
+    if (tokens_ > 0) {
+      return now_us;
+    }
+
+    // until the deficit is paid back (at least one us into the future)
+    return now_us + max<uint64_t>(ceil(-tokens_ * 8 * 1e6 / rate_bps_), 1);
+  }
+
+  // TXTIME: the kernel holds datagrams until their departure times, but
+  // only those within the horizon are handed over (fq drops datagrams too
+  // far in the future and retransmissions should not queue behind them)
+  const uint64_t departure_us = ceil(next_departure_us_);
+  if (departure_us <= now_us + HORIZON_US) {
+    return now_us;
+  }
+  return departure_us - HORIZON_US;
+}
+
+uint64_t Pacer::on_send(const size_t size, const uint64_t now_us)
+{
+  if (not enabled()) {
+    return 0;
+  }
+
+  if (mode_ == Mode::BUCKET) {
+    refill(now_us);
+    tokens_ -= size;
+    return 0;
+  }
+
+  // no credit for idle time: a datagram never departs before now
+  const double departure_us = max(next_departure_us_, static_cast<double>(now_us));
+  next_departure_us_ = departure_us + transmit_us(size);
+  return llround(departure_us * 1000);
+}
+
+void Pacer::undo_send(const size_t size)
+{
+  if (not enabled()) {
+    return;
+  }
+
+  if (mode_ == Mode::BUCKET) {
+    tokens_ = min(tokens_ + size, burst_bytes());
+  } else {
+    next_departure_us_ -= transmit_us(size);
+  }
+}
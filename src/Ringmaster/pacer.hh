@@ -0,0 +1,62 @@
+#ifndef PACER_HH
+#define PACER_HH
+
+#include <cstdint>
+#include <cstddef>
+
+// Spreads the datagrams of a frame over time at a pacing rate instead of
+// sending them back to back, so that a large (key) frame does not overflow
+// the bottleneck queue:
+// - BUCKET: token bucket in user space; the caller stops sending while
+//   next_send_us() is in the future
+// - TXTIME: departure times computed here and enforced by the kernel (the
+//   fq qdisc with SO_TXTIME); the caller only holds datagrams back beyond
+//   a short horizon
+// All times are monotonic_us()
+class Pacer
+{
+public:
+  enum class Mode { OFF, BUCKET, TXTIME };
+
+  Pacer(const Mode mode) : mode_(mode) {}
+
+  Mode mode() const { return mode_; }
+  void set_mode(const Mode mode) { mode_ = mode; }
+
+  // 0 disables pacing
+  void set_rate(const uint64_t rate_bps);
+  uint64_t rate_bps() const { return rate_bps_; }
+
+  // earliest time to hand the next datagram to the socket
+  uint64_t next_send_us(const uint64_t now_us);
+
+  // account for a datagram of 'size' bytes handed to the socket; return its
+  // departure time (CLOCK_MONOTONIC ns) to attach with SO_TXTIME, or 0
+  uint64_t on_send(const size_t size, const uint64_t now_us);
+
+  // give back a datagram that on_send() accounted for but was not sent
+  // (e.g., EWOULDBLOCK); call in reverse order of on_send()
+  void undo_send(const size_t size);
+
+  static constexpr uint64_t BURST_US = 2000; // bucket depth in time
+  static constexpr size_t MIN_BURST_BYTES = 3000; // ~two full datagrams
+  static constexpr uint64_t HORIZON_US = 10 * 1000; // TXTIME lookahead
+
+private:
+  Mode mode_;
+  uint64_t rate_bps_ {0};
+
+  // BUCKET: may go negative by up to one datagram
+  double tokens_ {0.0};
+  uint64_t last_refill_us_ {0};
+  double burst_bytes() const;
+  void refill(const uint64_t now_us);
+
+  // TXTIME: departure time of the next datagram (us, fractional)
+  double next_departure_us_ {0.0};
+
+  bool enabled() const { return mode_ != Mode::OFF and rate_bps_ > 0; }
+  double transmit_us(const size_t size) const { return size * 8 * 1e6 / rate_bps_; }
+};
+
+#endif /* PACER_HH */
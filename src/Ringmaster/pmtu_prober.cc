@@ -0,0 +1,127 @@
+#include <algorithm>
+
+#include "pmtu_prober.hh"
+
+using namespace std;
+
+PmtuProber::PmtuProber(const size_t base_mtu, const size_t max_mtu)
+  : base_mtu_(base_mtu), max_mtu_(max(base_mtu, max_mtu)), mtu_(base_mtu),
+    upper_(max_mtu_ + 1)
+{
+  if (max_mtu_ == base_mtu_) {
+    state_ = State::DONE;
+  }
+}
+
+optional<ProbeMsg> PmtuProber::next_probe(const uint64_t now_us, const uint64_t timeout_us)
+{
+  if (outstanding_) {
+    if (now_us < outstanding_ts_ + timeout_us) {
+      return nullopt;
+    }
+    on_probe_lost(now_us);
+  }
+
+  if (state_ == State::DONE and mtu_ < max_mtu_ and now_us >= done_ts_ + RAISE_INTERVAL_US) {
+    state_ = State::SEARCHING;
+    upper_ = max_mtu_ + 1;
+  }
+
+  if (state_ == State::SEARCHING) {
+    if (upper_ - mtu_ > SEARCH_GRANULARITY) {
+      // try the largest MTU first: datacenter paths usually carry jumbo
+      // frames end to end or not at all
+      return make_probe(upper_ > max_mtu_ ? max_mtu_ : (mtu_ + upper_) / 2, now_us);
+    }
+    finish_search(now_us);
+  }
+
+  // confirm the current MTU, retrying right away if a confirmation is lost
+  if (mtu_ > base_mtu_ and
+      (num_attempts_ > 0 or now_us >= confirmed_ts_ + CONFIRM_INTERVAL_US)) {
+    return make_probe(mtu_, now_us);
+  }
+
+  return nullopt;
+}
+
+void PmtuProber::on_probe_rejected(const ProbeMsg & probe, const uint64_t now_us)
+{
+  if (outstanding_ and outstanding_->seq == probe.seq) {
+    num_attempts_ = MAX_PROBES;
+    on_probe_lost(now_us);
+  }
+}
+
+void PmtuProber::on_probe_ack(const ProbeAckMsg & ack, const uint64_t now_us)
+{
+  if (not outstanding_ or ack.seq != outstanding_->seq) {
+    return; // late, or from before a fallback
+  }
+
+  num_probes_acked_++;
+  outstanding_.reset();
+  num_attempts_ = 0;
+
+  mtu_ = max<size_t>(mtu_, ack.mtu);
+  confirmed_ts_ = now_us;
+}
+
+void PmtuProber::on_path_mtu(const size_t path_mtu, const uint64_t now_us)
+{
+  if (path_mtu >= mtu_) {
+    // no need to probe sizes the kernel already knows to be too large
+    upper_ = min(upper_, path_mtu + 1);
+    return;
+  }
+
+  // ICMP "fragmentation needed": take the kernel's value and stop probing
+  // above it until the next raise
+  mtu_ = max(path_mtu, FrameDatagram::MIN_MTU);
+  base_mtu_ = min(base_mtu_, mtu_);
+  upper_ = mtu_ + 1;
+  outstanding_.reset();
+  num_attempts_ = 0;
+  finish_search(now_us);
+}
+
+void PmtuProber::on_probe_lost(const uint64_t now_us)
+{
+  const size_t probed_mtu = outstanding_->mtu;
+  outstanding_.reset();
+  if (num_attempts_ < MAX_PROBES) {
+    return; // probe the same size again
+  }
+  num_attempts_ = 0;
+
+  if (state_ == State::SEARCHING) {
+    upper_ = min(upper_, probed_mtu);
+    return;
+  }
+
+  // the current MTU stopped working (black hole): fall back to the base
+  // and search again below the failed size
+  if (probed_mtu == mtu_) {
+    mtu_ = base_mtu_;
+    upper_ = probed_mtu;
+    state_ = State::SEARCHING;
+    confirmed_ts_ = now_us;
+  }
+}
+
+void PmtuProber::finish_search(const uint64_t now_us)
+{
+  state_ = State::DONE;
+  done_ts_ = now_us;
+  confirmed_ts_ = now_us;
+}
+
+ProbeMsg PmtuProber::make_probe(const size_t mtu, const uint64_t now_us)
+{
+  outstanding_ = ProbeMsg(next_seq_++, mtu);
+  outstanding_ts_ = now_us;
+  num_attempts_++;
+  num_probes_sent_++;
+
+  return *outstanding_;
+}
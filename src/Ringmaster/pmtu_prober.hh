@@ -0,0 +1,76 @@
+#ifndef PMTU_PROBER_HH
+#define PMTU_PROBER_HH
+
+#include <optional>
+#include <cstdint>
+
+#include "protocol.hh"
+
+// Sender side of path MTU discovery in the packetization layer (as in
+// RFC 8899): probes the path with padded DF datagrams that the receiver
+// acknowledges, and binary-searches between the largest acknowledged MTU
+// and the smallest one that went unanswered. Falls back when the kernel
+// learns a smaller path MTU from ICMP, or when probes of the current MTU
+// go unanswered (a black hole after a route change).
+class PmtuProber
+{
+public:
+  // search from 'base_mtu' (assumed to work) up to 'max_mtu'
+  PmtuProber(const size_t base_mtu, const size_t max_mtu);
+
+  // the largest MTU known to work
+  size_t mtu() const { return mtu_; }
+  bool searching() const { return state_ == State::SEARCHING; }
+
+  // the probe to send now, if one is due; an outstanding probe counts as
+  // lost after 'timeout_us'
+  std::optional<ProbeMsg> next_probe(const uint64_t now_us, const uint64_t timeout_us);
+
+  // a probe could not be sent at all (EMSGSIZE)
+  void on_probe_rejected(const ProbeMsg & probe, const uint64_t now_us);
+
+  void on_probe_ack(const ProbeAckMsg & ack, const uint64_t now_us);
+
+  // the kernel's path MTU (lowered by ICMP "fragmentation needed")
+  void on_path_mtu(const size_t path_mtu, const uint64_t now_us);
+
+  // stats
+  unsigned int num_probes_sent() const { return num_probes_sent_; }
+  unsigned int num_probes_acked() const { return num_probes_acked_; }
+
+  // a size counts as failed after this many unanswered probes
+  static constexpr unsigned int MAX_PROBES = 3;
+  // stop the search once it has narrowed down to this many bytes
+  static constexpr size_t SEARCH_GRANULARITY = 16;
+  // confirm the current MTU (if above the base) this often
+  static constexpr uint64_t CONFIRM_INTERVAL_US = 5'000'000;
+  // search again for a larger MTU this often
+  static constexpr uint64_t RAISE_INTERVAL_US = 60'000'000;
+
+private:
+  enum class State { SEARCHING, DONE };
+
+  size_t base_mtu_;
+  size_t max_mtu_;
+  size_t mtu_;
+
+  State state_ {State::SEARCHING};
+  size_t upper_; // the smallest MTU known (or assumed) not to work
+  uint64_t done_ts_ {0};
+  uint64_t confirmed_ts_ {0};
+
+  // the probe in flight and the number of times its size has been probed
+  std::optional<ProbeMsg> outstanding_ {};
+  uint64_t outstanding_ts_ {0};
+  unsigned int num_attempts_ {0};
+  uint32_t next_seq_ {0};
+
+  unsigned int num_probes_sent_ {0};
+  unsigned int num_probes_acked_ {0};
+
+  void on_probe_lost(const uint64_t now_us);
+  void finish_search(const uint64_t now_us);
+  ProbeMsg make_probe(const size_t mtu, const uint64_t now_us);
+};
+
+#endif /* PMTU_PROBER_HH */
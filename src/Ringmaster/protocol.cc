@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <stdexcept>
 #include "protocol.hh"
 #include "serialization.hh"
@@ -13,9 +14,35 @@ BaseDatagram::BaseDatagram(const uint32_t _frame_id,
                            const string_view _payload)
   // initialize members
   : frame_id(_frame_id), frame_type(_frame_type),
-    frag_id(_frag_id), frag_cnt(_frag_cnt), payload(_payload)
+    frag_id(_frag_id), frag_cnt(_frag_cnt)
+{
+  set_payload(_payload);
+}
+
+BaseDatagram::BaseDatagram(const uint32_t _frame_id,
+                           const FrameType _frame_type,
+                           const uint16_t _frag_id,
+                           const uint16_t _frag_cnt,
+                           shared_ptr<const void> owner,
+                           const string_view _payload)
+  : frame_id(_frame_id), frame_type(_frame_type),
+    frag_id(_frag_id), frag_cnt(_frag_cnt),
+    payload_owner(move(owner)), payload(_payload)
 {}
 
+void BaseDatagram::set_payload(const string_view data)
+{
+  if (data.empty()) {
+    payload_owner.reset();
+    payload = {};
+    return;
+  }
+
+  const auto slab = make_shared<const string>(data);
+  payload = *slab;
+  payload_owner = slab;
+}
+
 
 TileDatagram::TileDatagram(const uint32_t _frame_id,
                   const FrameType _frame_type,
@@ -40,7 +67,7 @@ void TileDatagram::set_mtu(const size_t mtu)
   max_payload = mtu - 28 - TileDatagram::HEADER_SIZE; // MTU - (IP + UDP headers) - Datagram header
 }
 
-bool TileDatagram::parse_from_string(const string & binary)
+bool TileDatagram::parse_from_string(const string_view binary)
 {
   if (binary.size() < HEADER_SIZE) {
     return false; // datagram is too small to contain a header
@@ -55,25 +82,31 @@ bool TileDatagram::parse_from_string(const string & binary)
   frame_width = parser.read_uint16();
   frame_height = parser.read_uint16();
   send_ts = parser.read_uint64();
-  payload = parser.read_string();
+  set_payload(parser.read_view());
 
   return true;
 }
 
-string TileDatagram::serialize_to_string() const
+size_t TileDatagram::serialize_header(char * buf) const
 {
-  string binary;
-  binary.reserve(HEADER_SIZE + payload.size());
+  WireWriter writer(buf, HEADER_SIZE);
+  writer.write_uint32(frame_id);
+  writer.write_uint8(static_cast<uint8_t>(frame_type));
+  writer.write_uint16(tile_id);
+  writer.write_uint16(frag_id);
+  writer.write_uint16(frag_cnt);
+  writer.write_uint16(frame_width);
+  writer.write_uint16(frame_height);
+  writer.write_uint64(send_ts);
+
+  return writer.size();
+}
 
-  binary += put_number(frame_id);
-  binary += put_number(static_cast<uint8_t>(frame_type));
-  binary += put_number(tile_id);
-  binary += put_number(frag_id);
-  binary += put_number(frag_cnt);
-  binary += put_number(frame_width);
-  binary += put_number(frame_height);
-  binary += put_number(send_ts);
-  binary += payload;
+string TileDatagram::serialize_to_string() const
+{
+  string binary(HEADER_SIZE + payload.size(), '\0');
+  serialize_header(binary.data());
+  binary.replace(HEADER_SIZE, payload.size(), payload);
 
   return binary;
 }
@@ -91,19 +124,166 @@ FrameDatagram::FrameDatagram(const uint32_t _frame_id,
     frame_width(_frame_width), frame_height(_frame_height)
 {}
 
+FrameDatagram::FrameDatagram(const uint32_t _frame_id,
+                  const FrameType _frame_type,
+                  const uint16_t _frag_id,
+                  const uint16_t _frag_cnt,
+                  const uint16_t _frame_width,
+                  const uint16_t _frame_height,
+                  shared_ptr<const void> owner,
+                  const string_view _payload)
+  : BaseDatagram(_frame_id, _frame_type, _frag_id, _frag_cnt,
+                 move(owner), _payload),
+    frame_width(_frame_width), frame_height(_frame_height)
+{}
+
 size_t FrameDatagram::max_payload = 1500 - 28 - FrameDatagram::HEADER_SIZE; // 28: IP + UDP headers
+uint8_t FrameDatagram::header_version = FrameDatagram::HEADER_V1;
+
+namespace {
+  // v2 flags byte: the high bit is set, unlike in v1 where the byte is the
+  // top of frame_id (below 2^31)
+  constexpr uint8_t V2_MARKER = 0x80;
+  constexpr uint8_t V2_DIMENSIONS = 0x40;
+  constexpr unsigned int V2_TYPE_SHIFT = 3;
+  constexpr uint8_t V2_TYPE_MASK = 0x07;
+  constexpr uint8_t V2_VERSION_MASK = 0x07;
+
+  constexpr size_t V2_FIXED_SIZE = sizeof(uint8_t) + sizeof(uint32_t); // flags + send_ts
+  constexpr size_t V2_DIMENSIONS_SIZE = 2 * sizeof(uint16_t);
+
+  constexpr uint64_t TS_WRAP = uint64_t(1) << 32;
+}
+
+uint64_t extend_ts(const uint64_t ts, const uint64_t ref_ts)
+{
+  const uint64_t extended = (ref_ts & ~(TS_WRAP - 1)) | (ts & (TS_WRAP - 1));
+
+  if (extended > ref_ts + TS_WRAP / 2 and extended >= TS_WRAP) {
+    return extended - TS_WRAP;
+  }
+  if (extended + TS_WRAP / 2 < ref_ts) {
+    return extended + TS_WRAP;
+  }
+  return extended;
+}
+
+uint64_t FrameDatagramView::last_v2_send_ts_ = 0;
+
+void FrameDatagram::set_header_version(const uint8_t version)
+{
+  if (version != HEADER_V1 and version != HEADER_V2) {
+    throw runtime_error("unsupported header version: " + to_string(version));
+  }
+  header_version = version;
+}
+
+size_t FrameDatagram::header_size(const uint32_t frame_id, const uint16_t frag_id,
+                                  const uint16_t frag_cnt)
+{
+  if (header_version == HEADER_V1) {
+    return HEADER_SIZE;
+  }
+
+  return V2_FIXED_SIZE + varint_size(frame_id) + varint_size(frag_id) + varint_size(frag_cnt)
+         + (frag_id == 0 ? V2_DIMENSIONS_SIZE : 0);
+}
+
+size_t FrameDatagram::max_payload_of(const uint32_t frame_id, const uint16_t frag_id,
+                                     const uint32_t frag_id_bound)
+{
+  if (header_version == HEADER_V1) {
+    return max_payload;
+  }
+
+  const size_t max_header_size = V2_FIXED_SIZE + varint_size(frame_id) + 2 * varint_size(frag_id_bound)
+                                 + (frag_id == 0 ? V2_DIMENSIONS_SIZE : 0);
+  return max_datagram_size() - max_header_size;
+}
 
 void FrameDatagram::set_mtu(const size_t mtu)
 {
-  // if (mtu > 1500 or mtu < 512) {
-  //   throw runtime_error("reasonable MTU is between 512 and 1500 bytes");
-  // }
+  if (mtu > MAX_MTU or mtu < MIN_MTU) {
+    throw runtime_error("reasonable MTU is between " + to_string(MIN_MTU)
+                        + " and " + to_string(MAX_MTU) + " bytes");
+  }
   max_payload = mtu - 28 - FrameDatagram::HEADER_SIZE; // MTU - (IP + UDP headers) - Datagram header
 }
 
-bool FrameDatagram::parse_from_string(const string & binary)
+bool FrameDatagram::parse_from_string(const string_view binary)
 {
-  if (binary.size() < HEADER_SIZE) {
+  FrameDatagramView view;
+  if (not view.parse_from_string(binary)) {
+    return false;
+  }
+
+  frame_id = view.frame_id;
+  frame_type = view.frame_type;
+  frag_id = view.frag_id;
+  frag_cnt = view.frag_cnt;
+  frame_width = view.frame_width;
+  frame_height = view.frame_height;
+  send_ts = view.send_ts;
+  set_payload(view.payload);
+
+  return true;
+}
+
+size_t FrameDatagram::serialize_header(char * buf) const
+{
+  WireWriter writer(buf, HEADER_SIZE);
+
+  if (header_version == HEADER_V2) {
+    const bool dimensions = frag_id == 0;
+    writer.write_uint8(V2_MARKER | (dimensions ? V2_DIMENSIONS : 0)
+                       | static_cast<uint8_t>(frame_type) << V2_TYPE_SHIFT | HEADER_V2);
+    writer.write_varint(frame_id);
+    writer.write_varint(frag_id);
+    writer.write_varint(frag_cnt);
+    writer.write_uint32(static_cast<uint32_t>(send_ts));
+    if (dimensions) {
+      writer.write_uint16(frame_width);
+      writer.write_uint16(frame_height);
+    }
+    return writer.size();
+  }
+
+  writer.write_uint32(frame_id);
+  writer.write_uint8(static_cast<uint8_t>(frame_type));
+  writer.write_uint16(frag_id);
+  writer.write_uint16(frag_cnt);
+  writer.write_uint16(frame_width);
+  writer.write_uint16(frame_height);
+  writer.write_uint64(send_ts);
+
+  return writer.size();
+}
+
+string FrameDatagram::serialize_to_string() const
+{
+  string binary(serialized_size(), '\0');
+  const size_t header_size = serialize_header(binary.data());
+  binary.replace(header_size, payload.size(), payload);
+
+  return binary;
+}
+
+
+FrameDatagramView::FrameDatagramView(const FrameDatagram & datagram)
+  : frame_id(datagram.frame_id), frame_type(datagram.frame_type),
+    frag_id(datagram.frag_id), frag_cnt(datagram.frag_cnt),
+    frame_width(datagram.frame_width), frame_height(datagram.frame_height),
+    send_ts(datagram.send_ts), header_size(datagram.header_size()),
+    payload(datagram.payload)
+{}
+
+bool FrameDatagramView::parse_from_string(const string_view binary)
+{
+  if (not binary.empty() and (binary[0] & V2_MARKER)) {
+    return parse_v2(binary);
+  }
+
+  if (binary.size() < FrameDatagram::HEADER_SIZE) {
     return false; // datagram is too small to contain a header
   }
 
@@ -115,26 +295,63 @@ bool FrameDatagram::parse_from_string(const string & binary)
   frame_width = parser.read_uint16();
   frame_height = parser.read_uint16();
   send_ts = parser.read_uint64();
-  payload = parser.read_string();
+  header_size = FrameDatagram::HEADER_SIZE;
+  payload = parser.read_view();
 
   return true;
 }
 
-string FrameDatagram::serialize_to_string() const
+bool FrameDatagramView::parse_v2(const string_view binary)
 {
-  string binary;
-  binary.reserve(HEADER_SIZE + payload.size());
+  WireParser parser(binary);
 
-  binary += put_number(frame_id);
-  binary += put_number(static_cast<uint8_t>(frame_type));
-  binary += put_number(frag_id);
-  binary += put_number(frag_cnt);
-  binary += put_number(frame_width);
-  binary += put_number(frame_height);
-  binary += put_number(send_ts);
-  binary += payload;
+  try {
+    const uint8_t flags = parser.read_uint8();
+    if ((flags & V2_VERSION_MASK) != FrameDatagram::HEADER_V2) {
+      return false;
+    }
+    frame_type = static_cast<FrameType>((flags >> V2_TYPE_SHIFT) & V2_TYPE_MASK);
+
+    const uint64_t id = parser.read_varint();
+    const uint64_t frag = parser.read_varint();
+    const uint64_t cnt = parser.read_varint();
+    if (id > UINT32_MAX or frag > UINT16_MAX or cnt > UINT16_MAX) {
+      return false;
+    }
+    frame_id = id;
+    frag_id = frag;
+    frag_cnt = cnt;
+
+    // the hosts' clocks may be far apart: unwrap against the sender's own
+    // earlier timestamps (starting one wrap up, so that reordered earlier
+    // ones stay positive)
+    const uint32_t low_ts = parser.read_uint32();
+    send_ts = last_v2_send_ts_ == 0 ? TS_WRAP | low_ts : extend_ts(low_ts, last_v2_send_ts_);
+    last_v2_send_ts_ = max(last_v2_send_ts_, send_ts);
+
+    frame_width = 0;
+    frame_height = 0;
+    if (flags & V2_DIMENSIONS) {
+      frame_width = parser.read_uint16();
+      frame_height = parser.read_uint16();
+    }
+  } catch (const out_of_range &) {
+    return false; // datagram is too small to contain a header
+  }
 
-  return binary;
+  payload = parser.read_view();
+  header_size = binary.size() - payload.size();
+
+  return true;
+}
+
+FrameDatagram FrameDatagramView::to_datagram() const
+{
+  FrameDatagram datagram(frame_id, frame_type, frag_id, frag_cnt,
+                         frame_width, frame_height, payload);
+  datagram.send_ts = send_ts;
+
+  return datagram;
 }
 
 
@@ -145,42 +362,159 @@ size_t Msg::serialized_size() const
   return sizeof(type);
 }
 
+void Msg::write_to(WireWriter & writer) const
+{
+  writer.write_uint8(static_cast<uint8_t>(type));
+}
+
+size_t Msg::serialize_to(char * buf, const size_t capacity) const
+{
+  WireWriter writer(buf, capacity);
+  write_to(writer);
+
+  return writer.size();
+}
+
 string Msg::serialize_to_string() const
 {
-  return put_number(static_cast<uint8_t>(type));
+  string binary(serialized_size(), '\0');
+  serialize_to(binary.data(), binary.size());
+
+  return binary;
 }
 
-shared_ptr<Msg> Msg::parse_from_string(const string & binary)
+ParsedMsg Msg::parse_from_string(const string_view binary)
 {
-  if (binary.size() < sizeof(type)) {
-    return nullptr;
+  if (binary.size() < sizeof(Type)) {
+    return {};
   }
 
   WireParser parser(binary);
   auto type = static_cast<Type>(parser.read_uint8());
 
   if (type == Type::ACK) {
-    auto ret = make_shared<AckMsg>();
-    ret->frame_id = parser.read_uint32();
-    ret->frag_id = parser.read_uint16();
-    ret->send_ts = parser.read_uint64();
+    AckMsg ret;
+    if (binary.size() < ret.serialized_size()) {
+      return {};
+    }
+    ret.frame_id = parser.read_uint32();
+    ret.frag_id = parser.read_uint16();
+    ret.send_ts = parser.read_uint64();
     return ret;
   }
   else if (type == Type::CONFIG) {
-    auto ret = make_shared<ConfigMsg>();
-    ret->width = parser.read_uint16();
-    ret->height = parser.read_uint16();
-    ret->frame_rate = parser.read_uint16();
-    ret->target_bitrate = parser.read_uint32();
+    ConfigMsg ret;
+    // header_version and refresh_frames are optional
+    const size_t optional_size = 2 * sizeof(uint8_t);
+    if (binary.size() < ret.serialized_size() - optional_size) {
+      return {};
+    }
+    ret.width = parser.read_uint16();
+    ret.height = parser.read_uint16();
+    ret.frame_rate = parser.read_uint16();
+    ret.target_bitrate = parser.read_uint32();
+    ret.feedback = static_cast<ConfigMsg::Feedback>(parser.read_uint8());
+    if (binary.size() > ret.serialized_size() - optional_size) {
+      ret.header_version = parser.read_uint8();
+    }
+    if (binary.size() >= ret.serialized_size()) {
+      ret.refresh_frames = parser.read_uint8();
+    }
     return ret;
   }
   else if (type == Type::SIGNAL) {
-    auto ret = make_shared<SignalMsg>();
-    ret->target_bitrate = parser.read_uint32();
+    SignalMsg ret;
+    if (binary.size() < ret.serialized_size()) {
+      return {};
+    }
+    ret.target_bitrate = parser.read_uint32();
+    return ret;
+  }
+  else if (type == Type::NACK) {
+    NackMsg ret;
+    if (binary.size() < NackMsg::HEADER_SIZE) {
+      return {};
+    }
+    ret.next_frame = parser.read_uint32();
+    ret.echo_send_ts = parser.read_uint64();
+    ret.echo_delay_us = parser.read_uint32();
+    ret.num_ranges = parser.read_uint8();
+    if (ret.num_ranges > NackMsg::MAX_RANGES or
+        binary.size() < ret.serialized_size()) {
+      return {};
+    }
+    for (unsigned int i = 0; i < ret.num_ranges; i++) {
+      auto & range = ret.ranges[i];
+      range.frame_id = parser.read_uint32();
+      range.first_frag = parser.read_uint16();
+      range.num_frags = parser.read_uint16();
+    }
     return ret;
   }
+  else if (type == Type::SACK) {
+    SackMsg ret;
+    if (binary.size() < SackMsg::HEADER_SIZE) {
+      return {};
+    }
+    ret.cumulative.first = parser.read_uint32();
+    ret.cumulative.second = parser.read_uint16();
+    ret.echo_send_ts = parser.read_uint64();
+    ret.echo_delay_us = parser.read_uint32();
+    ret.num_blocks = parser.read_uint8();
+    if (ret.num_blocks > SackMsg::MAX_BLOCKS or
+        binary.size() < ret.serialized_size()) {
+      return {};
+    }
+    for (unsigned int i = 0; i < ret.num_blocks; i++) {
+      auto & block = ret.blocks[i];
+      block.frame_id = parser.read_uint32();
+      block.first_frag = parser.read_uint16();
+      block.bitmap = parser.read_uint64();
+    }
+    return ret;
+  }
+  else if (type == Type::REPORT) {
+    ReceiverReportMsg ret;
+    if (binary.size() < ReceiverReportMsg::WIRE_SIZE) {
+      return {};
+    }
+    ret.interval_us = parser.read_uint32();
+    ret.received_kbps = parser.read_uint32();
+    ret.loss_fraction = parser.read_uint8();
+    ret.jitter_us = parser.read_uint32();
+    ret.frames_completed = parser.read_uint16();
+    ret.frames_skipped = parser.read_uint16();
+    ret.remb_kbps = parser.read_uint32();
+    return ret;
+  }
+  else if (type == Type::PLI) {
+    PliMsg ret;
+    if (binary.size() < PliMsg::WIRE_SIZE) {
+      return {};
+    }
+    ret.frame_id = parser.read_uint32();
+    return ret;
+  }
+  else if (type == Type::PROBE or type == Type::PROBE_ACK) {
+    if (binary.size() < ProbeMsg::WIRE_SIZE) {
+      return {};
+    }
+    const uint32_t seq = parser.read_uint32();
+    const uint16_t mtu = parser.read_uint16();
+    if (type == Type::PROBE_ACK) {
+      ProbeAckMsg ret;
+      ret.seq = seq;
+      ret.mtu = mtu;
+      return ret;
+    }
+    // a probe only counts if it arrived whole
+    if (binary.size() + 28 < mtu) {
+      return {};
+    }
+    return ProbeMsg(seq, mtu);
+  }
   else {
-    return nullptr;
+    return {};
   }
 }
 
@@ -189,49 +523,51 @@ AckMsg::AckMsg(const BaseDatagram & datagram)
     send_ts(datagram.send_ts)
 {}
 
+AckMsg::AckMsg(const FrameDatagramView & datagram)
+  : Msg(Type::ACK), frame_id(datagram.frame_id), frag_id(datagram.frag_id),
+    send_ts(datagram.send_ts)
+{}
+
 size_t AckMsg::serialized_size() const
 {
-  return Msg::serialized_size() + sizeof(uint16_t) + sizeof(uint32_t)
-         + sizeof(uint64_t);
+  return WIRE_SIZE;
 }
 
-string AckMsg::serialize_to_string() const
+void AckMsg::write_to(WireWriter & writer) const
 {
-  string binary;
-  binary.reserve(serialized_size());
-
-  binary += Msg::serialize_to_string();
-  binary += put_number(frame_id);
-  binary += put_number(frag_id);
-  binary += put_number(send_ts);
-
-  return binary;
+  Msg::write_to(writer);
+  writer.write_uint32(frame_id);
+  writer.write_uint16(frag_id);
+  writer.write_uint64(send_ts);
 }
 
 // config message for udp sender
 ConfigMsg::ConfigMsg(const uint16_t _width, const uint16_t _height,
-                     const uint16_t _frame_rate, const uint32_t _target_bitrate)
+                     const uint16_t _frame_rate, const uint32_t _target_bitrate,
+                     const Feedback _feedback, const uint8_t _header_version,
+                     const uint8_t _refresh_frames)
   : Msg(Type::CONFIG), width(_width), height(_height),
-    frame_rate(_frame_rate), target_bitrate(_target_bitrate)
+    frame_rate(_frame_rate), target_bitrate(_target_bitrate),
+    feedback(_feedback), header_version(_header_version),
+    refresh_frames(_refresh_frames)
 {}
 
 size_t ConfigMsg::serialized_size() const
 {
-  return Msg::serialized_size() + 3 * sizeof(uint16_t) + sizeof(uint32_t); 
+  return Msg::serialized_size() + 3 * sizeof(uint16_t) + sizeof(uint32_t)
+         + sizeof(Feedback) + 2 * sizeof(uint8_t); 
 }
 
-string ConfigMsg::serialize_to_string() const
+void ConfigMsg::write_to(WireWriter & writer) const
 {
-  string binary;
-  binary.reserve(serialized_size());
-
-  binary += Msg::serialize_to_string();
-  binary += put_number(width);
-  binary += put_number(height);
-  binary += put_number(frame_rate);
-  binary += put_number(target_bitrate);
-
-  return binary;
+  Msg::write_to(writer);
+  writer.write_uint16(width);
+  writer.write_uint16(height);
+  writer.write_uint16(frame_rate);
+  writer.write_uint32(target_bitrate);
+  writer.write_uint8(static_cast<uint8_t>(feedback));
+  writer.write_uint8(header_version);
+  writer.write_uint8(refresh_frames);
 }
 
 // message for control signal
@@ -246,13 +582,115 @@ size_t SignalMsg::serialized_size() const
   return Msg::serialized_size() + sizeof(uint32_t); 
 }
 
-string SignalMsg::serialize_to_string() const
+void SignalMsg::write_to(WireWriter & writer) const
+{
+  Msg::write_to(writer);
+  writer.write_uint32(target_bitrate);
+}
+
+// NACK feedback
+bool NackMsg::add_range(const uint32_t frame_id, const uint16_t first_frag,
+                        const uint16_t num_frags)
 {
-  string binary;
-  binary.reserve(serialized_size());
+  if (num_ranges == MAX_RANGES) {
+    return false;
+  }
 
-  binary += Msg::serialize_to_string();
-  binary += put_number(target_bitrate);
+  ranges[num_ranges++] = {frame_id, first_frag, num_frags};
+  return true;
+}
 
-  return binary;
+size_t NackMsg::serialized_size() const
+{
+  return HEADER_SIZE + num_ranges * RANGE_SIZE;
+}
+
+void NackMsg::write_to(WireWriter & writer) const
+{
+  Msg::write_to(writer);
+  writer.write_uint32(next_frame);
+  writer.write_uint64(echo_send_ts);
+  writer.write_uint32(echo_delay_us);
+  writer.write_uint8(num_ranges);
+  for (unsigned int i = 0; i < num_ranges; i++) {
+    writer.write_uint32(ranges[i].frame_id);
+    writer.write_uint16(ranges[i].first_frag);
+    writer.write_uint16(ranges[i].num_frags);
+  }
+}
+
+// cumulative and selective ACK
+size_t SackMsg::serialized_size() const
+{
+  return HEADER_SIZE + num_blocks * BLOCK_SIZE;
+}
+
+void SackMsg::write_to(WireWriter & writer) const
+{
+  Msg::write_to(writer);
+  writer.write_uint32(cumulative.first);
+  writer.write_uint16(cumulative.second);
+  writer.write_uint64(echo_send_ts);
+  writer.write_uint32(echo_delay_us);
+  writer.write_uint8(num_blocks);
+  for (unsigned int i = 0; i < num_blocks; i++) {
+    writer.write_uint32(blocks[i].frame_id);
+    writer.write_uint16(blocks[i].first_frag);
+    writer.write_uint64(blocks[i].bitmap);
+  }
+}
+
+// receiver report
+size_t ReceiverReportMsg::serialized_size() const
+{
+  return WIRE_SIZE;
+}
+
+void ReceiverReportMsg::write_to(WireWriter & writer) const
+{
+  Msg::write_to(writer);
+  writer.write_uint32(interval_us);
+  writer.write_uint32(received_kbps);
+  writer.write_uint8(loss_fraction);
+  writer.write_uint32(jitter_us);
+  writer.write_uint16(frames_completed);
+  writer.write_uint16(frames_skipped);
+  writer.write_uint32(remb_kbps);
+}
+
+// picture loss indication
+size_t PliMsg::serialized_size() const
+{
+  return WIRE_SIZE;
+}
+
+void PliMsg::write_to(WireWriter & writer) const
+{
+  Msg::write_to(writer);
+  writer.write_uint32(frame_id);
+}
+
+// path MTU probe
+size_t ProbeMsg::serialized_size() const
+{
+  return max<size_t>(WIRE_SIZE, mtu - min<size_t>(mtu, 28)); // 28: IP + UDP headers
+}
+
+void ProbeMsg::write_to(WireWriter & writer) const
+{
+  Msg::write_to(writer);
+  writer.write_uint32(seq);
+  writer.write_uint16(mtu);
+}
+
+size_t ProbeAckMsg::serialized_size() const
+{
+  return WIRE_SIZE;
+}
+
+void ProbeAckMsg::write_to(WireWriter & writer) const
+{
+  Msg::write_to(writer);
+  writer.write_uint32(seq);
+  writer.write_uint16(mtu);
 }
@@ -2,18 +2,30 @@
 #define PROTOCOL_HH
 
 #include <string>
+#include <string_view>
 #include <memory>
 #include <utility> 
+#include <variant>
+#include <array>
+
+class WireWriter;
 
 enum class FrameType : uint8_t { 
   UNKNOWN = 0, // unknown
   KEY = 1,     // key frame
   NONKEY = 2,  // non-key frame
+  REFRESH = 3, // first frame of an intra-refresh wave (see ConfigMsg::refresh_frames)
+  RECOVERY = 4 // predicted only from a long-term reference the receiver has decoded
 };
 
 // (frame_id, frag_id)
 using SeqNum = std::pair<uint32_t, uint16_t>;
 
+// the timestamp closest to 'ref_ts' whose low 32 bits are those of 'ts': v2
+// headers carry only the low 32 bits of send_ts, which the sender widens
+// against its own clock when they are echoed back
+uint64_t extend_ts(const uint64_t ts, const uint64_t ref_ts);
+
 // Base Datagram class
 struct BaseDatagram 
 {
@@ -24,6 +36,14 @@ struct BaseDatagram
                const uint16_t _frag_cnt, 
                const std::string_view _payload);
 
+  // share 'payload', which must point into the slab 'owner', without copying
+  BaseDatagram(const uint32_t _frame_id,
+               const FrameType _frame_type,
+               const uint16_t _frag_id,
+               const uint16_t _frag_cnt,
+               std::shared_ptr<const void> owner,
+               const std::string_view _payload);
+
   virtual ~BaseDatagram() {}
 
   uint32_t frame_id {};    
@@ -32,16 +52,37 @@ struct BaseDatagram
   uint16_t frag_cnt {};  
   uint64_t send_ts {};
 
-  std::string payload {}; 
+  // 'payload' views a refcounted slab (e.g., an entire encoded frame) shared
+  // by all datagrams made from it, so copying a datagram into 'unacked' or
+  // the send buffer for a retransmission does not copy its payload
+  std::shared_ptr<const void> payload_owner {};
+  std::string_view payload {};
+
+  // copy 'data' into a slab of its own
+  void set_payload(const std::string_view data);
 
   // retransmission-related
   unsigned int num_rtx {0};  
   uint64_t last_send_ts {0};  
+
+  // delivery rate sampling (sender only), stamped when first sent: the
+  // bytes delivered so far, when the latest delivery was acknowledged, and
+  // when that delivered datagram had been sent
+  uint64_t delivered {0};
+  uint64_t delivered_ts {0};
+  uint64_t first_sent_ts {0};
+
+  // when the frame is due at the receiver (sender only; 0 if none)
+  uint64_t deadline_ts {0};
   
 
   // serialization and deserialization
-  virtual bool parse_from_string(const std::string & binary) = 0;
+  virtual bool parse_from_string(const std::string_view binary) = 0;
   virtual std::string serialize_to_string() const = 0;
+
+  // write only the header into 'buf' (of at least the header size) and
+  // return its size; the payload is sent from 'payload' without copying
+  virtual size_t serialize_header(char * buf) const = 0;
 };
 
 struct FrameDatagram : public BaseDatagram
@@ -55,18 +96,87 @@ struct FrameDatagram : public BaseDatagram
                 const uint16_t _frame_height,
                 const std::string_view _payload
                 );
+  FrameDatagram(const uint32_t _frame_id,
+                const FrameType _frame_type,
+                const uint16_t _frag_id,
+                const uint16_t _frag_cnt,
+                const uint16_t _frame_width,
+                const uint16_t _frame_height,
+                std::shared_ptr<const void> owner,
+                const std::string_view _payload);
   
   uint16_t frame_width {};
   uint16_t frame_height {};  
   static const size_t HEADER_SIZE  = sizeof(uint32_t) + 
-    sizeof(FrameType) + 4 * sizeof(uint16_t) + sizeof(uint64_t);
+    sizeof(FrameType) + 4 * sizeof(uint16_t) + sizeof(uint64_t); // v1, and the largest
 
-  
+  // Wire header versions, negotiated in ConfigMsg (receivers parse both):
+  // v1: the fixed HEADER_SIZE bytes above
+  // v2: a flags byte (version, frame type, and whether the frame dimensions
+  //     follow), varint frame_id, frag_id and frag_cnt, the low 32 bits of
+  //     send_ts, and the frame dimensions on fragment 0 only
+  static constexpr uint8_t HEADER_V1 = 1;
+  static constexpr uint8_t HEADER_V2 = 2;
+  static void set_header_version(const uint8_t version);
+  static uint8_t header_version;
+
+  // from the IPv4 minimum up to jumbo frames
+  static constexpr size_t MIN_MTU = 576;
+  static constexpr size_t MAX_MTU = 9216;
   static void set_mtu(const size_t mtu);
-  static size_t max_payload;
+  static size_t max_payload; // with a v1 header (at least as large with v2)
+  static size_t max_datagram_size() { return HEADER_SIZE + max_payload; }
 
-  bool parse_from_string(const std::string & binary) override;
+  // header size of fragment 'frag_id' of frame 'frame_id' (of 'frag_cnt')
+  static size_t header_size(const uint32_t frame_id, const uint16_t frag_id,
+                            const uint16_t frag_cnt);
+  size_t header_size() const { return header_size(frame_id, frag_id, frag_cnt); }
+
+  static size_t mtu() { return max_datagram_size() + 28; } // 28: IP + UDP headers
+
+  // the largest payload of fragment 'frag_id' of frame 'frame_id' if the
+  // frame's frag_ids (parity included) and frag_cnt are below 'frag_id_bound'
+  static size_t max_payload_of(const uint32_t frame_id, const uint16_t frag_id,
+                               const uint32_t frag_id_bound);
+
+  size_t serialized_size() const { return header_size() + payload.size(); }
+
+  bool parse_from_string(const std::string_view binary) override;
   std::string serialize_to_string() const override;
+  size_t serialize_header(char * buf) const override;
+};
+
+// Header of a FrameDatagram with a non-owning view of its payload (e.g.,
+// into a receive buffer), so parsing does not copy or allocate
+struct FrameDatagramView
+{
+  FrameDatagramView() {}
+  FrameDatagramView(const FrameDatagram & datagram);
+
+  uint32_t frame_id {};
+  FrameType frame_type {};
+  uint16_t frag_id {};
+  uint16_t frag_cnt {};
+  uint16_t frame_width {};  // 0 if not carried (v2 beyond fragment 0)
+  uint16_t frame_height {};
+  uint64_t send_ts {};
+  size_t header_size {};
+
+  std::string_view payload {};
+
+  // the view is valid only as long as 'binary'; a v2 send_ts is unwrapped
+  // against the previous one, so it has the sender's low 32 bits (and
+  // differences between send_ts are right) but not the sender's high bits
+  bool parse_from_string(const std::string_view binary);
+
+  // make an owning datagram (the only copy of the payload)
+  FrameDatagram to_datagram() const;
+
+private:
+  bool parse_v2(const std::string_view binary);
+
+  // the largest v2 send_ts unwrapped so far (0 before the first)
+  static uint64_t last_v2_send_ts_;
 };
 
 struct TileDatagram : public BaseDatagram
@@ -91,12 +201,29 @@ struct TileDatagram : public BaseDatagram
   static void set_mtu(const size_t mtu);
   static size_t max_payload;
 
-  bool parse_from_string(const std::string & binary) override;
+  bool parse_from_string(const std::string_view binary) override;
   std::string serialize_to_string() const override;
+  size_t serialize_header(char * buf) const override;
 };
 
 /////////////////////////////////////////////////////////////////////
 
+struct AckMsg;
+struct ConfigMsg;
+struct SignalMsg;
+struct NackMsg;
+struct SackMsg;
+struct ReceiverReportMsg;
+struct PliMsg;
+struct ProbeMsg;
+struct ProbeAckMsg;
+
+// Result of parsing a message: the message itself held by value (no heap
+// allocation), or std::monostate if the data is not a valid message
+using ParsedMsg = std::variant<std::monostate, AckMsg, ConfigMsg, SignalMsg,
+                               NackMsg, SackMsg, ReceiverReportMsg, PliMsg,
+                               ProbeMsg, ProbeAckMsg>;
+
 // Base message class
 struct Msg
 {
@@ -104,7 +231,13 @@ struct Msg
     INVALID = 0, 
     ACK = 1,     
     CONFIG = 2,
-    SIGNAL = 3  
+    SIGNAL = 3,
+    NACK = 4,
+    SACK = 5,
+    REPORT = 6,
+    PLI = 7,
+    PROBE = 8,
+    PROBE_ACK = 9
   };
 
   Type type {Type::INVALID};
@@ -114,39 +247,70 @@ struct Msg
   virtual ~Msg() {} // q: what's this syntax? a: virtual destructor
 
   // factory method to make a (derived class of) Msg
-  static std::shared_ptr<Msg> parse_from_string(const std::string & binary);
+  static ParsedMsg parse_from_string(const std::string_view binary);
+
+  // serialize into 'buf' of at least serialized_size() bytes and return
+  // the size, without allocating
+  size_t serialize_to(char * buf, const size_t capacity) const;
+  std::string serialize_to_string() const;
 
   // virtual functions for overriding
   virtual size_t serialized_size() const;
-  virtual std::string serialize_to_string() const;
+
+protected:
+  // write the fields (of each derived class after its base) to the writer
+  virtual void write_to(WireWriter & writer) const;
 };
 
 struct AckMsg : Msg
 {
   AckMsg() : Msg(Type::ACK) {}
   AckMsg(const BaseDatagram & datagram);
+  AckMsg(const FrameDatagramView & datagram);
 
   uint32_t frame_id {}; 
   uint16_t frag_id {};  
   uint64_t send_ts {};  
 
+  static constexpr size_t WIRE_SIZE = sizeof(Type) + sizeof(uint32_t)
+                                      + sizeof(uint16_t) + sizeof(uint64_t);
+
   size_t serialized_size() const override; 
-  std::string serialize_to_string() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
 };
 
 struct ConfigMsg : Msg
 {
+  // how the receiver reports received datagrams
+  enum class Feedback : uint8_t {
+    ACK = 0,  // acknowledge every datagram
+    NACK = 1, // request retransmissions of missing datagrams only
+    SACK = 2  // acknowledge batches of datagrams cumulatively plus SACK blocks
+  };
+
   ConfigMsg() : Msg(Type::CONFIG) {} 
   ConfigMsg(const uint16_t _width, const uint16_t _height,
-            const uint16_t _frame_rate, const uint32_t _target_bitrate);  
+            const uint16_t _frame_rate, const uint32_t _target_bitrate,
+            const Feedback _feedback = Feedback::ACK,
+            const uint8_t _header_version = FrameDatagram::HEADER_V1,
+            const uint8_t _refresh_frames = 0);  
 
   uint16_t width {};         
   uint16_t height {};         
   uint16_t frame_rate {};    
   uint32_t target_bitrate {}; 
+  Feedback feedback {Feedback::ACK};
+  uint8_t header_version {FrameDatagram::HEADER_V1}; // the highest the receiver parses
+  // recover with intra-refresh waves of this many frames instead of key
+  // frames (0: key frames); the picture is clean again at the end of a wave
+  uint8_t refresh_frames {0};
 
   size_t serialized_size() const override;
-  std::string serialize_to_string() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
 };
 
 struct SignalMsg : Msg
@@ -157,7 +321,169 @@ struct SignalMsg : Msg
   uint32_t target_bitrate {}; 
 
   size_t serialized_size() const override;
-  std::string serialize_to_string() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
+};
+
+// Feedback in NACK mode: the datagrams the receiver is missing, sent when
+// losses are detected and periodically (with no ranges) as a heartbeat
+struct NackMsg : Msg
+{
+  // 'num_frags' fragments of frame 'frame_id' starting from 'first_frag';
+  // num_frags = 0 requests the whole frame (its fragment count is unknown)
+  struct Range
+  {
+    uint32_t frame_id {};
+    uint16_t first_frag {};
+    uint16_t num_frags {};
+  };
+
+  static constexpr size_t MAX_RANGES = 64;
+
+  NackMsg() : Msg(Type::NACK) {}
+
+  uint32_t next_frame {};     // all frames before are complete or given up
+  uint64_t echo_send_ts {};   // send_ts of the latest datagram received
+  uint32_t echo_delay_us {};  // time since that datagram was received
+  uint8_t num_ranges {};
+  std::array<Range, MAX_RANGES> ranges {};
+
+  // return false if the message is full
+  bool add_range(const uint32_t frame_id, const uint16_t first_frag,
+                 const uint16_t num_frags);
+
+  static constexpr size_t HEADER_SIZE = sizeof(Type) + sizeof(uint32_t)
+                                        + sizeof(uint64_t) + sizeof(uint32_t)
+                                        + sizeof(uint8_t);
+  static constexpr size_t RANGE_SIZE = sizeof(uint32_t) + 2 * sizeof(uint16_t);
+  static constexpr size_t MAX_WIRE_SIZE = HEADER_SIZE + MAX_RANGES * RANGE_SIZE;
+
+  size_t serialized_size() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
+};
+
+// Feedback in SACK mode, sent every ACK_EVERY datagrams, ACK_DELAY_US after
+// the oldest unacknowledged one, or right away when a hole appears
+struct SackMsg : Msg
+{
+  // a 64-fragment window of frame 'frame_id' starting at 'first_frag';
+  // bit i of 'bitmap' is set if fragment first_frag + i was received
+  struct Block
+  {
+    uint32_t frame_id {};
+    uint16_t first_frag {};
+    uint64_t bitmap {};
+  };
+
+  static constexpr size_t MAX_BLOCKS = 16;
+  static constexpr uint16_t BLOCK_FRAGS = 64;
+
+  static constexpr unsigned int ACK_EVERY = 32;     // datagrams
+  static constexpr uint64_t ACK_DELAY_US = 2000;    // max delay of an ACK
+
+  SackMsg() : Msg(Type::SACK) {}
+
+  SeqNum cumulative {};       // every datagram before it has been received
+  uint64_t echo_send_ts {};   // send_ts of the latest datagram received
+  uint32_t echo_delay_us {};  // time since that datagram was received
+  uint8_t num_blocks {};
+  std::array<Block, MAX_BLOCKS> blocks {};
+
+  static constexpr size_t HEADER_SIZE = sizeof(Type) + sizeof(uint32_t)
+                                        + sizeof(uint16_t) + sizeof(uint64_t)
+                                        + sizeof(uint32_t) + sizeof(uint8_t);
+  static constexpr size_t BLOCK_SIZE = sizeof(uint32_t) + sizeof(uint16_t)
+                                       + sizeof(uint64_t);
+  static constexpr size_t MAX_WIRE_SIZE = HEADER_SIZE + MAX_BLOCKS * BLOCK_SIZE;
+
+  size_t serialized_size() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
+};
+
+// Receiver report, sent on the signal socket every INTERVAL_US with the
+// receiver's view of the stream over the period since the last one
+struct ReceiverReportMsg : Msg
+{
+  static constexpr uint64_t INTERVAL_US = 100 * 1000;
+
+  ReceiverReportMsg() : Msg(Type::REPORT) {}
+
+  uint32_t interval_us {};       // length of the period
+  uint32_t received_kbps {};     // rate of all datagrams received
+  uint8_t loss_fraction {};      // datagrams lost in the period, in 1/256 (as RTCP)
+  uint32_t jitter_us {};         // inter-arrival jitter (RFC 3550 6.4.1)
+  uint16_t frames_completed {};  // frames completed in the period
+  uint16_t frames_skipped {};    // frames given up on in the period
+  uint32_t remb_kbps {};         // receiver-estimated maximum bitrate
+
+  static constexpr size_t WIRE_SIZE = sizeof(Type) + 2 * sizeof(uint32_t)
+                                      + sizeof(uint8_t) + sizeof(uint32_t)
+                                      + 2 * sizeof(uint16_t) + sizeof(uint32_t);
+
+  size_t serialized_size() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
+};
+
+// Picture loss indication, sent on the signal socket when the receiver
+// gives up on a frame: the sender answers with a key frame
+struct PliMsg : Msg
+{
+  PliMsg() : Msg(Type::PLI) {}
+  PliMsg(const uint32_t _frame_id) : Msg(Type::PLI), frame_id(_frame_id) {}
+
+  uint32_t frame_id {}; // the frame the receiver cannot decode
+
+  static constexpr size_t WIRE_SIZE = sizeof(Type) + sizeof(uint32_t);
+
+  size_t serialized_size() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
+};
+
+// Path MTU probe, sent with the DF bit on the signal socket and padded
+// with zeros so that the IP packet is 'mtu' bytes long (serialize_to()
+// writes the fields only; serialize_to_string() pads)
+struct ProbeMsg : Msg
+{
+  ProbeMsg() : Msg(Type::PROBE) {}
+  ProbeMsg(const uint32_t _seq, const uint16_t _mtu)
+    : Msg(Type::PROBE), seq(_seq), mtu(_mtu) {}
+
+  uint32_t seq {};
+  uint16_t mtu {}; // the probed path MTU
+
+  static constexpr size_t WIRE_SIZE = sizeof(Type) + sizeof(uint32_t) + sizeof(uint16_t);
+
+  size_t serialized_size() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
+};
+
+// The receiver's answer to a probe that arrived, on the signal socket
+struct ProbeAckMsg : Msg
+{
+  ProbeAckMsg() : Msg(Type::PROBE_ACK) {}
+  ProbeAckMsg(const ProbeMsg & probe)
+    : Msg(Type::PROBE_ACK), seq(probe.seq), mtu(probe.mtu) {}
+
+  uint32_t seq {};
+  uint16_t mtu {};
+
+  static constexpr size_t WIRE_SIZE = sizeof(Type) + sizeof(uint32_t) + sizeof(uint16_t);
+
+  size_t serialized_size() const override;
+
+protected:
+  void write_to(WireWriter & writer) const override;
 };
 
 #endif /* PROTOCOL_HH */
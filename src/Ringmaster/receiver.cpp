@@ -2,14 +2,22 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <memory>
 #include <stdexcept>
-#include <chrono>
 
 #include "Utils/conversion.hh"
 #include "Utils/udp_socket.hh"
+#include "Utils/io_uring.hh"
+#include "Utils/epoller.hh"
+#include "Utils/timerfd.hh"
 #include "Video/sdl.hh"
+#include "Utils/timestamp.hh"
 #include "protocol.hh"
+#include "nack_tracker.hh"
+#include "sack_tracker.hh"
+#include "report_tracker.hh"
 // #include "vp9_decoder.hh"
 #include "HWDecoder.hh"
 
@@ -29,8 +37,19 @@ void print_usage(const string & program_name)
   "                     1: decode but not display frames\n"
   "                     2: neither decode nor display frames\n"
   "-o, --output <file>  file to output performance results to\n"
-  "-v, --verbose        enable more logging for debugging"
+  "-v, --verbose        enable more logging for debugging\n"
   "--streamtime         total streaming time in seconds\n"
+  "--gro                receive with UDP generic receive offload\n"
+  "--io-uring           receive video datagrams with io_uring\n"
+  "--feedback <mode>    ack: acknowledge every datagram (default)\n"
+  "                     nack: request retransmissions of missing datagrams only\n"
+  "                     sack: acknowledge batches of datagrams (cumulative ACK + SACK)\n"
+  "--header-version <v> highest datagram header version to accept (1 or 2, default: 2)\n"
+  "--pli-ms <ms>        request a key frame once the next frame has been stuck\n"
+  "                     behind later, complete frames this long (default: 50;\n"
+  "                     0: wait for the sender to recover)\n"
+  "--intra-refresh <n>  ask the sender to recover with intra-refresh waves of\n"
+  "                     n frames instead of key frames (default: 0, key frames)\n"
   << endl;
 }
 
@@ -43,6 +62,12 @@ int main(int argc, char * argv[])
   string output_path;
   bool verbose = false;
   uint16_t total_stream_time = 60;
+  bool use_gro = false;
+  bool use_io_uring = false;
+  ConfigMsg::Feedback feedback = ConfigMsg::Feedback::ACK;
+  uint8_t header_version = FrameDatagram::HEADER_V2;
+  unsigned int pli_timeout_ms = 50;
+  uint8_t refresh_frames = 0;
 
   const option cmd_line_opts[] = {
     {"fps",     required_argument, nullptr, 'F'},
@@ -51,6 +76,12 @@ int main(int argc, char * argv[])
     {"output",  required_argument, nullptr, 'o'},
     {"verbose", no_argument,       nullptr, 'v'},
     {"streamtime", required_argument, nullptr, 'T'},
+    {"gro",     no_argument,       nullptr, 'G'},
+    {"io-uring", no_argument,      nullptr, 'U'},
+    {"feedback", required_argument, nullptr, 'B'},
+    {"header-version", required_argument, nullptr, 'H'},
+    {"pli-ms",  required_argument, nullptr, 'P'},
+    {"intra-refresh", required_argument, nullptr, 'R'},
     { nullptr,  0,                 nullptr,  0 },
   };
 
@@ -79,6 +110,38 @@ int main(int argc, char * argv[])
       case 'T':
         total_stream_time = narrow_cast<uint16_t>(strict_stoi(optarg));
         break;
+      case 'G':
+        use_gro = true;
+        break;
+      case 'U':
+        use_io_uring = true;
+        break;
+      case 'B':
+        if (string(optarg) == "ack") {
+          feedback = ConfigMsg::Feedback::ACK;
+        } else if (string(optarg) == "nack") {
+          feedback = ConfigMsg::Feedback::NACK;
+        } else if (string(optarg) == "sack") {
+          feedback = ConfigMsg::Feedback::SACK;
+        } else {
+          print_usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'H':
+        header_version = narrow_cast<uint8_t>(strict_stoi(optarg));
+        if (header_version != FrameDatagram::HEADER_V1 and
+            header_version != FrameDatagram::HEADER_V2) {
+          print_usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'P':
+        pli_timeout_ms = narrow_cast<unsigned int>(strict_stoi(optarg));
+        break;
+      case 'R':
+        refresh_frames = narrow_cast<uint8_t>(strict_stoi(optarg));
+        break;
       default:
         print_usage(argv[0]);
         return EXIT_FAILURE;
@@ -100,6 +163,11 @@ int main(int argc, char * argv[])
   video_sock.connect(peer_addr_video);
   LOG(LogLevel::INFO) << "Video session connected:" << peer_addr_video.str() << ":" << video_sock.local_address().str();
 
+  // coalesced datagrams are split back in UDPSocket::recv_batch()
+  if (use_gro and not video_sock.set_gro(true)) {
+    LOG(LogLevel::WARNING) << "UDP GRO is not supported by the kernel; receiving datagrams one by one";
+  }
+
   // create a RTCP socket and connect to the sender
   const auto signal_port = narrow_cast<uint16_t>(port + 1);
   UDPSocket signal_sock;
@@ -107,7 +175,8 @@ int main(int argc, char * argv[])
   signal_sock.connect(peer_addr_signal);
   LOG(LogLevel::INFO)<< "Signal session connected" << peer_addr_signal.str() << ":" << signal_sock.local_address().str();
 
-  const ConfigMsg init_config_msg(width, height, frame_rate, target_bitrate); 
+  const ConfigMsg init_config_msg(width, height, frame_rate, target_bitrate, feedback,
+                                  header_version, refresh_frames); 
   video_sock.send(init_config_msg.serialize_to_string());
   LOG(LogLevel::INFO) <<  "init_config_msg sent";
   const SignalMsg init_signal_msg(target_bitrate); 
@@ -117,44 +186,316 @@ int main(int argc, char * argv[])
   // Create the decoder
   HWDecoder decoder(width, height, lazy_level, output_path);
   decoder.set_verbose(verbose);
+  decoder.set_refresh_frames(refresh_frames);
 
-  // Main loop
-  const auto start_time = std::chrono::steady_clock::now();
-  auto last_time = std::chrono::steady_clock::now();
-  while (true) {
+  // Set the sockets to non-blocking now and receive in an event loop (a
+  // report, PLI or probe ACK that would block is dropped; the next one
+  // follows shortly)
+  video_sock.set_blocking(false);
+  signal_sock.set_blocking(false);
+  Epoller poller;
+  bool time_up = false;
+
+  // ACKs are serialized into preallocated buffers and sent in batches
+  vector<array<char, AckMsg::WIRE_SIZE>> ack_bufs(
+      UDPSocket::MAX_BATCH_SIZE * UDPSocket::MAX_GSO_SEGMENTS);
+  vector<string_view> ack_batch;
+  ack_batch.reserve(ack_bufs.size());
+
+  // Receive datagrams into preallocated buffers; each buffer is released as
+  // soon as its payload has been handed to the decoder
+  BufferPool recv_pool(2 * UDPSocket::MAX_BATCH_SIZE, UDPSocket::UDP_MTU);
+  vector<BufferPool::Lease> raw_batch;
+  raw_batch.reserve(UDPSocket::MAX_BATCH_SIZE * UDPSocket::MAX_GSO_SEGMENTS);
+
+  // In NACK mode, only missing datagrams are reported (plus a heartbeat)
+  const bool use_nack = feedback == ConfigMsg::Feedback::NACK;
+  NackTracker nack_tracker;
+  array<char, NackMsg::MAX_WIRE_SIZE> nack_buf;
+  vector<string_view> feedback_batch(1); // a single NACK or SACK for io_uring
+  uint64_t last_nack_ts = 0;
+  constexpr uint64_t nack_heartbeat_us = 50 * 1000;
+
+  unique_ptr<UringUDP> uring;
+  const auto send_nack = [&]()
+    {
+      const auto now = timestamp_us();
+      NackMsg nack;
+      if (not nack_tracker.make_nack(now, nack) and
+          now < last_nack_ts + nack_heartbeat_us) {
+        return;
+      }
+
+      const string_view data {nack_buf.data(), nack.serialize_to(nack_buf.data(), nack_buf.size())};
+      if (uring) {
+        feedback_batch[0] = data;
+        uring->send_batch(feedback_batch);
+      } else {
+        video_sock.send(data);
+      }
+      last_nack_ts = now;
+
+      if (verbose and nack.num_ranges > 0) {
+        LOG(LogLevel::INFO) << "Sent NACK: ranges=" << static_cast<unsigned int>(nack.num_ranges)
+             << " next_frame=" << nack.next_frame;
+      }
+    };
+
+  // In SACK mode, datagrams are acknowledged in batches
+  const bool use_sack = feedback == ConfigMsg::Feedback::SACK;
+  SackTracker sack_tracker;
+  array<char, SackMsg::MAX_WIRE_SIZE> sack_buf;
+  TimerWheel::TimerId sack_timer;
+
+  const auto send_sack = [&]()
+    {
+      poller.timers().cancel(sack_timer);
+
+      SackMsg sack;
+      sack_tracker.make_sack(timestamp_us(), sack);
+      const string_view data {sack_buf.data(), sack.serialize_to(sack_buf.data(), sack_buf.size())};
+      if (uring) {
+        feedback_batch[0] = data;
+        uring->send_batch(feedback_batch);
+      } else {
+        video_sock.send(data);
+      }
+
+      if (verbose) {
+        LOG(LogLevel::INFO) << "Sent SACK: cumulative=(" << sack.cumulative.first
+             << ", " << sack.cumulative.second << ") blocks="
+             << static_cast<unsigned int>(sack.num_blocks);
+      }
+    };
+
+  // Request a key frame once the decoder has been blocked on a frame for
+  // 'pli_timeout_us', and again every 'pli_timeout_us' while it still is
+  // (the PLI or the key frame may be lost too)
+  const uint64_t pli_timeout_us = pli_timeout_ms * 1000;
+  uint64_t last_pli_us = 0;
+  array<char, PliMsg::WIRE_SIZE> pli_buf;
+
+  const auto request_key_frame = [&]()
+    {
+      const auto blocked_since = decoder.blocked_since_us();
+      const uint64_t now = monotonic_us();
+      if (pli_timeout_us == 0 or not blocked_since or
+          now < max(*blocked_since, last_pli_us) + pli_timeout_us) {
+        return;
+      }
 
-    FrameDatagram datagram;
-    if (not datagram.parse_from_string(video_sock.recv().value())) {
-      throw runtime_error("failed to parse a datagram");
+      const PliMsg pli(decoder.next_frame());
+      signal_sock.send(string_view {pli_buf.data(), pli.serialize_to(pli_buf.data(), pli_buf.size())});
+      last_pli_us = now;
+
+      LOG(LogLevel::WARNING) << "* Recovery: requested a key frame (PLI) after frame "
+           << pli.frame_id << " was blocked for "
+           << (now - *blocked_since) / 1000 << " ms";
+    };
+
+  // Send the ACKs of a whole batch at once (ACKs that would block are
+  // dropped; the sender retransmits the datagrams anyway)
+  const auto flush_acks = [&]()
+    {
+      if (uring) {
+        uring->send_batch(ack_batch);
+      } else {
+        video_sock.send_batch(ack_batch);
+      }
+      ack_batch.clear();
+
+      while (decoder.next_frame_complete()) {
+        decoder.consume_next_frame();
+      }
+      request_key_frame();
+
+      if (use_nack) {
+        nack_tracker.clean_up_to(decoder.next_frame());
+        send_nack();
+      } else if (use_sack) {
+        sack_tracker.clean_up_to(decoder.next_frame());
+      }
+    };
+
+  // Receiver reports on the signal socket, whatever the feedback mode; the
+  // estimate starts from the requested bitrate (if any)
+  ReportTracker report_tracker(target_bitrate > 0 ? target_bitrate : 2000);
+  array<char, ReceiverReportMsg::WIRE_SIZE> report_buf;
+
+  // Acknowledge a received datagram (or one rebuilt from FEC parity, so
+  // that the sender does not retransmit it)
+  const auto acknowledge = [&](const FrameDatagramView & datagram)
+    {
+      if (datagram.frag_id >= datagram.frag_cnt) {
+        return; // parity is not tracked by the sender
+      }
+
+      if (use_nack) {
+        // Only look for missing datagrams
+        nack_tracker.on_datagram(datagram, timestamp_us());
+      } else if (use_sack) {
+        // Acknowledge now if due, or within SackMsg::ACK_DELAY_US
+        if (sack_tracker.on_datagram(datagram, timestamp_us())) {
+          send_sack();
+        } else if (not poller.timers().pending(sack_timer)) {
+          sack_timer = poller.timers().schedule(monotonic_us() + SackMsg::ACK_DELAY_US,
+            [&]()
+            {
+              if (sack_tracker.pending()) {
+                send_sack();
+              }
+            }
+          );
+        }
+      } else {
+        // Acknowledge the received datagram
+        if (ack_batch.size() == ack_bufs.size()) {
+          flush_acks();
+        }
+        char * ack_buf = ack_bufs[ack_batch.size()].data();
+        ack_batch.emplace_back(ack_buf, AckMsg(datagram).serialize_to(ack_buf, AckMsg::WIRE_SIZE));
+        if (verbose) {
+          LOG(LogLevel::INFO) << "Acked datagram: frame_id=" << datagram.frame_id
+               << " frag_id=" << datagram.frag_id << endl;
+        }
+      }
+    };
+
+  // Acknowledge a received datagram and hand it to the decoder
+  const auto handle_datagram = [&](const string_view raw_data)
+    {
+      // parse the header and view the payload in the receive buffer
+      FrameDatagramView datagram;
+      if (not datagram.parse_from_string(raw_data)) {
+        throw runtime_error("failed to parse a datagram");
+      }
+
+      acknowledge(datagram);
+      report_tracker.on_datagram(datagram, timestamp_us());
+
+      // The decoder copies the payload out of the receive buffer, which is
+      // the only copy between the socket and the reassembled frame
+      const auto recovered = decoder.add_datagram(datagram);
+      if (recovered) {
+        FrameDatagramView rebuilt = datagram;
+        rebuilt.frag_id = recovered->second;
+        rebuilt.payload = {};
+        acknowledge(rebuilt);
+      }
+    };
+
+  // Use io_uring if available; otherwise receive with recvmmsg
+  if (use_io_uring) {
+    try {
+      // datagrams may be as large as the sender's MTU allows
+      uring = make_unique<UringUDP>(video_sock, false, UDPSocket::MAX_GSO_SIZE);
+      LOG(LogLevel::INFO) << "Using io_uring";
+    } catch (const exception & e) {
+      LOG(LogLevel::WARNING) << "io_uring is not available (" << e.what()
+                             << "); falling back to recvmmsg";
     }
 
-    // Acknowledge the received datagram
-    AckMsg ack(datagram);
-    video_sock.send(ack.serialize_to_string());
-    if (verbose) {
-      LOG(LogLevel::INFO) << "Acked datagram: frame_id=" << datagram.frame_id
-           << " frag_id=" << datagram.frag_id << endl;
+    if (uring and use_gro) {
+      LOG(LogLevel::WARNING) << "UDP GRO is not used with io_uring";
+      video_sock.set_gro(false);
     }
+  }
+
+  if (uring) {
+    // Call whenever io_uring has completions
+    poller.register_event(uring->event_fd(), Epoller::In,
+      [&]()
+      {
+        uring->process_completions(handle_datagram);
+        flush_acks();
+      }
+    );
+  } else {
+    // Call whenever the video socket is readable
+    poller.register_event(video_sock, Epoller::In,
+      [&]()
+      {
+        while (true) {
+          // Receive all the datagrams that are already queued in one syscall
+          raw_batch.clear();
+          if (video_sock.recv_batch(recv_pool, raw_batch) == 0) { // EWOULDBLOCK; try again when data is available
+            break;
+          }
+
+          for (const auto & raw_data : raw_batch) {
+            handle_datagram(raw_data.data());
+          }
+
+          flush_acks();
+        }
+      }
+    );
+  }
 
+  // NACK losses once their reorder window expires, and send heartbeats,
+  // even when no datagrams arrive
+  if (use_nack) {
+    constexpr uint64_t nack_check_us = 2000;
+    poller.timers().schedule_periodic(monotonic_us() + nack_check_us, nack_check_us, send_nack);
+  }
 
-    // Use move() to transfer ownership of dynamically allocated memory
-    // After the move operation, the state of datagram is valid but unspecified.
-    // Cannot make any assumptions about its content, but can assign a new value to it or destroy it safely.
-    decoder.add_datagram(move(datagram));
+  poller.timers().schedule_periodic(monotonic_us() + ReceiverReportMsg::INTERVAL_US,
+    ReceiverReportMsg::INTERVAL_US,
+    [&]()
+    {
+      ReceiverReportMsg report;
+      report_tracker.make_report(timestamp_us(), decoder.frames_completed(),
+                                 decoder.frames_skipped(), report);
+      signal_sock.send(string_view {report_buf.data(), report.serialize_to(report_buf.data(), report_buf.size())});
 
-    while (decoder.next_frame_complete()) {
-      decoder.consume_next_frame();
+      if (verbose) {
+        LOG(LogLevel::INFO) << "Sent report: rate=" << report.received_kbps
+             << " loss=" << static_cast<unsigned int>(report.loss_fraction) << "/256"
+             << " jitter_us=" << report.jitter_us << " remb=" << report.remb_kbps;
+      }
     }
+  );
+
+  // Answer the sender's path MTU probes
+  array<char, ProbeAckMsg::WIRE_SIZE> probe_ack_buf;
+  poller.register_event(signal_sock, Epoller::In,
+    [&]()
+    {
+      while (true) {
+        const auto raw_data = signal_sock.recv();
+        if (not raw_data) { // EWOULDBLOCK; try again when data is available
+          break;
+        }
 
-    if (std::chrono::steady_clock::now() - last_time > std::chrono::seconds(1)) {
-      // do something every 1s
+        const ParsedMsg msg = Msg::parse_from_string(*raw_data);
+        if (const auto probe = get_if<ProbeMsg>(&msg)) {
+          const ProbeAckMsg ack(*probe);
+          signal_sock.send(string_view {probe_ack_buf.data(),
+                                        ack.serialize_to(probe_ack_buf.data(), probe_ack_buf.size())});
+          if (verbose) {
+            LOG(LogLevel::INFO) << "Answered path MTU probe: seq=" << ack.seq << " mtu=" << ack.mtu;
+          }
+        }
+      }
     }
-    last_time = std::chrono::steady_clock::now();
+  );
 
-    if (std::chrono::steady_clock::now() - start_time > std::chrono::seconds(total_stream_time)) {
-      LOG(LogLevel::INFO) << "Time's up!";
-      break;
+  // Stop streaming after 'total_stream_time' seconds
+  Timerfd stream_timer;
+  stream_timer.set_time({total_stream_time, 0}, {0, 0}); // one-shot
+  poller.register_event(stream_timer, Epoller::In,
+    [&]()
+    {
+      if (stream_timer.read_expirations() > 0) {
+        LOG(LogLevel::INFO) << "Time's up!";
+        time_up = true;
+      }
     }
+  );
+
+  // Main loop
+  while (not time_up) {
+    poller.poll(-1);
   }
 
   return EXIT_SUCCESS;
@@ -0,0 +1,33 @@
+#ifndef REMB_CONTROLLER_HH
+#define REMB_CONTROLLER_HH
+
+#include "congestion_controller.hh"
+
+// Receiver-driven congestion control: follow the maximum bitrate estimated
+// by the receiver from the arrival timing of the datagrams, as reported in
+// its ReceiverReportMsgs, independently of the per-datagram feedback
+class RembController : public CongestionController
+{
+public:
+  RembController(const unsigned int start_kbps) : target_kbps_(start_kbps) {}
+
+  void on_acked(const size_t, const uint64_t) override {}
+  void on_arrival(const uint64_t, const uint64_t, const size_t) override {}
+  void on_lost(const size_t, const uint64_t) override {}
+  void on_rtt_sample(const uint64_t, const uint64_t) override {}
+
+  void on_remb(const unsigned int remb_kbps, const uint64_t) override
+  {
+    if (remb_kbps > 0) {
+      target_kbps_ = remb_kbps;
+    }
+  }
+
+  unsigned int target_bitrate_kbps() const override { return target_kbps_; }
+  const char * name() const override { return "remb"; }
+
+private:
+  unsigned int target_kbps_;
+};
+
+#endif /* REMB_CONTROLLER_HH */
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cmath>
+
+#include "report_tracker.hh"
+
+using namespace std;
+
+ReportTracker::ReportTracker(const unsigned int start_kbps)
+  : estimator_(start_kbps)
+{}
+
+void ReportTracker::on_datagram(const FrameDatagramView & datagram,
+                                const uint64_t now_us)
+{
+  if (period_start_us_ == 0) {
+    period_start_us_ = now_us;
+  }
+
+  const size_t size = datagram.header_size + datagram.payload.size();
+  period_bytes_ += size;
+
+  // RFC 3550 6.4.1: J += (|D(i-1, i)| - J) / 16
+  const int64_t transit_us = static_cast<int64_t>(now_us) - static_cast<int64_t>(datagram.send_ts);
+  if (prev_transit_us_) {
+    const double d = llabs(transit_us - *prev_transit_us_);
+    jitter_us_ += (d - jitter_us_) / 16;
+  }
+  prev_transit_us_ = transit_us;
+
+  // arrival timing of every datagram (retransmissions included, as they
+  // carry their own send timestamps)
+  estimator_.on_arrival(datagram.send_ts, now_us, size);
+  estimator_.on_acked(size, now_us);
+
+  if (datagram.frag_cnt == 0 or datagram.frag_id >= datagram.frag_cnt) {
+    return;
+  }
+
+  const SeqNum seq_num {datagram.frame_id, datagram.frag_id};
+  if (highest_ and seq_num <= *highest_) {
+    return; // reordered or retransmitted; counted as lost already
+  }
+
+  if (highest_) {
+    const auto & [highest_frame, highest_frag] = *highest_;
+    if (seq_num.first == highest_frame) {
+      period_lost_ += seq_num.second - highest_frag - 1;
+    } else {
+      // the rest of the highest frame, whole frames in between (assumed
+      // as large as this one), and the start of this frame
+      const unsigned int frames_between = min(seq_num.first - highest_frame - 1, 1000u);
+      period_lost_ += highest_frag_cnt_ - highest_frag - 1
+                      + frames_between * datagram.frag_cnt + seq_num.second;
+    }
+  }
+
+  period_received_++;
+  highest_ = seq_num;
+  highest_frag_cnt_ = datagram.frag_cnt;
+}
+
+void ReportTracker::make_report(const uint64_t now_us,
+                                const uint64_t frames_completed,
+                                const uint64_t frames_skipped,
+                                ReceiverReportMsg & report)
+{
+  const uint64_t interval_us = period_start_us_ > 0 and now_us > period_start_us_
+                               ? now_us - period_start_us_ : ReceiverReportMsg::INTERVAL_US;
+
+  report.interval_us = interval_us;
+  report.received_kbps = period_bytes_ * 8 * 1000 / interval_us;
+
+  const unsigned int expected = period_received_ + period_lost_;
+  report.loss_fraction = expected > 0 ? min(period_lost_ * 256 / expected, 255u) : 0;
+  report.jitter_us = lrint(jitter_us_);
+
+  report.frames_completed = min<uint64_t>(frames_completed - last_frames_completed_, UINT16_MAX);
+  report.frames_skipped = min<uint64_t>(frames_skipped - last_frames_skipped_, UINT16_MAX);
+  last_frames_completed_ = frames_completed;
+  last_frames_skipped_ = frames_skipped;
+
+  report.remb_kbps = estimator_.target_bitrate_kbps();
+
+  // start a new period
+  period_start_us_ = now_us;
+  period_bytes_ = 0;
+  period_received_ = 0;
+  period_lost_ = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef REPORT_TRACKER_HH
+#define REPORT_TRACKER_HH
+
+#include <optional>
+
+#include "protocol.hh"
+#include "gcc_controller.hh"
+
+// Receiver side of the receiver reports: measures the received rate, loss
+// and jitter of the datagrams, and estimates the maximum bitrate from their
+// arrival timing (as REMB does) with a delay-based controller of its own
+class ReportTracker
+{
+public:
+  // 'start_kbps' is where the estimate starts from
+  ReportTracker(const unsigned int start_kbps);
+
+  // call for every received datagram; 'now_us' is timestamp_us()
+  void on_datagram(const FrameDatagramView & datagram, const uint64_t now_us);
+
+  // fill in 'report' for the period since the last one and start a new
+  // period; 'frames_completed' and 'frames_skipped' are the decoder's totals
+  void make_report(const uint64_t now_us, const uint64_t frames_completed,
+                   const uint64_t frames_skipped, ReceiverReportMsg & report);
+
+private:
+  // the current period
+  uint64_t period_start_us_ {0};
+  size_t period_bytes_ {0};
+  unsigned int period_received_ {0};
+  unsigned int period_lost_ {0};
+
+  // losses are the datagrams skipped over by the highest one received
+  std::optional<SeqNum> highest_ {};
+  uint16_t highest_frag_cnt_ {0};
+
+  // inter-arrival jitter; the transit time includes the clock offset,
+  // which cancels out in the differences
+  std::optional<int64_t> prev_transit_us_ {};
+  double jitter_us_ {0.0};
+
+  // decoder totals at the last report
+  uint64_t last_frames_completed_ {0};
+  uint64_t last_frames_skipped_ {0};
+
+  // receiver-side bandwidth estimation
+  GccController estimator_;
+};
+
+#endif /* REPORT_TRACKER_HH */
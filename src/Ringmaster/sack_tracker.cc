@@ -0,0 +1,158 @@
+#include <algorithm>
+
+#include "sack_tracker.hh"
+
+using namespace std;
+
+bool SackTracker::on_datagram(const FrameDatagramView & datagram,
+                              const uint64_t now_us)
+{
+  // echo the newest send timestamp for the sender's RTT samples
+  if (datagram.send_ts > latest_send_ts_) {
+    latest_send_ts_ = datagram.send_ts;
+    latest_recv_us_ = now_us;
+  }
+
+  // acknowledge duplicates and old datagrams too, in case a SACK was lost
+  if (num_pending_++ == 0) {
+    oldest_pending_us_ = now_us;
+  }
+
+  const SeqNum seq_num {datagram.frame_id, datagram.frag_id};
+  if (seq_num < cumulative_ or datagram.frag_cnt == 0
+      or datagram.frag_id >= datagram.frag_cnt) {
+    return num_pending_ >= SackMsg::ACK_EVERY;
+  }
+
+  auto & frame = frames_[datagram.frame_id];
+  if (frame.frag_cnt == 0) {
+    frame.frag_cnt = datagram.frag_cnt;
+    frame.received.resize(frame.frag_cnt);
+  } else if (datagram.frag_cnt != frame.frag_cnt) {
+    return num_pending_ >= SackMsg::ACK_EVERY; // inconsistent with the other fragments
+  }
+
+  if (frame.received[datagram.frag_id]) {
+    // a duplicate (e.g., a retransmission after a lost SACK): report its
+    // window again
+    const bool blocks_full = mark_dirty(seq_num);
+    return blocks_full or num_pending_ >= SackMsg::ACK_EVERY;
+  }
+  frame.received[datagram.frag_id] = true;
+
+  const bool hole = leaves_hole(seq_num);
+  if (not highest_ or seq_num > *highest_) {
+    highest_ = seq_num;
+  }
+
+  advance_cumulative();
+
+  const bool blocks_full = mark_dirty(seq_num);
+
+  return hole or blocks_full or num_pending_ >= SackMsg::ACK_EVERY;
+}
+
+bool SackTracker::mark_dirty(const SeqNum & seq_num)
+{
+  if (seq_num < cumulative_) {
+    return false; // covered by the cumulative point
+  }
+
+  // report the window of a datagram beyond the cumulative point
+  const SeqNum window {seq_num.first,
+                       static_cast<uint16_t>(seq_num.second - seq_num.second % SackMsg::BLOCK_FRAGS)};
+  if (find(dirty_windows_.begin(), dirty_windows_.end(), window) == dirty_windows_.end()) {
+    dirty_windows_.push_back(window);
+  }
+
+  return dirty_windows_.size() >= SackMsg::MAX_BLOCKS;
+}
+
+bool SackTracker::leaves_hole(const SeqNum & seq_num) const
+{
+  if (not highest_) {
+    return seq_num > cumulative_;
+  }
+
+  if (seq_num <= *highest_) {
+    return false; // fills a hole (or is reordered) rather than leaving one
+  }
+
+  const auto & [highest_frame, highest_frag] = *highest_;
+  if (seq_num.first == highest_frame) {
+    return seq_num.second > highest_frag + 1;
+  }
+
+  // a later frame: the rest of the highest frame and the start of this one
+  // must have been skipped for no hole
+  const auto it = frames_.find(highest_frame);
+  const bool highest_frame_done = it == frames_.end() or
+                                  highest_frag + 1 == it->second.frag_cnt;
+  return not highest_frame_done or seq_num.first > highest_frame + 1
+         or seq_num.second > 0;
+}
+
+void SackTracker::advance_cumulative()
+{
+  while (true) {
+    const auto it = frames_.find(cumulative_.first);
+    if (it == frames_.end()) {
+      return; // the fragment count of the next frame is unknown yet
+    }
+
+    const auto & frame = it->second;
+    while (cumulative_.second < frame.frag_cnt and frame.received[cumulative_.second]) {
+      cumulative_.second++;
+    }
+
+    if (cumulative_.second < frame.frag_cnt) {
+      return;
+    }
+
+    // the frame is complete
+    frames_.erase(it);
+    cumulative_ = {cumulative_.first + 1, 0};
+  }
+}
+
+void SackTracker::clean_up_to(const uint32_t frontier)
+{
+  if (frontier <= cumulative_.first) {
+    return;
+  }
+
+  frames_.erase(frames_.begin(), frames_.lower_bound(frontier));
+  cumulative_ = {frontier, 0};
+  advance_cumulative();
+}
+
+void SackTracker::make_sack(const uint64_t now_us, SackMsg & sack)
+{
+  sack.cumulative = cumulative_;
+  sack.echo_send_ts = latest_send_ts_;
+  sack.echo_delay_us = latest_send_ts_ ? now_us - latest_recv_us_ : 0;
+  sack.num_blocks = 0;
+
+  for (const auto & [frame_id, first_frag] : dirty_windows_) {
+    const auto it = frames_.find(frame_id);
+    if (it == frames_.end() or sack.num_blocks == SackMsg::MAX_BLOCKS) {
+      continue; // covered by the cumulative point by now
+    }
+
+    const auto & frame = it->second;
+    const uint32_t end = min<uint32_t>(first_frag + SackMsg::BLOCK_FRAGS, frame.frag_cnt);
+    uint64_t bitmap = 0;
+    for (uint32_t frag_id = first_frag; frag_id < end; frag_id++) {
+      if (frame.received[frag_id]) {
+        bitmap |= uint64_t(1) << (frag_id - first_frag);
+      }
+    }
+
+    if (bitmap != 0) {
+      sack.blocks[sack.num_blocks++] = {frame_id, first_frag, bitmap};
+    }
+  }
+
+  dirty_windows_.clear();
+  num_pending_ = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef SACK_TRACKER_HH
+#define SACK_TRACKER_HH
+
+#include <map>
+#include <vector>
+#include <optional>
+
+#include "protocol.hh"
+
+// Receiver side of SACK mode: keeps the cumulative ACK point and the
+// fragments received beyond it, and batches them into SackMsgs
+class SackTracker
+{
+public:
+  // call for every received datagram; 'now_us' is timestamp_us()
+  // return true if a SACK should be sent right away (ACK_EVERY datagrams
+  // are unacknowledged, or the datagram leaves a hole behind it)
+  bool on_datagram(const FrameDatagramView & datagram, const uint64_t now_us);
+
+  // move the cumulative point past the frames before 'frontier' (consumed
+  // or skipped by the decoder), even if some of them were never received
+  void clean_up_to(const uint32_t frontier);
+
+  // fill in 'sack' and reset the unacknowledged datagrams
+  void make_sack(const uint64_t now_us, SackMsg & sack);
+
+  // if any datagram has not been acknowledged, and when the oldest arrived
+  bool pending() const { return num_pending_ > 0; }
+  uint64_t oldest_pending_us() const { return oldest_pending_us_; }
+
+private:
+  struct FrameState
+  {
+    uint16_t frag_cnt {0};
+    std::vector<bool> received {};
+  };
+
+  // frames at or after the cumulative point
+  std::map<uint32_t, FrameState> frames_ {};
+
+  // the next datagram expected in order
+  SeqNum cumulative_ {0, 0};
+
+  // the highest datagram received
+  std::optional<SeqNum> highest_ {};
+
+  // 64-fragment windows (frame_id, first_frag) changed since the last SACK
+  std::vector<SeqNum> dirty_windows_ {};
+
+  unsigned int num_pending_ {0};
+  uint64_t oldest_pending_us_ {0};
+
+  // for the sender's RTT samples
+  uint64_t latest_send_ts_ {0};
+  uint64_t latest_recv_us_ {0};
+
+  // advance 'cumulative_' over the datagrams received in order
+  void advance_cumulative();
+
+  // add the window of a received datagram beyond the cumulative point to
+  // the next SACK; returns true if the SACK is full
+  bool mark_dirty(const SeqNum & seq_num);
+
+  // if 'seq_num' skips over datagrams not received after 'highest_'
+  bool leaves_hole(const SeqNum & seq_num) const;
+};
+
+#endif /* SACK_TRACKER_HH */
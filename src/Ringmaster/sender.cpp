@@ -1,25 +1,49 @@
 #include <getopt.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <stdexcept>
 #include <utility>
+#include <variant>
+#include <optional>
+#include <functional>
 #include <chrono>
 #include <thread>
+#include <cerrno>
+#include <system_error>
 
 #include "Utils/conversion.hh"
 #include "Utils/timerfd.hh"
 #include "Utils/udp_socket.hh"
-#include "Utils/poller.hh"
+#include "Utils/io_uring.hh"
+#include "Utils/epoller.hh"
 #include "Video/yuv4mpeg.hh"
 #include "protocol.hh"
 #include "HWEncoder.hh"
+#include "gcc_controller.hh"
+#include "bbr_controller.hh"
+#include "remb_controller.hh"
+#include "pacer.hh"
+#include "pmtu_prober.hh"
 #include "Utils/timestamp.hh"
 
 #include "NvCodecUtils.h"
 
 namespace {
   constexpr unsigned int BILLION = 1000 * 1000 * 1000;
+
+  // start rate of a congestion controller if the receiver asks for none
+  constexpr unsigned int DEFAULT_START_KBPS = 2000;
+
+  // pacing rate as a multiple of the target bitrate (WebRTC's pacing factor)
+  constexpr double DEFAULT_PACING_GAIN = 2.5;
+
+  // largest MTU probed for by default (jumbo frames)
+  constexpr size_t DEFAULT_MAX_MTU = 9000;
 }
 
 
@@ -28,7 +52,36 @@ void print_usage(const std::string & program_name)
   std::cerr <<
   "Usage: " << program_name << " [options] port y4m\n\n"
   "Options:\n"
-  "--mtu <MTU>                MTU for deciding UDP payload size\n"
+  "--mtu <MTU>                MTU for deciding UDP payload size (default: 1500;\n"
+  "                           the base MTU with --pmtud)\n"
+  "--pmtud                    probe the path for a larger MTU (with the DF bit\n"
+  "                           set) and size the datagrams accordingly\n"
+  "--max-mtu <MTU>            largest MTU to probe for (default: 9000, and at\n"
+  "                           most the interface's)\n"
+  "--gso                      send frames with UDP segmentation offload\n"
+  "--io-uring                 send and receive video datagrams with io_uring\n"
+  "--cc <static|gcc|bbr|remb> congestion control: a static bitrate set by the\n"
+  "                           receiver (default), delay-based (GCC-style),\n"
+  "                           model-based (BBR-style) or the receiver's estimate\n"
+  "--pacing <off|bucket|txtime>\n"
+  "                           spread datagrams over time: not at all (default),\n"
+  "                           with a token bucket, or with SO_TXTIME departure\n"
+  "                           times (needs the fq qdisc on the interface)\n"
+  "--pacing-gain <gain>       pacing rate as a multiple of the target bitrate\n"
+  "                           (default 2.5; BBR paces at its own rate)\n"
+  "--latency-ms <ms>          target latency: drop datagrams of frames that\n"
+  "                           would arrive later than this after capture\n"
+  "                           instead of retransmitting them (default: off)\n"
+  "--max-queue-ms <ms>        skip encoding raw frames while the send buffer\n"
+  "                           takes longer than this to drain at the pacing\n"
+  "                           rate (default: off)\n"
+  "--fec                      add XOR parity datagrams to every frame, as many\n"
+  "                           as the loss rate in the receiver reports calls for\n"
+  "--ltr                      recover from losses by predicting from a long-term\n"
+  "                           reference the receiver has decoded, instead of\n"
+  "                           with a key frame or refresh wave when possible\n"
+  "--header-version <1|2>     highest datagram header version to send; the\n"
+  "                           receiver may ask for a lower one (default: 2)\n"
   "-o, --output <file>        file to output performance results to\n"
   "-v, --verbose              enable more logging for debugging"
   << std::endl;
@@ -38,15 +91,13 @@ std::pair<Address, ConfigMsg> recv_config_msg(UDPSocket & udp_sock)
 {
   while (true) {
     const auto & [peer_addr, raw_data] = udp_sock.recvfrom();
-    const std::shared_ptr<Msg> msg = Msg::parse_from_string(raw_data.value());
-    if (msg == nullptr or msg->type != Msg::Type::CONFIG) {
+    const ParsedMsg msg = Msg::parse_from_string(raw_data.value());
+    const auto config_msg = std::get_if<ConfigMsg>(&msg);
+    if (config_msg == nullptr) {
       std::cerr << "Unknown message type received on video port." << std::endl;
       continue; 
     }
-    const auto config_msg = dynamic_pointer_cast<ConfigMsg>(msg);
-    if (config_msg) {
-      return {peer_addr, *config_msg};
-    }
+    return {peer_addr, *config_msg};
   }
 }
 
@@ -54,15 +105,13 @@ std::pair<Address, SignalMsg> recv_signal_msg(UDPSocket & udp_sock)
 {
   while (true) {
     const auto & [peer_addr, raw_data] = udp_sock.recvfrom();
-    const std::shared_ptr<Msg> msg = Msg::parse_from_string(raw_data.value());
-    if (msg == nullptr or msg->type != Msg::Type::SIGNAL) {
+    const ParsedMsg msg = Msg::parse_from_string(raw_data.value());
+    const auto signal_msg = std::get_if<SignalMsg>(&msg);
+    if (signal_msg == nullptr) {
       std::cerr << "Unknown message type received on signal port." << std::endl;
       continue; 
     }
-    const auto signal_msg = dynamic_pointer_cast<SignalMsg>(msg);
-    if (signal_msg) {
-      return {peer_addr, *signal_msg};
-    }
+    return {peer_addr, *signal_msg};
   }
 }
 
@@ -70,9 +119,33 @@ int main(int argc, char * argv[])
 {
   std::string output_path;
   bool verbose = false;
+  bool use_gso = false;
+  bool use_io_uring = false;
+  std::string cc = "static";
+  std::string pacing = "off";
+  double pacing_gain = DEFAULT_PACING_GAIN;
+  bool use_fec = false;
+  bool use_ltr = false;
+  unsigned int latency_ms = 0;
+  unsigned int max_queue_ms = 0;
+  unsigned int header_version = FrameDatagram::HEADER_V2;
+  bool use_pmtud = false;
+  size_t max_mtu = DEFAULT_MAX_MTU;
 
   const option cmd_line_opts[] = {
     {"mtu",     required_argument, nullptr, 'M'},
+    {"pmtud",   no_argument,       nullptr, 'D'},
+    {"max-mtu", required_argument, nullptr, 'X'},
+    {"gso",     no_argument,       nullptr, 'G'},
+    {"io-uring", no_argument,      nullptr, 'U'},
+    {"cc",      required_argument, nullptr, 'C'},
+    {"pacing",  required_argument, nullptr, 'P'},
+    {"pacing-gain", required_argument, nullptr, 'g'},
+    {"fec",     no_argument,       nullptr, 'F'},
+    {"ltr",     no_argument,       nullptr, 'T'},
+    {"latency-ms", required_argument, nullptr, 'L'},
+    {"max-queue-ms", required_argument, nullptr, 'Q'},
+    {"header-version", required_argument, nullptr, 'H'},
     {"output",  required_argument, nullptr, 'o'},
     {"verbose", no_argument,       nullptr, 'v'},
     { nullptr,  0,                 nullptr,  0 },
@@ -88,6 +161,42 @@ int main(int argc, char * argv[])
       case 'M':
         FrameDatagram::set_mtu(strict_stoi(optarg));
         break;
+      case 'D':
+        use_pmtud = true;
+        break;
+      case 'X':
+        max_mtu = narrow_cast<size_t>(strict_stoi(optarg));
+        break;
+      case 'G':
+        use_gso = true;
+        break;
+      case 'U':
+        use_io_uring = true;
+        break;
+      case 'C':
+        cc = optarg;
+        break;
+      case 'P':
+        pacing = optarg;
+        break;
+      case 'g':
+        pacing_gain = std::stod(optarg);
+        break;
+      case 'F':
+        use_fec = true;
+        break;
+      case 'T':
+        use_ltr = true;
+        break;
+      case 'L':
+        latency_ms = narrow_cast<unsigned int>(strict_stoi(optarg));
+        break;
+      case 'Q':
+        max_queue_ms = narrow_cast<unsigned int>(strict_stoi(optarg));
+        break;
+      case 'H':
+        header_version = narrow_cast<unsigned int>(strict_stoi(optarg));
+        break;
       case 'o':
         output_path = optarg;
         break;
@@ -105,6 +214,38 @@ int main(int argc, char * argv[])
     return EXIT_FAILURE;
   }
 
+  if (cc != "static" and cc != "gcc" and cc != "bbr" and cc != "remb") {
+    std::cerr << "Unknown congestion control: " << cc << std::endl;
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (pacing != "off" and pacing != "bucket" and pacing != "txtime") {
+    std::cerr << "Unknown pacing mode: " << pacing << std::endl;
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (header_version != FrameDatagram::HEADER_V1 and
+      header_version != FrameDatagram::HEADER_V2) {
+    std::cerr << "Unknown header version: " << header_version << std::endl;
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (use_pmtud and (max_mtu < FrameDatagram::MIN_MTU or max_mtu > FrameDatagram::MAX_MTU)) {
+    std::cerr << "Max MTU must be between " << FrameDatagram::MIN_MTU
+              << " and " << FrameDatagram::MAX_MTU << std::endl;
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (pacing_gain <= 0) {
+    std::cerr << "Pacing gain must be positive" << std::endl;
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
   const auto video_port = narrow_cast<uint16_t>(strict_stoi(argv[optind]));
   const auto signal_port = narrow_cast<uint16_t>(video_port + 1);
   const std::string yuv_path = argv[optind + 1];
@@ -130,7 +271,78 @@ int main(int argc, char * argv[])
   std::cerr << "Received config: width=" << std::to_string(width)
        << " height=" << std::to_string(height)
        << " FPS=" << std::to_string(frame_rate)
-       << " bitrate=" << std::to_string(target_bitrate) << std::endl;
+       << " bitrate=" << std::to_string(target_bitrate)
+       << " feedback=" << std::array{"ack", "nack", "sack"}.at(static_cast<size_t>(init_config_msg.feedback))
+       << " header_version=" << std::to_string(init_config_msg.header_version)
+       << " refresh_frames=" << std::to_string(init_config_msg.refresh_frames)
+       << std::endl;
+
+  // the highest header version both ends speak
+  FrameDatagram::set_header_version(std::min<unsigned int>(
+    header_version, std::max<unsigned int>(init_config_msg.header_version, FrameDatagram::HEADER_V1)));
+  LOG(LogLevel::INFO) << "Datagram header version: "
+                      << std::to_string(FrameDatagram::header_version);
+
+  // Path MTU discovery: DF on the video datagrams and on the probes (sent
+  // on the signal socket, to the same host), up to the interface's MTU
+  std::unique_ptr<PmtuProber> pmtu_prober;
+  if (use_pmtud) {
+    video_sock.set_pmtu_probe();
+    signal_sock.set_pmtu_probe();
+    max_mtu = std::min(max_mtu, video_sock.path_mtu());
+    pmtu_prober = std::make_unique<PmtuProber>(std::min(FrameDatagram::mtu(), max_mtu), max_mtu);
+    FrameDatagram::set_mtu(pmtu_prober->mtu());
+    LOG(LogLevel::INFO) << "Path MTU discovery: base=" << pmtu_prober->mtu()
+                        << " max=" << max_mtu;
+  }
+
+  // Fall back to batched sends if the kernel does not support GSO
+  if (use_gso and not video_sock.gso_supported()) {
+    LOG(LogLevel::WARNING) << "UDP GSO is not supported by the kernel; falling back to sendmmsg";
+    use_gso = false;
+  }
+
+  // Use io_uring for the video socket if available (with zero-copy sends
+  // where the kernel supports them); otherwise stay with the socket calls
+  std::unique_ptr<UringUDP> uring;
+  if (use_io_uring) {
+    try {
+      // send buffers large enough for any MTU the prober may settle on
+      const size_t max_datagram_size = pmtu_prober ? max_mtu - 28 : FrameDatagram::max_datagram_size();
+      uring = std::make_unique<UringUDP>(video_sock, true, max_datagram_size, max_datagram_size);
+      LOG(LogLevel::INFO) << "Using io_uring (zero-copy send: "
+                          << (uring->zero_copy() ? "on" : "off") << ")";
+    } catch (const std::exception & e) {
+      LOG(LogLevel::WARNING) << "io_uring is not available (" << e.what()
+                             << "); falling back to sendmmsg/recvmmsg";
+    }
+
+    if (uring and use_gso) {
+      LOG(LogLevel::WARNING) << "UDP GSO is not used with io_uring";
+      use_gso = false;
+    }
+  }
+
+  // Pace in the kernel if possible; io_uring sends carry no control
+  // messages, and the segments of a GSO buffer would share one departure time
+  Pacer pacer(pacing == "bucket" ? Pacer::Mode::BUCKET
+              : pacing == "txtime" ? Pacer::Mode::TXTIME : Pacer::Mode::OFF);
+  if (pacer.mode() == Pacer::Mode::TXTIME) {
+    if (uring) {
+      LOG(LogLevel::WARNING) << "SO_TXTIME is not used with io_uring; falling back to a token bucket";
+      pacer.set_mode(Pacer::Mode::BUCKET);
+    } else if (not video_sock.set_txtime()) {
+      LOG(LogLevel::WARNING) << "SO_TXTIME is not supported by the kernel; falling back to a token bucket";
+      pacer.set_mode(Pacer::Mode::BUCKET);
+    } else if (use_gso) {
+      LOG(LogLevel::WARNING) << "UDP GSO is not used with SO_TXTIME";
+      use_gso = false;
+    }
+  }
+  if (pacer.mode() != Pacer::Mode::OFF) {
+    LOG(LogLevel::INFO) << "Pacing: " << (pacer.mode() == Pacer::Mode::BUCKET ? "bucket" : "txtime")
+                        << " (gain=" << double_to_string(pacing_gain) << ")";
+  }
 
   // Set UDP socket to non-blocking now
   video_sock.set_blocking(false);
@@ -146,28 +358,265 @@ int main(int argc, char * argv[])
   }
 
   // Create the encoder
-  HWEncoder encoder(width, height, frame_rate, output_path);
+  HWEncoder encoder(width, height, frame_rate, output_path, init_config_msg.refresh_frames,
+                    use_ltr);
   encoder.set_target_bitrate(target_bitrate);
   encoder.set_verbose(verbose);
+  encoder.set_feedback(init_config_msg.feedback);
+  encoder.set_fec(use_fec);
+  encoder.set_target_latency(latency_ms);
+
+  // The congestion controller takes over the bitrate from the receiver
+  if (cc != "static") {
+    const unsigned int start_kbps = target_bitrate > 0 ? target_bitrate : DEFAULT_START_KBPS;
+    if (cc == "gcc") {
+      encoder.set_congestion_controller(std::make_unique<GccController>(start_kbps));
+    } else if (cc == "bbr") {
+      encoder.set_congestion_controller(std::make_unique<BbrController>(start_kbps));
+    } else {
+      encoder.set_congestion_controller(std::make_unique<RembController>(start_kbps));
+    }
+    LOG(LogLevel::INFO) << "Congestion control: " << cc << " (start bitrate=" << start_kbps << ")";
+  }
 
   // Allocate a host frame container
   int nHostFrameSize = encoder.getEncodedFrameSize(); 
   std::unique_ptr<uint8_t[]> pHostFrame(new uint8_t[nHostFrameSize]); 
 
   // Create a periodic timer
-  Poller poller;
+  Epoller poller;
   Timerfd fps_timer;
   const timespec frame_interval {0, static_cast<long>(BILLION / frame_rate)}; // {sec, nsec}
   fps_timer.set_time(frame_interval, frame_interval); // {initial expiration, interval}
 
 
+  // Send as many datagrams in the send buffer as the socket (or io_uring)
+  // accepts now
+  // headers are serialized into 'header_bufs' and sent along with the
+  // payloads in place (scatter-gather), so payloads are never copied here
+  std::vector<std::array<char, FrameDatagram::HEADER_SIZE>> header_bufs(
+      std::max(UDPSocket::MAX_BATCH_SIZE, UDPSocket::MAX_GSO_SEGMENTS));
+  std::vector<UDPSocket::Gather> send_batch;
+  send_batch.reserve(header_bufs.size());
+  unsigned int num_datagrams_sent = 0; // reset every stats interval
+  unsigned int num_send_calls = 0;
+  unsigned int num_frames_dropped = 0;
+
+  // The rate at which the pacer drains the send buffer (or would, if
+  // pacing is off): the congestion controller's pacing rate if it has one
+  const auto pacing_rate_bps = [&]() -> uint64_t
+    {
+      const CongestionController * cc_ptr = encoder.congestion_controller();
+      if (cc_ptr and cc_ptr->pacing_rate_kbps() > 0) {
+        return cc_ptr->pacing_rate_kbps() * 1000ULL;
+      }
+      return pacing_gain * encoder.target_bitrate_kbps() * 1000;
+    };
+
+  // While the pacer holds datagrams back, a one-shot timer requests the
+  // next send instead of the socket becoming writable
+  TimerWheel::TimerId pacing_timer;
+  std::function<void()> request_send;
+  std::function<void()> update_rtx_timer;
+
+  const auto flush_send_buf = [&]()
+    {
+      std::deque<FrameDatagram> & send_buf = encoder.send_buf();
+
+      pacer.set_rate(pacing_rate_bps());
+
+      bool paced = false;
+      uint64_t now = monotonic_us();
+
+      while (not send_buf.empty()) {
+        size_t batch_size = 0;
+        size_t num_sent = 0;
+        now = monotonic_us();
+
+        if (use_gso) {
+          // coalesce datagrams of equal size (only the last one may be shorter)
+          // into a super-buffer that the kernel segments
+          send_batch.clear();
+          size_t gso_size = 0;
+          const size_t segment_size = send_buf.front().serialized_size();
+
+          while (batch_size < send_buf.size() and batch_size < UDPSocket::MAX_GSO_SEGMENTS) {
+            auto & datagram = send_buf[batch_size];
+            const size_t datagram_size = datagram.serialized_size();
+            if (datagram_size > segment_size or
+                gso_size + datagram_size > UDPSocket::MAX_GSO_SIZE) {
+              break;
+            }
+            if (pacer.next_send_us(now) > now) {
+              paced = true;
+              break;
+            }
+
+            datagram.send_ts = timestamp_us(); // timestamp the sending time before sending
+            char * header = header_bufs[batch_size].data();
+            send_batch.push_back({{header, datagram.serialize_header(header)}, datagram.payload});
+            pacer.on_send(datagram_size, now);
+            gso_size += datagram_size;
+            batch_size++;
+
+            if (datagram_size < segment_size) {
+              break;
+            }
+          }
+
+          if (batch_size == 0) {
+            break; // paced out
+          }
+          num_sent = video_sock.send_gso(send_batch, segment_size) ? batch_size : 0;
+        } else {
+          const size_t max_batch_size = std::min(send_buf.size(), UDPSocket::MAX_BATCH_SIZE);
+
+          send_batch.clear();
+          for (; batch_size < max_batch_size; batch_size++) {
+            if (pacer.next_send_us(now) > now) {
+              paced = true;
+              break;
+            }
+
+            auto & datagram = send_buf[batch_size];
+            datagram.send_ts = timestamp_us(); // timestamp the sending time before sending
+            char * header = header_bufs[batch_size].data();
+            UDPSocket::Gather gather {{header, datagram.serialize_header(header)}, datagram.payload};
+            gather.txtime = pacer.on_send(gather.size(), now);
+            if (uring) { // sent in place from the encoded frame's slab
+              gather.payload_owner = datagram.payload_owner;
+              gather.tag = (static_cast<uint64_t>(datagram.frame_id) << 16) | datagram.frag_id;
+            }
+            send_batch.push_back(std::move(gather));
+          }
+
+          if (batch_size == 0) {
+            break; // paced out
+          }
+          num_sent = uring ? uring->send_batch(send_batch)  // fewer when all send slots are in flight
+                           : video_sock.send_batch(send_batch);
+        }
+
+        num_send_calls++;
+        num_datagrams_sent += num_sent;
+
+        for (size_t i = 0; i < num_sent; i++) {
+          auto & datagram = send_buf.front();
+          if (verbose) {
+            LOG(LogLevel::INFO) << "Sent datagram: frame_id=" << datagram.frame_id
+                 << " frag_id=" << datagram.frag_id
+                 << " frag_cnt=" << datagram.frag_cnt
+                 << " rtx=" << datagram.num_rtx << std::endl;
+          }
+
+          // Mark as unacked if not a retransmission
+          if (datagram.num_rtx == 0) {
+            encoder.add_unacked(std::move(datagram));
+          }
+
+          send_buf.pop_front();
+        }
+
+        if (num_sent < batch_size) { // EWOULDBLOCK (or no free send slot) midway; try again later
+          for (size_t i = 0; i < batch_size - num_sent; i++) {
+            send_buf[i].send_ts = 0; // since it wasn't sent successfully
+          }
+          for (size_t i = batch_size; i > num_sent; i--) {
+            pacer.undo_send(send_batch[i - 1].size());
+          }
+          paced = false; // wait for the socket instead
+          break;
+        }
+
+        if (paced) {
+          break;
+        }
+      }
+
+      if (paced and not send_buf.empty() and not poller.timers().pending(pacing_timer)) {
+        pacing_timer = poller.timers().schedule(pacer.next_send_us(now),
+          [&]()
+          {
+            request_send();
+            update_rtx_timer();
+          }
+        );
+      }
+    };
+
+  // Flush the send buffer: with io_uring right away (completions trigger
+  // further flushes), otherwise whenever the socket is writable; while
+  // paced out, only once the pacing timer fires
+  request_send = [&]()
+    {
+      if (encoder.send_buf().empty() or poller.timers().pending(pacing_timer)) {
+        return;
+      }
+
+      if (uring) {
+        flush_send_buf();
+      } else {
+        poller.activate(video_sock, Epoller::Out);
+      }
+    };
+
+  // Keep a wheel timer in sync with the encoder's retransmission timer;
+  // call whenever datagrams are sent or ACKed
+  TimerWheel::TimerId rtx_timer;
+  std::optional<uint64_t> rtx_deadline;
+  update_rtx_timer = [&]()
+    {
+      const auto deadline = encoder.next_timeout_us();
+      if (deadline == rtx_deadline) {
+        return;
+      }
+
+      poller.timers().cancel(rtx_timer);
+      rtx_deadline = deadline;
+      if (not deadline) {
+        return;
+      }
+
+      // the encoder keeps timestamp_us() time while the wheel is monotonic
+      const auto now = timestamp_us();
+      const uint64_t delay_us = *deadline > now ? *deadline - now : 0;
+      rtx_timer = poller.timers().schedule(monotonic_us() + delay_us,
+        [&]()
+        {
+          rtx_deadline.reset();
+          encoder.handle_timeout();  // tail loss probe or RTO
+          request_send();
+          update_rtx_timer();
+        }
+      );
+    };
+
+  if (not uring) {
+    poller.register_event(video_sock, Epoller::Out,
+      [&]()
+      {
+        flush_send_buf();
+        update_rtx_timer();
+
+        // Not interested in socket event if no datagrams to send (or the
+        // pacer holds them back)
+        if (encoder.send_buf().empty() or poller.timers().pending(pacing_timer)) {
+          poller.deactivate(video_sock, Epoller::Out);
+        }
+      }
+    );
+  }
+
   // Call Encoder at periodic time intervals,
   std::streamsize nRead = 0;
-  poller.register_event(fps_timer, Poller::In,
+  poller.register_event(fps_timer, Epoller::In,
     [&]()
     {
       // being lenient: read raw frames 'num_exp' times and use the last one
       const auto num_exp = fps_timer.read_expirations(); 
+      if (num_exp == 0) {
+        return;
+      }
       if (num_exp > 1) {
         std::cerr << "Warning: skipping " << num_exp - 1 << " raw frames" << std::endl;
       }
@@ -183,119 +632,219 @@ int main(int argc, char * argv[])
         }    
       }
 
+      // backpressure: rather than queue another frame behind a send buffer
+      // that takes too long to drain, skip this one (the raw frame is read
+      // anyway to keep the frame clock)
+      if (max_queue_ms > 0) {
+        const uint64_t queue_delay_us = encoder.queue_delay_us(pacing_rate_bps());
+        if (queue_delay_us > max_queue_ms * 1000ULL) {
+          num_frames_dropped++;
+          LOG(LogLevel::WARNING) << "Skipped encoding a frame: queued="
+               << encoder.send_buf_bytes() << " bytes, drain_ms="
+               << double_to_string(queue_delay_us / 1000.0);
+
+          request_send();
+          return;
+        }
+      }
+
       encoder.compress_frame(pHostFrame);
 
       // interested in socket being writable if there are datagrams to send
-      if (not encoder.send_buf().empty()) {
-        poller.activate(video_sock, Poller::Out);
-      }
+      request_send();
+      update_rtx_timer();  // unless the encoder gave up on unacked datagrams
     }
   );
 
-  // Call whenever there are datagrams to send
-  poller.register_event(video_sock, Poller::Out,
-    [&]()
+  const auto handle_ack_datagram = [&](const std::string_view raw_data)
     {
-      std::deque<FrameDatagram> & send_buf = encoder.send_buf();
+      const ParsedMsg msg = Msg::parse_from_string(raw_data);
+      if (const auto nack = std::get_if<NackMsg>(&msg)) {
+        encoder.handle_nack(*nack);  // RTT estimation, requested retransmissions
+        return;
+      }
 
-      while (not send_buf.empty()) {
-        auto & datagram = send_buf.front();
-        datagram.send_ts = timestamp_us(); // timestamp the sending time before sending
+      if (const auto sack = std::get_if<SackMsg>(&msg)) {
+        encoder.handle_sack(*sack);  // RTT estimation, retransmission, etc.
+        return;
+      }
 
-        if (video_sock.send(datagram.serialize_to_string())) {
-          if (verbose) {
-            LOG(LogLevel::INFO) << "Sent datagram: frame_id=" << datagram.frame_id
-                 << " frag_id=" << datagram.frag_id
-                 << " frag_cnt=" << datagram.frag_cnt
-                 << " rtx=" << datagram.num_rtx << std::endl;
-          }
+      const auto ack = std::get_if<AckMsg>(&msg);
+      if (ack == nullptr) {  // ignore invalid or non-ACK messages
+        return;
+      }
 
-          // Mark as unacked if not a retransmission
-          if (datagram.num_rtx == 0) {
-            encoder.add_unacked(std::move(datagram));
-          }
+      if (verbose) {
+        LOG(LogLevel::INFO) << "Received ACK: frame_id=" << ack->frame_id
+             << " frag_id=" << ack->frag_id;
+      }
 
-          send_buf.pop_front();
+      encoder.handle_ack(*ack);  // RTT estimation, retransmission, etc.
+    };
+
+  // Receive ACKs into preallocated buffers rather than a string per datagram
+  BufferPool ack_pool(UDPSocket::MAX_BATCH_SIZE, UDPSocket::UDP_MTU);
+  std::vector<BufferPool::Lease> raw_batch;
+  raw_batch.reserve(UDPSocket::MAX_BATCH_SIZE);
+
+  if (uring) {
+    // Call whenever io_uring has completions: received ACKs or sent datagrams
+    poller.register_event(uring->event_fd(), Epoller::In,
+      [&]()
+      {
+        uring->process_completions(handle_ack_datagram,
+          [&](const uint64_t tag, const int err)
+          {
+            // send again what the kernel had no room for; anything else is
+            // lost and left to the retransmission logic
+            if (err == EAGAIN or err == ENOBUFS or err == ENOMEM) {
+              encoder.requeue_unsent({static_cast<uint32_t>(tag >> 16),
+                                      static_cast<uint16_t>(tag & 0xFFFF)});
+            }
+          }
+        );
 
-        } else { // EWOULDBLOCK; try again later
-          datagram.send_ts = 0; // since it wasn't sent successfully
-          break;
-        }
+        // Flush the send buffer (retransmissions or freed send slots)
+        request_send();
+        update_rtx_timer();
       }
+    );
+  } else {
+    // Call whenever the data socket is readable
+    poller.register_event(video_sock, Epoller::In,
+      [&]()
+      {
+        while (true) {
+          raw_batch.clear();  // return the buffers of the previous batch
+          if (video_sock.recv_batch(ack_pool, raw_batch) == 0) { // EWOULDBLOCK; try again when data is available
+            break;
+          }
 
-      if (send_buf.empty()) {  // Not interested in socket event if no datagrams to send
-        poller.deactivate(video_sock, Poller::Out);
-      }
-    }
-  );
+          for (const auto & raw_data : raw_batch) {
+            handle_ack_datagram(raw_data.data());
+          }
 
-  // Call whenever the data socket is readable
-  poller.register_event(video_sock, Poller::In,
-    [&]()
-    {
-      while (true) {
-        const auto & raw_data = video_sock.recv();
-        if (not raw_data) { // EWOULDBLOCK; try again when data is available
-          break;
-        }
-        const std::shared_ptr<Msg> msg = Msg::parse_from_string(*raw_data);
-        if (msg == nullptr or msg->type != Msg::Type::ACK) {  // ignore invalid or non-ACK messages
-          return;
+          // Flush the send buffer
+          request_send();
+          update_rtx_timer();
         }
+      }
+    );
+  }
 
-        const auto ack = dynamic_pointer_cast<AckMsg>(msg);
-
-        if (verbose) {
-          LOG(LogLevel::INFO) << "Received ACK: frame_id=" << ack->frame_id
-               << " frag_id=" << ack->frag_id;
+  // Probe the path MTU and resize the datagrams of the frames encoded from
+  // now on (the ones already packetized keep their size)
+  if (pmtu_prober) {
+    constexpr uint64_t probe_interval_us = 50 * 1000;
+    poller.timers().schedule_periodic(monotonic_us() + probe_interval_us, probe_interval_us,
+      [&]()
+      {
+        const uint64_t now = monotonic_us();
+        pmtu_prober->on_path_mtu(video_sock.path_mtu(), now);
+
+        const auto probe = pmtu_prober->next_probe(now, encoder.rto_us());
+        if (probe) {
+          try {
+            signal_sock.send(probe->serialize_to_string());  // dropped if it would block
+          } catch (const std::system_error & e) {
+            if (e.code().value() != EMSGSIZE) {
+              throw;
+            }
+            pmtu_prober->on_probe_rejected(*probe, now);
+          }
         }
 
-        encoder.handle_ack(ack);  // RTT estimation, retransmission, etc.
-
-        // Flush the send buffer
-        if (not encoder.send_buf().empty()) {
-          poller.activate(video_sock, Poller::Out);
+        if (pmtu_prober->mtu() != FrameDatagram::mtu()) {
+          LOG(LogLevel::INFO) << "Path MTU: " << FrameDatagram::mtu()
+                              << " -> " << pmtu_prober->mtu();
+          FrameDatagram::set_mtu(pmtu_prober->mtu());
         }
       }
-    }
-  );
+    );
+  }
 
   // output Enc stats every second
-  Timerfd stats_timer;
-  const timespec stats_interval {1, 0};
-  stats_timer.set_time(stats_interval, stats_interval);
-  poller.register_event(stats_timer, Poller::In,
+  constexpr uint64_t stats_interval_us = 1000000;
+  poller.timers().schedule_periodic(monotonic_us() + stats_interval_us, stats_interval_us,
     [&]()
     {
-      if (stats_timer.read_expirations() == 0) {
-        return;
-      }
       encoder.output_periodic_stats();
+
+      LOG(LogLevel::INFO) << "  - Datagrams/send calls: " << num_datagrams_sent
+           << "/" << num_send_calls;
+      if (max_queue_ms > 0) {
+        LOG(LogLevel::INFO) << "  - Frames skipped for queuing delay: " << num_frames_dropped;
+      }
+      if (pmtu_prober) {
+        LOG(LogLevel::INFO) << "  - Path MTU" << (pmtu_prober->searching() ? " (searching)" : "")
+             << ": " << pmtu_prober->mtu() << " (probes sent/acked: "
+             << pmtu_prober->num_probes_sent() << "/" << pmtu_prober->num_probes_acked() << ")";
+      }
+      num_datagrams_sent = 0;
+      num_send_calls = 0;
+      num_frames_dropped = 0;
     }
   );
 
   // Call whenever the signal socket is readable
-  poller.register_event(signal_sock, Poller::In, 
+  poller.register_event(signal_sock, Epoller::In, 
     [&]() 
     {
       while (true) {
         const auto & raw_data = signal_sock.recv();
         if (not raw_data) { // EWOULDBLOCK; try again when data is available
-        std::cerr << "Unknown message type received on RTCP port." << std::endl;
           break;
         }
-        const std::shared_ptr<Msg> sig_msg = Msg::parse_from_string(*raw_data);
-
-       if (sig_msg->type == Msg::Type::SIGNAL) {
-          const auto signal = dynamic_pointer_cast<SignalMsg>(sig_msg);
-          // Parse the signal message
-          std::cerr << "Received signal: bitrate=" << signal->target_bitrate
-               << std::endl;
-          
-          // Update the encoder configuration
-          encoder.set_target_bitrate(signal->target_bitrate);
+        const ParsedMsg sig_msg = Msg::parse_from_string(*raw_data);
+
+        // Receiver reports feed the congestion controller, if any
+        if (const auto report = std::get_if<ReceiverReportMsg>(&sig_msg)) {
+          if (verbose) {
+            LOG(LogLevel::INFO) << "Received report: rate=" << report->received_kbps
+                 << " loss=" << double_to_string(report->loss_fraction / 256.0)
+                 << " jitter_us=" << report->jitter_us
+                 << " frames=" << report->frames_completed << "/" << report->frames_skipped
+                 << " remb=" << report->remb_kbps;
+          }
+
+          if (encoder.congestion_controller()) {
+            encoder.congestion_controller()->on_remb(report->remb_kbps, timestamp_us());
+          }
+          encoder.update_loss_rate(report->loss_fraction / 256.0);
+          continue;
         }
-        return;
+
+        // the receiver gave up on a frame: answer with a key frame
+        if (const auto pli = std::get_if<PliMsg>(&sig_msg)) {
+          encoder.handle_pli(*pli);
+          continue;
+        }
+
+        if (const auto probe_ack = std::get_if<ProbeAckMsg>(&sig_msg)) {
+          if (pmtu_prober) {
+            pmtu_prober->on_probe_ack(*probe_ack, monotonic_us());
+          }
+          continue;
+        }
+
+        const auto signal = std::get_if<SignalMsg>(&sig_msg);
+        if (signal == nullptr) {
+          std::cerr << "Unknown message type received on RTCP port." << std::endl;
+          continue;
+        }
+
+        // Parse the signal message
+        std::cerr << "Received signal: bitrate=" << signal->target_bitrate
+             << std::endl;
+
+        // Update the encoder configuration unless a congestion controller
+        // is in charge of the bitrate
+        if (encoder.congestion_controller()) {
+          std::cerr << "Ignoring the signaled bitrate under congestion control ("
+               << encoder.congestion_controller()->name() << ")" << std::endl;
+          continue;
+        }
+        encoder.set_target_bitrate(signal->target_bitrate);
       }
     }
   );
@@ -122,6 +122,11 @@ bool Decoder::add_datagram_common(const FrameDatagram & datagram)
     return false;
   }
 
+  // no FEC recovery here: ignore parity datagrams (frag_id >= frag_cnt)
+  if (datagram.frag_id >= frag_cnt) {
+    return false;
+  }
+
   if (not frame_buf_.count(frame_id)) {
     // initialize a Frame instance for frame 'frame_id'
     frame_buf_.emplace(piecewise_construct, 
@@ -168,16 +173,20 @@ bool Decoder::next_frame_complete()
     const auto frame_id = it->first;
     const auto & frame = it->second;
 
-    // found a complete key frame ahead of next_frame_
-    if (frame.type() == FrameType::KEY and frame.complete()) {
+    // found a complete key frame (or a frame predicted only from an LTR
+    // decoded earlier) ahead of next_frame_
+    const bool ltr_recovery = frame.type() == FrameType::RECOVERY;
+    if ((frame.type() == FrameType::KEY or ltr_recovery) and frame.complete()) {
       assert(frame_id > next_frame_);
 
       // set next_frame_ to frame_id and clean up old frames
       const auto frame_diff = frame_id - next_frame_;
       advance_next_frame(frame_diff);
+      num_frames_skipped_ += frame_diff;
 
       cerr << "* Recovery: skipped " << frame_diff
-           << " frames ahead to key frame " << frame_id << endl;
+           << " frames ahead to " << (ltr_recovery ? "LTR recovery frame " : "key frame ")
+           << frame_id << endl;
 
       return true;
     }
@@ -195,6 +204,7 @@ void Decoder::consume_next_frame()
 
   // found a decodable frame; update (and output) stats
   num_decodable_frames_++;
+  num_frames_completed_++;
   const size_t frame_size = frame.frame_size().value();
   total_decodable_frame_size_ += frame_size;
   // output stats 
@@ -274,7 +284,7 @@ double Decoder::decode_frame(vpx_codec_ctx_t & context, const Frame & frame)
   const uint8_t * const buf_end = buf_ptr + decode_buf.size();
 
   for (const auto & datagram : frame.frags()) {
-    const string & payload = datagram.value().payload;
+    const string_view payload = datagram.value().payload;
 
     if (buf_ptr + payload.size() >= buf_end) {
       throw runtime_error("frame size exceeds max decoding buffer size");
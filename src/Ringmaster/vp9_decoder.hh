@@ -92,6 +92,8 @@ public:
 
   // accessors
   uint32_t next_frame() const { return next_frame_; }
+  uint64_t frames_completed() const { return num_frames_completed_; }
+  uint64_t frames_skipped() const { return num_frames_skipped_; }
 
   // mutators
   void set_verbose(const bool verbose) { verbose_ = verbose; }
@@ -115,6 +117,8 @@ private:
 
   // next frame ID to decode
   uint32_t next_frame_ {0};
+  uint64_t num_frames_completed_ {0}; // totals since the start
+  uint64_t num_frames_skipped_ {0};
 
   // frame ID => class Frame
   std::map<uint32_t, Frame> frame_buf_ {};
@@ -6,6 +6,7 @@
 #include <chrono>
 #include <algorithm>
 #include <limits>
+#include <cmath>
 
 #include "vp9_encoder.hh"
 #include "conversion.hh"
@@ -115,6 +116,16 @@ void Encoder::compress_frame(const RawImage & raw_img)
 
   const auto frame_generation_ts = timestamp_us();
 
+  // apply the congestion controller's target unless it barely changed
+  if (cc_) {
+    const unsigned int target_kbps = cc_->target_bitrate_kbps();
+    const double curr_kbps = static_cast<double>(target_bitrate_);
+    if (target_kbps > 0 and
+        fabs(target_kbps - curr_kbps) > CC_MIN_CHANGE * curr_kbps) {
+      set_target_bitrate(target_kbps);
+    }
+  }
+
   // encode raw_img into encoder_pkt buffered in the ctx
   encode_frame(raw_img);
 
@@ -150,6 +161,12 @@ void Encoder::encode_frame(const RawImage & raw_img)
 
   // default: normal frame
   vpx_enc_frame_flags_t encode_flags = 0;
+  curr_frame_type_ = FrameType::UNKNOWN;
+
+  // an LTR is acknowledged once every frame up to it has been delivered
+  if (ltr_enabled_) {
+    ltr_.on_delivered_up_to(first_outstanding_frame());
+  }
   
   // cleaning the pacakge buffer before encoding a new frame
   if (not unacked_.empty()) {
@@ -158,9 +175,25 @@ void Encoder::encode_frame(const RawImage & raw_img)
 
     // give up if first unacked datagram was initially sent MAX_UNACKED_US ago
     if (us_since_first_send > MAX_UNACKED_US) {
-      encode_flags = VPX_EFLAG_FORCE_KF; // force next frame to be key frame
-      cerr << "* Recovery: gave up retransmissions and forced a key frame "
-           << frame_id_ << endl;
+      ltr_.invalidate_from(first_unacked.frame_id);
+
+      // predict from the newest LTR the receiver has decoded only: not from
+      // the last frame, nor from the other (unacknowledged) LTR slot
+      const auto ltr = ltr_enabled_ ? ltr_.newest_acked() : nullopt;
+      if (ltr) {
+        encode_flags = VP8_EFLAG_NO_REF_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF
+                       | (ltr->slot == 0 ? VP8_EFLAG_NO_REF_ARF : VP8_EFLAG_NO_REF_GF);
+        ltr_.invalidate_from(ltr->frame_id + 1);
+        num_ltr_recoveries_++;
+        curr_frame_type_ = FrameType::RECOVERY;
+        cerr << "* Recovery: gave up retransmissions and forced an LTR recovery frame "
+             << frame_id_ << " (from frame " << ltr->frame_id << ")" << endl;
+      } else {
+        encode_flags = VPX_EFLAG_FORCE_KF; // force next frame to be key frame
+        ltr_.clear();
+        cerr << "* Recovery: gave up retransmissions and forced a key frame "
+             << frame_id_ << endl;
+      }
 
       if (verbose_) {
         cerr << "Giving up on lost datagram: frame_id="
@@ -175,6 +208,10 @@ void Encoder::encode_frame(const RawImage & raw_img)
     }
   }
 
+  if (ltr_enabled_ and encode_flags == 0) {
+    encode_flags = ltr_flags();
+  }
+
   // encode a frame and calculate encoding time
   const auto encode_start = steady_clock::now();
   check_call(vpx_codec_encode(&context_, raw_img.get_vpx_image(), frame_id_, 1,
@@ -215,9 +252,15 @@ size_t Encoder::packetize_encoded_frame(uint16_t width, uint16_t height)
       auto frame_type = FrameType::NONKEY;
       if (encoder_pkt->data.frame.flags & VPX_FRAME_IS_KEY) {
         frame_type = FrameType::KEY;
+        ltr_.clear();  // a key frame replaces all references
         if (verbose_) {
           cerr << "Encoded a key frame: frame_id=" << frame_id_ << endl;
         }
+      } else if (curr_frame_type_ == FrameType::RECOVERY) {
+        frame_type = FrameType::RECOVERY;
+        if (verbose_) {
+          cerr << "Encoded an LTR recovery frame: frame_id=" << frame_id_ << endl;
+        }
       }
 
       // calculate the total fragments to send
@@ -242,8 +285,38 @@ size_t Encoder::packetize_encoded_frame(uint16_t width, uint16_t height)
   return frame_size;
 }
 
+vpx_enc_frame_flags_t Encoder::ltr_flags()
+{
+  // keep the golden and altref frames as they are, unless a new LTR is due
+  vpx_enc_frame_flags_t flags = VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+
+  const auto slot = ltr_.slot_to_mark();
+  if (slot) {
+    flags &= ~(*slot == 0 ? VP8_EFLAG_NO_UPD_GF : VP8_EFLAG_NO_UPD_ARF);
+    ltr_.on_marked(*slot, frame_id_);
+  }
+
+  return flags;
+}
+
+uint32_t Encoder::first_outstanding_frame() const
+{
+  uint32_t first = frame_id_;
+  if (not unacked_.empty()) {
+    first = min(first, unacked_.begin()->first.first);
+  }
+  for (const auto & datagram : send_buf_) {
+    first = min(first, datagram.frame_id);
+  }
+  return first;
+}
+
 void Encoder::add_unacked(const FrameDatagram & datagram)
 {
+  if (unacked_.empty()) {  // not delivering while idle
+    delivered_ts_ = first_sent_ts_ = datagram.send_ts;
+  }
+
   const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
   auto [it, success] = unacked_.emplace(seq_num, datagram);
 
@@ -252,10 +325,17 @@ void Encoder::add_unacked(const FrameDatagram & datagram)
   }
 
   it->second.last_send_ts = it->second.send_ts;
+  it->second.delivered = delivered_bytes_;
+  it->second.delivered_ts = delivered_ts_;
+  it->second.first_sent_ts = first_sent_ts_;
 }
 
 void Encoder::add_unacked(FrameDatagram && datagram)
 {
+  if (unacked_.empty()) {  // not delivering while idle
+    delivered_ts_ = first_sent_ts_ = datagram.send_ts;
+  }
+
   const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
   auto [it, success] = unacked_.emplace(seq_num, move(datagram));
 
@@ -264,17 +344,21 @@ void Encoder::add_unacked(FrameDatagram && datagram)
   }
 
   it->second.last_send_ts = it->second.send_ts;
+  it->second.delivered = delivered_bytes_;
+  it->second.delivered_ts = delivered_ts_;
+  it->second.first_sent_ts = first_sent_ts_;
 }
 
-void Encoder::handle_ack(const shared_ptr<AckMsg> & ack)
+void Encoder::handle_ack(const AckMsg ack)
 {
   const auto curr_ts = timestamp_us();
 
   // observed an RTT sample
-  add_rtt_sample(curr_ts - ack->send_ts);
+  const uint64_t send_ts = extend_ts(ack.send_ts, curr_ts);  // echoed by the receiver
+  add_rtt_sample(curr_ts - send_ts);
 
   // find the acked datagram in 'unacked_'
-  const auto acked_seq_num = make_pair(ack->frame_id, ack->frag_id);
+  const auto acked_seq_num = make_pair(ack.frame_id, ack.frag_id);
   auto acked_it = unacked_.find(acked_seq_num);
 
   if (acked_it == unacked_.end()) {
@@ -282,6 +366,12 @@ void Encoder::handle_ack(const shared_ptr<AckMsg> & ack)
     return;
   }
 
+  if (cc_) {
+    cc_->on_rtt_sample(curr_ts - send_ts, curr_ts);
+    cc_->on_arrival(send_ts, curr_ts, acked_it->second.payload.size());
+  }
+  on_delivered(acked_it->second, curr_ts);
+
   // retransmit all unacked datagrams before the acked one (backward)
   for (auto rit = make_reverse_iterator(acked_it);
        rit != unacked_.rend(); rit++) {
@@ -295,6 +385,10 @@ void Encoder::handle_ack(const shared_ptr<AckMsg> & ack)
     // retransmit if it's the first RTX or the last RTX was about one RTT ago
     if (datagram.num_rtx == 0 or
         curr_ts - datagram.last_send_ts > ewma_rtt_us_.value()) {
+      if (cc_) {
+        cc_->on_lost(datagram.payload.size(), curr_ts);
+      }
+
       datagram.num_rtx++;
       datagram.last_send_ts = curr_ts;
 
@@ -307,6 +401,23 @@ void Encoder::handle_ack(const shared_ptr<AckMsg> & ack)
   unacked_.erase(acked_it);
 }
 
+void Encoder::on_delivered(const FrameDatagram & datagram, const uint64_t now_us)
+{
+  const size_t size = datagram.payload.size();
+  delivered_bytes_ += size;
+  delivered_ts_ = now_us;
+  first_sent_ts_ = datagram.send_ts;
+
+  if (cc_) {
+    // delivery rate over the longer of the send and ACK intervals
+    const uint64_t send_elapsed = datagram.send_ts - datagram.first_sent_ts;
+    const uint64_t ack_elapsed = now_us - datagram.delivered_ts;
+    cc_->on_acked(size, now_us);
+    cc_->on_rate_sample(delivered_bytes_ - datagram.delivered,
+                        max(send_elapsed, ack_elapsed), now_us);
+  }
+}
+
 void Encoder::add_rtt_sample(const unsigned int rtt_us)
 {
   // min RTT
@@ -337,7 +448,12 @@ void Encoder::output_periodic_stats()
          << "/" << double_to_string(*ewma_rtt_us_ / 1000.0) << endl;
   }
 
+  if (ltr_enabled_) {
+    cerr << "  - LTR recoveries: " << num_ltr_recoveries_ << endl;
+  }
+
   // reset all but RTT-related stats
+  num_ltr_recoveries_ = 0;
   num_encoded_frames_ = 0;
   total_encode_time_ms_ = 0.0;
   max_encode_time_ms_ = 0.0;
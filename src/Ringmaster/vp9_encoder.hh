@@ -14,6 +14,8 @@ extern "C" {
 #include "exception.hh"    
 #include "image.hh"
 #include "protocol.hh"
+#include "congestion_controller.hh"
+#include "ltr_tracker.hh"
 #include "file_descriptor.hh" 
 
 class Encoder
@@ -34,7 +36,7 @@ public:
   void add_unacked(FrameDatagram && datagram);
 
   // handle ACK
-  void handle_ack(const std::shared_ptr<AckMsg> & ack);
+  void handle_ack(const AckMsg ack);
 
   // output stats every second and reset some of them
   void output_periodic_stats();
@@ -48,6 +50,13 @@ public:
   void set_verbose(const bool verbose) { verbose_ = verbose; }
   void set_target_bitrate(const unsigned int bitrate_kbps);
 
+  // recover from losses by predicting from an acknowledged long-term
+  // reference (the golden or altref frame) instead of with a key frame
+  void set_ltr(const bool enabled) { ltr_enabled_ = enabled; }
+
+  // let a congestion controller drive the target bitrate
+  void set_congestion_controller(std::unique_ptr<CongestionController> cc) { cc_ = std::move(cc); }
+
   // forbid copying and moving
   Encoder(const Encoder & other) = delete;
   const Encoder & operator=(const Encoder & other) = delete;
@@ -66,12 +75,31 @@ private:
   // current target bitrate
   unsigned int target_bitrate_ {0};
 
+  // congestion controller (none for a static bitrate)
+  std::unique_ptr<CongestionController> cc_ {};
+  static constexpr double CC_MIN_CHANGE = 0.05;
+
+  // delivery rate sampling for the congestion controller
+  uint64_t delivered_bytes_ {0};
+  uint64_t delivered_ts_ {0};
+  uint64_t first_sent_ts_ {0};
+  void on_delivered(const FrameDatagram & datagram, const uint64_t now_us);
+
   // VPX encoding configuration and context
   vpx_codec_enc_cfg_t cfg_ {};
   vpx_codec_ctx_t context_ {};
 
   // frame ID to encode
   uint32_t frame_id_ {0};
+  FrameType curr_frame_type_ {FrameType::UNKNOWN};
+
+  // long-term references: LtrTracker slot 0 is the golden frame and slot 1
+  // the altref frame; regular frames only update the last frame
+  bool ltr_enabled_ {false};
+  LtrTracker ltr_ {};
+  unsigned int num_ltr_recoveries_ {0};
+  vpx_enc_frame_flags_t ltr_flags();
+  uint32_t first_outstanding_frame() const;
 
   // queue of datagrams (packetized video frames) to send
   std::deque<FrameDatagram> send_buf_ {};